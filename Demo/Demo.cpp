@@ -1,7 +1,25 @@
 #include <stack>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 #include "../Generator/Code/World/World.h"
+#include "../Generator/Code/Geometry/Geometry.h"
+#include "../Generator/Code/Pipeline/Profile.h"
+#include "../Generator/Code/Pipeline/Biome/BiomeStage.h"
+#include "../Generator/Code/Pipeline/Height/HeightStage.h"
 #include "../noise/Simplex/simplex.h"
 
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
 using namespace generator;
 using namespace landmass;
 
@@ -14,7 +32,7 @@ Attribute waterType {2, AttributeType::Vertex};
 Attribute biome {8, AttributeType::Cell};
 Attribute cellHeight {32, AttributeType::Cell};
 
-struct HeightGenerator: landmass::Generator {
+struct LandmassHeight: landmass::Generator {
     enum {Height, Moisture, Water};
 
     static constexpr float groupFrequency = 0.0003f;
@@ -23,7 +41,7 @@ struct HeightGenerator: landmass::Generator {
     // The maximum lake size we generate.
     static const U32 lakeSize = 200;
 
-    HeightGenerator(): Generator({&height, &moisture, &waterType}) {}
+    LandmassHeight(): Generator({&height, &moisture, &waterType}) {}
 
     virtual void generate(landmass::Chunk& chunk, ChunkMatrix& matrix, I32 seed) override {
         NoiseContext noise(120);
@@ -99,10 +117,10 @@ struct HeightGenerator: landmass::Generator {
     }
 };
 
-struct BiomeGenerator: landmass::Generator {
+struct LandmassBiome: landmass::Generator {
     enum {BiomeType, Height, VertexHeight, VertexWater};
 
-    BiomeGenerator(): Generator({&biome, &cellHeight, &height, &waterType}) {}
+    LandmassBiome(): Generator({&biome, &cellHeight, &height, &waterType}) {}
 
     virtual void generate(landmass::Chunk& chunk, ChunkMatrix& matrix, I32 seed) override {
         auto biomeAttribute = attribute(BiomeType);
@@ -161,19 +179,262 @@ struct BiomeGenerator: landmass::Generator {
     }
 };
 
-int main() {
+
+/**
+ * Headless world generation benchmark.
+ * Usage: genbench [--seed n] [--area width height] [--chunk-size log2] [--chunk-height log2]
+ *                 [--threads count] [--view chunks] [--stages landmass,terrain,geometry]
+ * Generates an area of chunks through the World and Pipeline, the same way a game would.
+ * Results are written to stdout as JSON, with a readable summary on stderr.
+ * The output hash only depends on the seed and the generated area, so it can be compared between machines and versions.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+static F64 secondsSince(Clock::time_point start) {
+    return std::chrono::duration<F64>(Clock::now() - start).count();
+}
+
+/// A stream generator stage that measures the time spent in it.
+/// Streams are generated lazily while filling chunks, so their time is part of the terrain time.
+struct Timed {
+    std::atomic<U64> nanoseconds {0};
+    std::atomic<U64> segments {0};
+
+    template<class F> void measure(F&& f) {
+        auto start = Clock::now();
+        f();
+        nanoseconds += (U64)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        segments++;
+    }
+};
+
+/// Generates rolling hills that fit within the chunk height.
+struct NoiseHeight: generator::HeightGenerator {
+    NoiseHeight(I32 seed, Size depth, Timed& timed): noise(seed), depth(depth), timed(timed) {}
+
+    void generate(const Segment& segment, TiledMatrix& heightMap, TiledMatrix** auxiliaries, Pipeline& pipeline) override {
+        timed.measure([&] {
+            segment.map([&](Int x, Int y) {
+                auto n = Simplex::octave_noise(4, 0.005f, 0.5f, (F32)x, (F32)y, noise) * 0.5f + 0.5f;
+                heightMap.set(x, y, segment.detail, (Size)(depth / 4 + n * depth / 2));
+            });
+        });
+    }
+
+    NoiseContext noise;
+    Size depth;
+    Timed& timed;
+};
+
+/// Uses the default biome everywhere.
+struct DefaultBiomes: generator::BiomeGenerator {
+    DefaultBiomes(Timed& timed): timed(timed) {}
+
+    void generate(const Segment& segment, TiledMatrix& map, TiledMatrix** auxiliaries, Pipeline& pipeline) override {
+        timed.measure([&] {
+            map.fillRegion(segment.x, segment.y, segment.width, segment.height, segment.detail, DefaultBiome::id);
+        });
+    }
+
+    Timed& timed;
+};
+
+/// Collects the chunks that were added to the view.
+struct CollectView: ViewCallback {
+    void addChunk(generator::Chunk& chunk) override {
+        if(added.insert(&chunk).second) chunks.push_back(&chunk);
+    }
+
+    void removeChunk(generator::Chunk& chunk) override {}
+
+    std::unordered_set<generator::Chunk*> added;
+    std::vector<generator::Chunk*> chunks;
+};
+
+/// Returns the peak resident memory of the process in bytes, or 0 if it is unknown.
+static Size peakMemory() {
+#ifdef _WIN32
+    return 0;
+#else
+    rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage)) return 0;
+#ifdef __APPLE__
+    return (Size)usage.ru_maxrss;
+#else
+    return (Size)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+/// Hashes the block types of a set of chunks with FNV-1a, in position order.
+static U64 hashChunks(std::vector<generator::Chunk*> chunks) {
+    std::sort(chunks.begin(), chunks.end(), [](const generator::Chunk* a, const generator::Chunk* b) {
+        return a->area.y < b->area.y || (a->area.y == b->area.y && a->area.x < b->area.x);
+    });
+
+    U64 hash = 14695981039346656037ull;
+    auto add = [&](U64 value) {
+        for(Size i = 0; i < 8; i++) {
+            hash ^= (value >> (i * 8)) & 0xff;
+            hash *= 1099511628211ull;
+        }
+    };
+
+    for(auto chunk: chunks) {
+        add((U64)(U32)chunk->area.x);
+        add((U64)(U32)chunk->area.y);
+        for(Size z = 0; z < chunk->area.depth; z++) {
+            for(Size y = 0; y < chunk->area.height; y++) {
+                for(Size x = 0; x < chunk->area.width; x++) add(chunk->at(x, y, z).blockType);
+            }
+        }
+    }
+    return hash;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: genbench [--seed n] [--area width height] [--chunk-size log2] [--chunk-height log2]\n"
+                    "                [--threads count] [--view chunks] [--stages landmass,terrain,geometry]\n");
+}
+
+int main(int argc, const char** argv) {
     I32 seed = 1;
-    World world(seed);
+    Size areaWidth = 4;
+    Size areaHeight = 4;
+    Size chunkSize = 5;
+    Size chunkHeight = 7;
+    Size threads = ThreadPool::defaultThreadCount();
+    Size view = 2;
+    std::string stages = "landmass,terrain,geometry";
+
+    for(int i = 1; i < argc; i++) {
+        auto option = argv[i];
+        auto hasValue = i + 1 < argc;
+        if(!strcmp(option, "--seed") && hasValue) {
+            seed = (I32)strtol(argv[++i], nullptr, 10);
+        } else if(!strcmp(option, "--area") && i + 2 < argc) {
+            areaWidth = (Size)strtoull(argv[++i], nullptr, 10);
+            areaHeight = (Size)strtoull(argv[++i], nullptr, 10);
+        } else if(!strcmp(option, "--chunk-size") && hasValue) {
+            chunkSize = (Size)strtoull(argv[++i], nullptr, 10);
+        } else if(!strcmp(option, "--chunk-height") && hasValue) {
+            chunkHeight = (Size)strtoull(argv[++i], nullptr, 10);
+        } else if(!strcmp(option, "--threads") && hasValue) {
+            threads = (Size)strtoull(argv[++i], nullptr, 10);
+        } else if(!strcmp(option, "--view") && hasValue) {
+            view = (Size)strtoull(argv[++i], nullptr, 10);
+        } else if(!strcmp(option, "--stages") && hasValue) {
+            stages = argv[++i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if(!areaWidth || !areaHeight || !view || chunkSize < 1 || chunkSize > 7 || chunkHeight > 12) {
+        usage();
+        return 1;
+    }
+
+    auto runs = [&](const char* stage) {return stages.find(stage) != std::string::npos;};
+
+    // The stream stages are pulled in by the chunks that need them, so they have to outlive the world.
+    Timed heightTime;
+    Timed biomeTime;
+    Stage heightStage;
+    Stage biomeStage;
+    heightStage += std::unique_ptr<generator::Generator>(new NoiseHeight(seed, Size(1) << chunkHeight, heightTime));
+    biomeStage += std::unique_ptr<generator::Generator>(new DefaultBiomes(biomeTime));
+
+    World world(seed, view, 7, chunkSize, chunkHeight, threads);
+    world.prefetchHorizon = 0;
+    world.pipeline.landmass += std::make_unique<LandmassHeight>();
+    world.pipeline.landmass += std::make_unique<LandmassBiome>();
+    world.pipeline.data.setSource(BaseHeight, heightStage, 0);
+    world.pipeline.data.setSource(Biomes, biomeStage, 0);
+
+    // Each viewpoint covers a square of twice the view distance, so place them on a grid that covers the area.
+    std::vector<WorldPosition> viewpoints;
+    auto span = (Int)view * 2;
+    for(Int y = (Int)view; y - (Int)view < (Int)areaHeight; y += span) {
+        for(Int x = (Int)view; x - (Int)view < (Int)areaWidth; x += span) {
+            viewpoints.push_back(WorldPosition {(float)x, (float)y});
+        }
+    }
+    auto chunkCount = viewpoints.size() * span * span;
 
-    world.pipeline.landmass += std::make_unique<HeightGenerator>();
-    world.pipeline.landmass += std::make_unique<BiomeGenerator>();
+    F64 landmassTime = 0;
+    if(runs("landmass")) {
+        auto start = Clock::now();
+        for(auto& p: viewpoints) {
+            for(Int y = (Int)p.y - (Int)view; y < (Int)p.y + (Int)view; y++) {
+                for(Int x = (Int)p.x - (Int)view; x < (Int)p.x + (Int)view; x++) world.pipeline.landmass.generate(x, y, seed);
+            }
+        }
+        landmassTime = secondsSince(start);
+    }
+
+    // Chunks are generated in the background and added to the view by later updates, which this thread helps with.
+    CollectView collected;
+    F64 terrainTime = 0;
+    if(runs("terrain")) {
+        auto start = Clock::now();
+        while(collected.chunks.size() < chunkCount) {
+            world.updateView(viewpoints.data(), viewpoints.size(), collected);
+            if(!world.pipeline.workers.runPending()) std::this_thread::yield();
+        }
+        terrainTime = secondsSince(start);
+    }
 
-    for(int x = 0; x < 20; x++) {
-        for(int y = 0; y < 20; y++) {
-            world.pipeline.landmass.generate(x, y, seed);
+    F64 geometryTime = 0;
+    Size vertices = 0;
+    if(runs("geometry")) {
+        auto start = Clock::now();
+        for(auto chunk: collected.chunks) {
+            auto geometry = buildCubeGeometry(*chunk);
+            vertices += geometry.vertexCount;
+            geometry.release();
         }
+        geometryTime = secondsSince(start);
     }
 
-    exit(0);
+    auto generated = collected.chunks.size();
+    auto voxelsPerChunk = (Size(1) << (chunkSize * 2)) << chunkHeight;
+    auto total = landmassTime + terrainTime;
+    auto chunksPerSecond = total > 0 ? generated / total : 0;
+    auto hash = hashChunks(collected.chunks);
+
+    Size voxelBytes = 0;
+    for(auto chunk: collected.chunks) voxelBytes += chunk->memoryUsage();
+
+    fprintf(stderr, "seed %d, %zu chunks of %zu voxels on %zu threads\n", seed, (size_t)generated, (size_t)voxelsPerChunk, (size_t)threads);
+    fprintf(stderr, "%-10s %10.3f s\n", "landmass", landmassTime);
+    fprintf(stderr, "%-10s %10.3f s  (height %.3f s, biome %.3f s of generator time)\n", "terrain", terrainTime,
+            heightTime.nanoseconds * 1e-9, biomeTime.nanoseconds * 1e-9);
+    fprintf(stderr, "%-10s %10.3f s  %zu vertices\n", "geometry", geometryTime, (size_t)vertices);
+    fprintf(stderr, "%.1f chunks/s, %.0f voxels/s, voxel memory %.1f MiB, peak memory %.1f MiB, hash %016llx\n",
+            chunksPerSecond, chunksPerSecond * voxelsPerChunk, voxelBytes / (1024.0 * 1024.0), peakMemory() / (1024.0 * 1024.0),
+            (unsigned long long)hash);
+
+    printf("{\n  \"version\": 1,\n  \"seed\": %d,\n  \"threads\": %zu,\n  \"chunks\": %zu,\n  \"voxelsPerChunk\": %zu,\n",
+           seed, (size_t)threads, (size_t)generated, (size_t)voxelsPerChunk);
+    printf("  \"chunksPerSecond\": %.2f,\n  \"voxelsPerSecond\": %.0f,\n  \"voxelBytes\": %zu,\n  \"peakMemoryBytes\": %zu,\n  \"hash\": \"%016llx\",\n",
+           chunksPerSecond, chunksPerSecond * voxelsPerChunk, (size_t)voxelBytes, (size_t)peakMemory(), (unsigned long long)hash);
+    printf("  \"stages\": {\"landmass\": %.6f, \"terrain\": %.6f, \"height\": %.6f, \"biome\": %.6f, \"geometry\": %.6f}",
+           landmassTime, terrainTime, heightTime.nanoseconds * 1e-9, biomeTime.nanoseconds * 1e-9, geometryTime);
+
+    // Builds with GENERATOR_PROFILE also report each measured zone.
+    auto zones = profile::summarize();
+    if(!zones.empty()) {
+        printf(",\n  \"zones\": [");
+        for(Size i = 0; i < zones.size(); i++) {
+            auto& z = zones[i];
+            printf("%s\n    {\"name\": \"%s\", \"count\": %llu, \"totalNs\": %llu, \"maxNs\": %llu}", i ? "," : "",
+                   z.name, (unsigned long long)z.count, (unsigned long long)z.totalTime, (unsigned long long)z.maxTime);
+        }
+        printf("\n  ]");
+    }
+    printf("\n}\n");
     return 0;
-}
\ No newline at end of file
+}
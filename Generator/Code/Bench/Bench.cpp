@@ -0,0 +1,128 @@
+#include "Bench.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <Math/Math.h>
+
+namespace generator {
+namespace bench {
+
+static std::atomic<Size> allocations {0};
+
+// This is trivially initialized, so that the allocator entry points can use it at any time.
+static thread_local Size threadAllocations = 0;
+
+Size allocationCount() {
+    return allocations.load(std::memory_order_relaxed);
+}
+
+Size threadAllocationCount() {
+    return threadAllocations;
+}
+
+void Runner::run(const char* name, Size batch, const std::function<void(Size)>& f) {
+    if(!filter.empty() && !strstr(name, filter.c_str())) return;
+
+    // Warm up caches and any lazily created state before measuring.
+    auto warmup = Tritium::Math::max(samples / 10, (Size)1);
+    for(Size i = 0; i < warmup; i++) f(batch);
+
+    std::vector<F64> latencies;
+    latencies.reserve(samples);
+    F64 total = 0;
+    auto startAllocations = allocationCount();
+
+    for(Size i = 0; i < samples; i++) {
+        auto start = std::chrono::steady_clock::now();
+        f(batch);
+        auto end = std::chrono::steady_clock::now();
+
+        auto time = std::chrono::duration<F64, std::nano>(end - start).count();
+        latencies.push_back(time / batch);
+        total += time;
+    }
+
+    auto operations = samples * batch;
+    auto allocated = allocationCount() - startAllocations;
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](F64 p) {
+        return latencies[Tritium::Math::min((Size)(p * latencies.size()), latencies.size() - 1)];
+    };
+
+    results.push_back(Result {
+        name, operations, operations / (total * 1e-9),
+        percentile(0.5), percentile(0.9), percentile(0.99), latencies.back(),
+        (F64)allocated / operations
+    });
+    fprintf(stderr, "%-32s %14.0f ops/s  p50 %10.1f ns  p99 %10.1f ns  %8.3f allocs/op\n",
+            name, results.back().opsPerSecond, results.back().p50, results.back().p99, results.back().allocationsPerOp);
+}
+
+void Runner::write(FILE* file) const {
+    fprintf(file, "{\n  \"version\": 1,\n  \"mallocCounted\": %s,\n  \"benchmarks\": [", countsMalloc() ? "true" : "false");
+    for(Size i = 0; i < results.size(); i++) {
+        auto& r = results[i];
+        fprintf(file, "%s\n    {\"name\": \"%s\", \"operations\": %llu, \"opsPerSecond\": %.1f, "
+                "\"latencyNs\": {\"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"max\": %.2f}, \"allocationsPerOp\": %.4f}",
+                i ? "," : "", r.name.c_str(), (unsigned long long)r.operations, r.opsPerSecond,
+                r.p50, r.p90, r.p99, r.max, r.allocationsPerOp);
+    }
+    fprintf(file, "\n  ]\n}\n");
+}
+
+}} // namespace generator::bench
+
+using generator::bench::allocations;
+using generator::bench::threadAllocations;
+
+// Count allocations by replacing the allocator entry points.
+// With glibc, malloc itself can be replaced, which also covers the matrices and chunks that allocate with malloc.
+#ifdef __GLIBC__
+
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+
+void* malloc(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    threadAllocations++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    threadAllocations++;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    threadAllocations++;
+    return __libc_realloc(pointer, size);
+}
+
+}
+
+bool generator::bench::countsMalloc() {return true;}
+
+#else //__GLIBC__
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    threadAllocations++;
+    if(auto pointer = malloc(size)) return pointer;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept {
+    free(pointer);
+}
+
+bool generator::bench::countsMalloc() {return false;}
+
+#endif //__GLIBC__
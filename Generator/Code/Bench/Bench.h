@@ -0,0 +1,65 @@
+
+#ifndef GENERATOR_BENCH_H
+#define GENERATOR_BENCH_H
+
+#include <Base.h>
+#include <stdio.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace generator {
+namespace bench {
+
+/// Returns the number of heap allocations made by the process so far.
+Size allocationCount();
+
+/// Returns the number of heap allocations made by the calling thread so far.
+Size threadAllocationCount();
+
+/// Checks if allocations made through malloc are counted, rather than only operator new.
+bool countsMalloc();
+
+/// The measured results of a single benchmark.
+struct Result {
+    std::string name;
+    Size operations; /// The total number of measured operations.
+    F64 opsPerSecond;
+    F64 p50; /// Latency percentiles in nanoseconds per operation.
+    F64 p90;
+    F64 p99;
+    F64 max;
+    F64 allocationsPerOp;
+};
+
+/**
+ * Runs a set of microbenchmarks and collects their results.
+ * Each benchmark performs a fixed batch of operations per sample, after a number of warmup samples.
+ * The latency of each sample is divided by the batch size, so percentiles are per operation.
+ * Batches and inputs are fixed, so results are comparable between runs and versions.
+ */
+struct Runner {
+    Runner(Size samples, const char* filter): samples(samples), filter(filter ? filter : "") {}
+
+    /// Runs a benchmark if it matches the filter.
+    /// The function is called as f(count) for each sample, and should perform count operations.
+    void run(const char* name, Size batch, const std::function<void(Size)>& f);
+
+    /// Writes the results as a JSON document.
+    void write(FILE* file) const;
+
+    std::vector<Result> results;
+
+private:
+    Size samples;
+    std::string filter;
+};
+
+/// Keeps the compiler from optimizing away a value that is never used.
+template<class T> void consume(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+}} // namespace generator::bench
+
+#endif // GENERATOR_BENCH_H
@@ -0,0 +1,239 @@
+#include <random>
+#include <string.h>
+#include <vector>
+#include "Bench.h"
+#include "../Geometry/Geometry.h"
+#include "../Pipeline/ChunkPool.h"
+#include "../Pipeline/Pipeline.h"
+#include "../Pipeline/Profile.h"
+#include "../Pipeline/Voxel.h"
+#include "../Pipeline/Biome/BiomeStage.h"
+#include "../Pipeline/Height/HeightStage.h"
+#include "../Pipeline/Landmass/Chunk.h"
+#include "../../../noise/Simplex/simplex.h"
+
+using namespace generator;
+using namespace generator::bench;
+
+/**
+ * Microbenchmarks for the generator hot paths.
+ * Usage: GeneratorBench [--samples count] [--trace file] [filter]
+ * Results are written to stdout as JSON, with a readable summary on stderr.
+ * When built with GENERATOR_PROFILE, --trace writes the recorded zones as a Chrome trace.
+ */
+
+/// Positions that are spread over several tiles, generated the same way on each run.
+static std::vector<Int> randomPositions(Size count, Int range, U32 seed) {
+    std::mt19937 random(seed);
+    std::vector<Int> positions(count);
+    for(auto& p: positions) p = (Int)(random() % (range * 2)) - range;
+    return positions;
+}
+
+static void matrixBenchmarks(Runner& runner) {
+    const Size kCount = 4096;
+    TiledMatrix matrix(0, 16, 8);
+    auto xs = randomPositions(kCount, 1024, 1);
+    auto ys = randomPositions(kCount, 1024, 2);
+    for(Size i = 0; i < kCount; i++) matrix.set(xs[i], ys[i], 0, i & 0xffff);
+
+    runner.run("matrix.get", kCount, [&](Size count) {
+        Size sum = 0;
+        for(Size i = 0; i < count; i++) sum += matrix.get(xs[i], ys[i], 0);
+        consume(sum);
+    });
+
+    runner.run("matrix.set", kCount, [&](Size count) {
+        for(Size i = 0; i < count; i++) matrix.set(xs[i], ys[i], 0, i);
+    });
+
+    std::vector<U16> region(256 * 256);
+    runner.run("matrix.readRegion", 256 * 256, [&](Size count) {
+        matrix.readRegion(-128, -128, 256, 256, 0, region.data());
+        consume(region[0]);
+    });
+
+    runner.run("matrix.writeRegion", 256 * 256, [&](Size count) {
+        matrix.writeRegion(-128, -128, 256, 256, 0, region.data());
+    });
+
+    TiledMatrix coarse(3, 16, 8);
+    std::mt19937 random(3);
+    for(Int y = -256; y < 256; y += 8) {
+        for(Int x = -256; x < 256; x += 8) coarse.set(x, y, 3, random() & 0xffff);
+    }
+
+    runner.run("matrix.getBilinear", 64 * 64, [&](Size count) {
+        F32 sum = 0;
+        for(Int y = 0; y < 64; y++) {
+            for(Int x = 0; x < 64; x++) sum += coarse.getBilinear(x - 32, y - 32, 3);
+        }
+        consume(sum);
+    });
+
+    std::vector<F32> samples(64 * 64);
+    runner.run("matrix.sampleBilinear", 64 * 64, [&](Size count) {
+        coarse.sampleBilinear(-32, -32, 64, 64, 0, samples.data());
+        consume(samples[0]);
+    });
+}
+
+static void landmassBenchmarks(Runner& runner) {
+    landmass::RandomHexFiller filler(128, 1);
+    landmass::ChunkMatrix matrix(0, 13, 32, 4);
+
+    // Each operation builds a chunk that was never built before, so every sample uses new positions.
+    I32 next = 0;
+    runner.run("landmass.Chunk.build", 16, [&](Size count) {
+        for(Size i = 0; i < count; i++) {
+            auto& chunk = matrix.getChunk(next++, 0);
+            chunk.build(matrix, filler, nullptr, 0);
+        }
+    });
+}
+
+static void pipelineBenchmarks(Runner& runner) {
+    landmass::RandomHexFiller filler(128, 1);
+    Pipeline pipeline(filler, 1, 32, 4);
+
+    // Provide the streams the default biome reads, so that chunks contain terrain.
+    pipeline.data.getOrCreate(Biomes, 0)->fillRegion(-4096, -4096, 8192, 8192, 0, DefaultBiome::id);
+    auto height = pipeline.data.getOrCreate(BaseHeight, 0);
+    std::mt19937 random(4);
+    for(Int y = -64; y < 64; y++) {
+        for(Int x = -64; x < 64; x++) height->set(x, y, 0, 8 + random() % 16);
+    }
+
+    I32 next = 0;
+    runner.run("pipeline.fillChunk", 4, [&](Size count) {
+        for(Size i = 0; i < count; i++) {
+            Chunk chunk(Area {next++ % 4, 0, 0, 32, 32, 32, 0});
+            pipeline.fillChunk(chunk);
+            consume(chunk.at(0, 0, 0).blockType);
+        }
+    });
+
+    // Spawning requests many chunks at once, which share their landmass and stream tiles.
+    runner.run("pipeline.fillChunks", 16, [&](Size count) {
+        std::vector<std::unique_ptr<Chunk>> chunks;
+        std::vector<Chunk*> batch;
+        for(Size i = 0; i < count; i++) {
+            chunks.emplace_back(new Chunk(Area {(I32)(i % 4), 0, 0, 32, 32, 32, 0}));
+            batch.push_back(chunks.back().get());
+        }
+
+        pipeline.fillChunks(batch.data(), batch.size());
+        consume(batch[0]->at(0, 0, 0).blockType);
+    });
+
+    Chunk chunk(Area {0, 0, 0, 32, 32, 32, 0});
+    pipeline.fillChunk(chunk);
+    runner.run("geometry.buildCubeGeometry", 1, [&](Size count) {
+        for(Size i = 0; i < count; i++) {
+            auto geometry = buildCubeGeometry(chunk);
+            consume(geometry.vertexCount);
+            geometry.release();
+        }
+    });
+}
+
+static void voxelBenchmarks(Runner& runner) {
+    // The cost per voxel of each order should not depend on the chunk depth.
+    const char* orders[] = {"xfirst", "zfirst", "bricks"};
+    for(Size o = 0; o < 3; o++) {
+        for(Size depth: {32, 256}) {
+            Chunk chunk(Area {0, 0, 0, 32, 32, (U16)depth, 0}, VoxelStorage::Flat, (VoxelOrder)o);
+            auto name = std::string("voxel.build.") + orders[o] + "." + std::to_string(depth);
+            runner.run(name.c_str(), 32 * 32 * depth, [&](Size count) {
+                chunk.build([](Voxel& current, Int x, Int y, Int z) {
+                    return Voxel {z < 16 + ((x ^ y) & 7) ? 1u : 0u};
+                });
+                consume(chunk.at(0, 0, 0).blockType);
+            });
+
+            name = std::string("voxel.buildColumns.") + orders[o] + "." + std::to_string(depth);
+            runner.run(name.c_str(), 32 * 32 * depth, [&](Size count) {
+                chunk.buildColumns([](Int x, Int y, ColumnLayers& layers) {
+                    layers.add(Voxel {1}, 16 + ((x ^ y) & 7));
+                });
+                consume(chunk.at(0, 0, 0).blockType);
+            });
+        }
+    }
+
+    // Creating and releasing a chunk, as the world does while a viewpoint moves.
+    Area area {0, 0, 0, 32, 32, 128, 0};
+    auto fill = [](Chunk& chunk) {
+        chunk.buildColumns([](Int x, Int y, ColumnLayers& layers) {layers.add(Voxel {1}, 16 + ((x ^ y) & 7));});
+    };
+
+    runner.run("voxel.Chunk.create", 1, [&](Size count) {
+        for(Size i = 0; i < count; i++) {
+            auto chunk = new Chunk(area, VoxelStorage::Flat, VoxelOrder::ZFirst);
+            fill(*chunk);
+            delete chunk;
+        }
+    });
+
+    ChunkPool pool;
+    runner.run("voxel.ChunkPool.create", 1, [&](Size count) {
+        for(Size i = 0; i < count; i++) {
+            auto chunk = pool.create(area, VoxelStorage::Flat, VoxelOrder::ZFirst);
+            fill(*chunk);
+            pool.release(chunk);
+        }
+    });
+}
+
+static void noiseBenchmarks(Runner& runner) {
+    NoiseContext context(1);
+    runner.run("Simplex.octave_noise2", 1024, [&](Size count) {
+        F32 sum = 0;
+        for(Size i = 0; i < count; i++) sum += Simplex::octave_noise(8, 0.005f, 0.5f, (F32)i, (F32)(i * 3), context);
+        consume(sum);
+    });
+
+    runner.run("Simplex.octave_noise3", 1024, [&](Size count) {
+        F32 sum = 0;
+        for(Size i = 0; i < count; i++) sum += Simplex::octave_noise(8, 0.005f, 0.5f, (F32)i, (F32)(i * 3), (F32)(i & 63), context);
+        consume(sum);
+    });
+}
+
+int main(int argc, const char** argv) {
+    Size samples = 200;
+    const char* filter = nullptr;
+    const char* trace = nullptr;
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--samples") && i + 1 < argc) {
+            samples = (Size)strtoull(argv[++i], nullptr, 10);
+            if(!samples) {
+                fprintf(stderr, "--samples needs at least 1 sample\n");
+                return 1;
+            }
+        } else if(!strcmp(argv[i], "--trace") && i + 1 < argc) {
+            trace = argv[++i];
+        } else {
+            filter = argv[i];
+        }
+    }
+
+    profile::setAllocationCounter(threadAllocationCount);
+
+    Runner runner(samples, filter);
+    matrixBenchmarks(runner);
+    landmassBenchmarks(runner);
+    pipelineBenchmarks(runner);
+    voxelBenchmarks(runner);
+    noiseBenchmarks(runner);
+
+    runner.write(stdout);
+
+    if(trace) {
+        if(auto file = fopen(trace, "w")) {
+            profile::writeTrace(file);
+            fclose(file);
+        }
+    }
+    return 0;
+}
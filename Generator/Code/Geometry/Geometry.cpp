@@ -1,5 +1,6 @@
 
 #include "Geometry.h"
+#include "../Pipeline/Profile.h"
 #include "../Pipeline/Voxel.h"
 
 namespace generator {
@@ -105,10 +106,9 @@ static void makeTopFace(ChunkBuilder<CubeVoxelVertex>& v, U32 x, U32 y, U32 z, c
     ++v[ 0].x;
 }
 
-static void makeCube(const Chunk& c, ChunkBuilder<CubeVoxelVertex>& v, U32 x, U32 y, U32 z, char light) {
+static void makeCube(const Chunk& c, ChunkBuilder<CubeVoxelVertex>& v, U32 x, U32 y, U32 z, char light, bool top, bool bottom) {
     auto w = c.area.width - 1;
     auto h = c.area.height - 1;
-    auto d = c.area.depth - 1;
 
     if(x >= w || !c.at(x+1, y, z).blockType)
         makeEastFace(v, x, y, z, light);
@@ -122,37 +122,34 @@ static void makeCube(const Chunk& c, ChunkBuilder<CubeVoxelVertex>& v, U32 x, U3
     if(y >= h || !c.at(x, y+1, z).blockType)
         makeSouthFace(v, x, y, z, light);
 
-    // Check if we need to build the top and bottom.
-    bool top = false, bottom = false;
-    if(z >= d) {
-        top = true;
-        if(!c.at(x, y, z-1).blockType)
-            bottom = true;
-    } else if(z == 0) {
-        // The bottom of the world can never be visible.
-        if(c.area.z != 0)
-            bottom = true;
-        if(!c.at(x, y, z+1).blockType)
-            top = true;
-    } else {
-        if(!c.at(x, y, z+1).blockType)
-            top = true;
-        if(!c.at(x, y, z-1).blockType)
-            bottom = true;
-    }
-
     if(top) makeTopFace(v, x, y, z, light);
     if(bottom) makeBottomFace(v, x, y, z, light);
 }
 
 static void buildChunk(const Chunk& c, ChunkBuilder<CubeVoxelVertex>& builder) {
-    for(U32 x = 0; x < c.area.width; x++) {
-        for(U32 y = 0; y < c.area.height; y++) {
-            for(U32 z = 0; z < c.area.depth; z++) {
-                // If the type is not air, we create a cube.
-                auto v = c.at(x, y, z);
-                if(v.blockType) {
-                    makeCube(c, builder, x, y, z, v.baseLight);
+    auto d = c.area.depth - 1u;
+    std::vector<VoxelSpan> spans;
+
+    // Neighbouring pillars along the x-axis are closest in memory for every voxel order.
+    for(U32 y = 0; y < c.area.height; y++) {
+        for(U32 x = 0; x < c.area.width; x++) {
+            spans.clear();
+            c.forEachSpan(x, y, [&](const VoxelSpan& span) {spans.push_back(span);});
+
+            // Within a pillar, the top and bottom faces can only be visible at the ends of each run.
+            for(Size i = 0; i < spans.size(); i++) {
+                auto& span = spans[i];
+                // If the type is not air, we create cubes.
+                if(!span.voxel.blockType) continue;
+
+                bool airAbove = i + 1 < spans.size() && !spans[i + 1].voxel.blockType;
+                bool airBelow = i > 0 && !spans[i - 1].voxel.blockType;
+                for(U32 z = span.begin; z < span.end; z++) {
+                    bool top = z >= d || (z + 1 == span.end && airAbove);
+
+                    // The bottom of the world can never be visible.
+                    bool bottom = z == 0 ? c.area.z != 0 : z == span.begin && airBelow;
+                    makeCube(c, builder, x, y, z, span.voxel.baseLight, top, bottom);
                 }
             }
         }
@@ -160,6 +157,8 @@ static void buildChunk(const Chunk& c, ChunkBuilder<CubeVoxelVertex>& builder) {
 }
 
 ChunkGeometry<CubeVoxelVertex> buildCubeGeometry(const Chunk& chunk) {
+    GENERATOR_ZONE("geometry.buildCubeGeometry");
+
     // By using glass, it is possible to get a chunk where every cube needs to be fully drawn.
     // Reserve space for the worst case.
     U32 maxCubes = chunk.area.width * chunk.area.height * chunk.area.depth;
@@ -2,11 +2,10 @@
 #include <vector>
 #include "../Pipeline.h"
 #include "../Height/HeightStage.h"
+#include "../Profile.h"
 
 namespace generator {
 
-DefineStream(Biomes, 8);
-	
 void BiomeGenerator::generate(const Segment& segment, TiledMatrix** auxiliaries, Pipeline& pipeline) {
     auto map = pipeline.data.getOrCreate(Biomes, segment.detail);
     generate(segment, *map, auxiliaries, pipeline);
@@ -27,15 +26,17 @@ GenerateChunk findBiome(BiomeId id) {
 const BiomeId DefaultBiome::id = registerBiome(DefaultBiome::fillChunk);
 
 void DefaultBiome::fillChunk(Chunk& chunk, Pipeline& pipeline) {
+    GENERATOR_ZONE("biome.DefaultBiome.fillChunk");
     auto height = pipeline.data.get(BaseHeight);
-    chunk.build([=](Voxel& current, Int x, Int y, Int z) -> Voxel {
-        Size baseHeight = 0;
-        if(height) baseHeight = height->get(x, y, z);
 
-        U16 blockType = 0;
-        if(z <= baseHeight) blockType = 1;
+    // Far chunks read their pillars from the mip pyramid if there is one, which covers the area between them.
+    auto detail = height ? height->getDetail() + Tritium::Math::min((Size)chunk.area.lod, height->getMipLevels()) : 0;
+    chunk.buildColumns([=](Int x, Int y, ColumnLayers& layers) {
+        Size baseHeight = 0;
+        if(height) baseHeight = height.get(x, y, detail);
 
-        return Voxel {blockType};
+        // Everything up to and including the base height is solid.
+        layers.add(Voxel {1}, (Int)baseHeight + 1);
     });
 }
 
@@ -9,14 +9,19 @@ namespace generator {
 
 struct Pipeline;
 
-DeclareStream(Biomes);
+/// Currently, biome ids are represented as bytes. We may want to change this to 16-bit values
+/// in the future if it turns out that more than 256 biomes are used in one world.
+using BiomeId = U8;
+
+DefineStream(Biomes, 1, 8, BiomeId);
 
 /**
  * Helper base class for biome id generators.
  * This will automatically send the biome map to the overloaded generate().
  */
 struct BiomeGenerator: Generator {
-    using Generator::Generator;
+    BiomeGenerator(std::vector<StreamId>&& auxiliaryStreams = std::vector<StreamId>{}):
+        Generator(::move(auxiliaryStreams), std::vector<StreamId>{Biomes}) {}
 
     void generate(const Segment& segment, TiledMatrix** auxiliaries, Pipeline& pipeline) override;
 
@@ -25,16 +30,10 @@ struct BiomeGenerator: Generator {
      * The default implementation just sets the default biome everywhere.
      */
     virtual void generate(const Segment& segment, TiledMatrix& map, TiledMatrix** auxiliaries, Pipeline& pipeline) {
-        segment.map([&](auto x, auto y) {
-            map.set(x, y, segment.detail, 0);
-        });
+        map.fillRegion(segment.x, segment.y, segment.width, segment.height, segment.detail, 0);
     }
 };
 
-/// Currently, biome ids are represented as bytes. We may want to change this to 16-bit values
-/// in the future if it turns out that more than 256 biomes are used in one world.
-using BiomeId = U8;
-
 /// Chunk generators are called through this interface.
 using GenerateChunk = void(*)(Chunk&, Pipeline&);
 
@@ -2,6 +2,7 @@
 #include "../noise/simplex/simplex.h"
 #include "../Pipeline.h"
 #include "../Height/HeightStage.h"
+#include "../Profile.h"
 
 namespace generator {
 
@@ -12,12 +13,14 @@ namespace generator {
 	const BiomeId WeirdBiome::id = registerBiome(WeirdBiome::fillChunk);
 
 	void WeirdBiome::fillChunk(Chunk& chunk, Pipeline& pipeline) {
+		GENERATOR_ZONE("biome.WeirdBiome.fillChunk");
 		auto baseHeight = pipeline.data.get(BaseHeight);
+		auto detail = baseHeight ? baseHeight->getDetail() : 0;
 		int weirdnessHeight = 20;
 
 		chunk.build([=](Voxel& current, Int x, Int y, Int z) -> Voxel {
 			Size height = 0;
-			if (baseHeight) height = baseHeight->get(x, y, z);
+			if (baseHeight) height = baseHeight.get(x, y, detail);
 
 			U16 blockType = 0;
 
@@ -51,6 +54,7 @@ namespace generator {
 	const BiomeId PlainBiome::id = registerBiome(PlainBiome::fillChunk);
 
 	void PlainBiome::fillChunk(Chunk& chunk, Pipeline& pipeline) {
+		GENERATOR_ZONE("biome.PlainBiome.fillChunk");
 		Size chunkHeight = chunk.area.depth;
 		auto baseHeight = pipeline.data.get(BaseHeight);
 
@@ -123,8 +127,7 @@ namespace generator {
 					density  = NoiseLerp(currentFunc, lastFunc, alpha, x + column * step, y + row * step, z + zi * step, bounds[layer - 1], bounds[layer]);
 					U16 blockType = (U16) (density > 0.5f);
 
-					Voxel& voxel = chunk.at(column, row, zi);
-					voxel = Voxel {blockType};
+					chunk.set(column, row, zi, Voxel {blockType});
 				}
 			}
 		}
@@ -0,0 +1,104 @@
+#include "ChunkPool.h"
+#include <new>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#else
+#include <malloc.h>
+#endif //!_WIN32
+
+namespace generator {
+
+ChunkPool::~ChunkPool() {
+    for(auto& slab: slabs) {
+#ifndef _WIN32
+        munmap(slab.data, slab.size);
+#else
+        _aligned_free(slab.data);
+#endif
+    }
+}
+
+Chunk* ChunkPool::create(Area area, VoxelStorage storage, VoxelOrder order) {
+    return new(allocate(sizeof(Chunk))) Chunk(area, storage, order, this);
+}
+
+void ChunkPool::release(Chunk* chunk) {
+    if(!chunk) return;
+
+    chunk->~Chunk();
+    recycle(chunk, sizeof(Chunk));
+}
+
+void* ChunkPool::allocate(Size bytes) {
+    auto size = blockSize(bytes);
+    std::lock_guard<std::mutex> guard(lock);
+    used += size;
+
+    auto& blocks = freeBlocks[size];
+    if(!blocks.empty()) {
+        auto block = blocks.back();
+        blocks.pop_back();
+        return block;
+    }
+
+    // Blocks that don't fit in a shared slab get one of their own, which is kept for later blocks of the same size.
+    if(size > kSlabSize / 4) return createSlab(size);
+
+    if(size > (Size)(end - next)) {
+        next = createSlab(kSlabSize);
+        end = next + kSlabSize;
+    }
+
+    auto block = next;
+    next += size;
+    return block;
+}
+
+void ChunkPool::recycle(void* block, Size bytes) {
+    if(!block) return;
+
+    auto size = blockSize(bytes);
+    std::lock_guard<std::mutex> guard(lock);
+    used -= size;
+    freeBlocks[size].push_back(block);
+}
+
+Size ChunkPool::reservedBytes() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return reserved;
+}
+
+Size ChunkPool::usedBytes() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return used;
+}
+
+U8* ChunkPool::createSlab(Size bytes) {
+    auto size = (bytes + kSlabSize - 1) & ~(kSlabSize - 1);
+    U8* data;
+
+#ifndef _WIN32
+    // Huge pages have to be aligned to their size, so the mapping is trimmed to an aligned range.
+    auto mapped = (U8*)mmap(nullptr, size + kSlabSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mapped == MAP_FAILED) throw std::bad_alloc();
+
+    data = (U8*)(((Size)mapped + kSlabSize - 1) & ~(kSlabSize - 1));
+    if(data > mapped) munmap(mapped, data - mapped);
+    munmap(data + size, mapped + kSlabSize - data);
+
+#ifdef MADV_HUGEPAGE
+    madvise(data, size, MADV_HUGEPAGE);
+#endif
+#else
+    data = (U8*)_aligned_malloc(size, kSlabSize);
+    if(!data) throw std::bad_alloc();
+#endif
+
+    slabs.push_back(Slab {data, size});
+    reserved += size;
+    return data;
+}
+
+} // namespace generator
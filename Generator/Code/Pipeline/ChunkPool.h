@@ -0,0 +1,81 @@
+
+#ifndef GENERATOR_CHUNKPOOL_H
+#define GENERATOR_CHUNKPOOL_H
+
+#include <Base.h>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "Voxel.h"
+
+namespace generator {
+
+/**
+ * Recycles the memory of chunks, so that generating chunks of the same size doesn't allocate from the heap.
+ * Chunk objects and their heightmap, voxel and palette index blocks are carved out of large slabs,
+ * which are backed by huge pages on Linux when they are available.
+ * Released blocks are kept on a free list for their size and reused by the next block of that size.
+ * Chunks with the same area dimensions request the same sizes, so memory usage stays stable as chunks are replaced.
+ * Blocks may be allocated and recycled from any thread.
+ */
+struct ChunkPool {
+    /// The size of each slab, which matches the size of a huge page.
+    static const Size kSlabSize = 2 * 1024 * 1024;
+
+    /// Blocks are rounded up to a multiple of this, which keeps them on separate cache lines.
+    static const Size kBlockAlignment = 64;
+
+    ChunkPool() = default;
+    ChunkPool(const ChunkPool&) = delete;
+
+    /// Every chunk created by the pool must be released before it is destroyed.
+    ~ChunkPool();
+
+    /// Creates a chunk that allocates its memory from this pool.
+    Chunk* create(Area area, VoxelStorage storage = VoxelStorage::Flat, VoxelOrder order = VoxelOrder::XFirst);
+
+    /// Destroys a chunk created by this pool, keeping its memory for later chunks.
+    void release(Chunk* chunk);
+
+    /// Returns a block of at least the provided size, aligned to kBlockAlignment.
+    void* allocate(Size bytes);
+
+    /// Returns a block to the pool. The size must be the same as when it was allocated.
+    void recycle(void* block, Size bytes);
+
+    /// Returns the number of bytes reserved in slabs.
+    Size reservedBytes() const;
+
+    /// Returns the number of bytes in blocks that are currently allocated.
+    Size usedBytes() const;
+
+private:
+    static Size blockSize(Size bytes) {
+        return (bytes + kBlockAlignment - 1) & ~(kBlockAlignment - 1);
+    }
+
+    /// Reserves a new slab of at least the provided size.
+    U8* createSlab(Size bytes);
+
+    struct Slab {
+        U8* data;
+        Size size;
+    };
+
+    mutable std::mutex lock;
+    std::vector<Slab> slabs;
+
+    /// The free blocks of each block size.
+    std::unordered_map<Size, std::vector<void*>> freeBlocks;
+
+    /// The unused part of the most recent shared slab.
+    U8* next = nullptr;
+    U8* end = nullptr;
+
+    Size reserved = 0;
+    Size used = 0;
+};
+
+} // namespace generator
+
+#endif // GENERATOR_CHUNKPOOL_H
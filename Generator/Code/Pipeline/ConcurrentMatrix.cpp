@@ -0,0 +1,157 @@
+#include "ConcurrentMatrix.h"
+#include <Math/Math.h>
+
+namespace generator {
+
+ConcurrentTiledMatrix::~ConcurrentTiledMatrix() {
+    auto current = directory.load();
+    if(current) {
+        for(Size i = 0; i < (Size)current->width * (Size)current->height; i++) {
+            auto block = current->blocks[i].load();
+            if(!block) continue;
+
+            for(auto& tile: block->tiles) {
+                delete tile.load();
+            }
+            delete block;
+        }
+    }
+
+    // Blocks are shared between directories, so older ones only own their pointer array.
+    while(current) {
+        auto previous = current->previous;
+        delete[] current->blocks;
+        delete current;
+        current = previous;
+    }
+}
+
+void ConcurrentTiledMatrix::create(Size detail, Size itemBits, U8 tileSize) {
+    this->tileSize = tileSize;
+    this->itemBits = (U8)itemBits;
+    this->baseDetail = (U8)detail;
+}
+
+void ConcurrentTiledMatrix::trim() {
+    std::lock_guard<std::mutex> guard(lock);
+    auto current = directory.load(std::memory_order_relaxed);
+    if(!current) return;
+
+    // The blocks are owned by the current directory, so older ones only own their pointer array.
+    auto retired = current->previous;
+    current->previous = nullptr;
+    while(retired) {
+        auto previous = retired->previous;
+        delete[] retired->blocks;
+        delete retired;
+        retired = previous;
+    }
+}
+
+Size ConcurrentTiledMatrix::retiredDirectories() const {
+    Size count = 0;
+    auto current = directory.load(std::memory_order_acquire);
+    for(auto d = current ? current->previous : nullptr; d; d = d->previous) count++;
+    return count;
+}
+
+ConcurrentTiledMatrix::Block* ConcurrentTiledMatrix::findBlock(Int blockX, Int blockY) const {
+    auto current = directory.load(std::memory_order_acquire);
+    if(!current) return nullptr;
+
+    auto localX = blockX - current->x;
+    auto localY = blockY - current->y;
+    if(localX < 0 || localY < 0 || current->width <= localX || current->height <= localY) return nullptr;
+
+    return current->blocks[current->width * localY + localX].load(std::memory_order_acquire);
+}
+
+ConcurrentTiledMatrix::Block& ConcurrentTiledMatrix::blockAt(Int blockX, Int blockY) {
+    if(auto block = findBlock(blockX, blockY)) return *block;
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    // Grow the directory if the block is outside of it.
+    // Since all changes to the top level happen while locked, copying it here cannot lose any blocks.
+    auto current = directory.load(std::memory_order_relaxed);
+    if(!current || blockX < current->x || blockY < current->y ||
+       current->x + (Int)current->width <= blockX || current->y + (Int)current->height <= blockY) {
+        auto left = current ? Tritium::Math::min((I32)blockX, current->x) : (I32)blockX;
+        auto bottom = current ? Tritium::Math::min((I32)blockY, current->y) : (I32)blockY;
+        auto right = current ? Tritium::Math::max((I32)blockX + 1, current->x + (I32)current->width) : (I32)blockX + 1;
+        auto top = current ? Tritium::Math::max((I32)blockY + 1, current->y + (I32)current->height) : (I32)blockY + 1;
+
+        auto next = new Directory;
+        next->x = left;
+        next->y = bottom;
+        next->width = (U32)(right - left);
+        next->height = (U32)(top - bottom);
+        next->previous = current;
+        next->blocks = new std::atomic<Block*>[next->width * next->height];
+
+        for(U32 row = 0; row < next->height; row++) {
+            for(U32 column = 0; column < next->width; column++) {
+                Block* block = nullptr;
+                auto oldX = (I32)column + left - (current ? current->x : 0);
+                auto oldY = (I32)row + bottom - (current ? current->y : 0);
+                if(current && oldX >= 0 && oldY >= 0 && oldX < (I32)current->width && oldY < (I32)current->height) {
+                    block = current->blocks[current->width * oldY + oldX].load(std::memory_order_relaxed);
+                }
+                next->blocks[next->width * row + column].store(block, std::memory_order_relaxed);
+            }
+        }
+
+        directory.store(next, std::memory_order_release);
+        current = next;
+    }
+
+    auto& slot = current->blocks[current->width * (blockY - current->y) + (blockX - current->x)];
+    auto block = slot.load(std::memory_order_relaxed);
+    if(!block) {
+        block = new Block();
+        slot.store(block, std::memory_order_release);
+    }
+    return *block;
+}
+
+IdMatrix* ConcurrentTiledMatrix::findTileAt(Int tileX, Int tileY) const {
+    auto block = findBlock(tileX >> kBlockSize, tileY >> kBlockSize);
+    if(!block) return nullptr;
+    return block->tiles[indexInBlock(tileX, tileY)].load(std::memory_order_acquire);
+}
+
+IdMatrix& ConcurrentTiledMatrix::tileAt(Int tileX, Int tileY) {
+    auto& slot = blockAt(tileX >> kBlockSize, tileY >> kBlockSize).tiles[indexInBlock(tileX, tileY)];
+    auto tile = slot.load(std::memory_order_acquire);
+    if(tile) return *tile;
+
+    // Create the tile and try to publish it. If another thread got there first we use its tile instead.
+    auto size = Size(1) << tileSize;
+    auto created = new IdMatrix(size, size, baseDetail, itemBits);
+    if(slot.compare_exchange_strong(tile, created, std::memory_order_acq_rel, std::memory_order_acquire)) {
+        return *created;
+    }
+
+    delete created;
+    return *tile;
+}
+
+IdMatrix& ConcurrentTiledMatrix::getTile(Int x, Int y) {
+    return tileAt(tileIndex(x), tileIndex(y));
+}
+
+const IdMatrix* ConcurrentTiledMatrix::findTile(Int x, Int y) const {
+    return findTileAt(tileIndex(x), tileIndex(y));
+}
+
+Size ConcurrentTiledMatrix::get(Int x, Int y, Size detail) const {
+    auto tile = findTile(x, y);
+    if(!tile) return 0;
+    return tile->get(indexInTile(x), indexInTile(y), detail);
+}
+
+void ConcurrentTiledMatrix::set(Int x, Int y, Size detail, Size value) {
+    getTile(x, y).set(indexInTile(x), indexInTile(y), detail, value);
+}
+
+} // namespace generator
@@ -0,0 +1,107 @@
+
+#ifndef GENERATOR_CONCURRENTMATRIX_H
+#define GENERATOR_CONCURRENTMATRIX_H
+
+#include <atomic>
+#include <mutex>
+#include "Matrix.h"
+
+namespace generator {
+
+/**
+ * A tiled matrix that can be used from several threads at once.
+ * Tiles are stored in a two-level directory: the top level is a rectangle of blocks,
+ * where each block contains a fixed square of tile pointers.
+ * Growing the matrix only reallocates the top level, which contains one pointer per block.
+ * Replaced directories are kept alive until trim() is called or the matrix is destroyed,
+ * so readers never observe freed memory while the matrix grows.
+ *
+ * Tiles are created atomically, and writes to distinct tiles are safe from different threads.
+ * Concurrent writes to the same tile must be ordered by the caller, since items share packed words.
+ */
+struct ConcurrentTiledMatrix {
+    ConcurrentTiledMatrix() = default;
+    ConcurrentTiledMatrix(const ConcurrentTiledMatrix&) = delete;
+    ConcurrentTiledMatrix(Size detail, Size itemBits, U8 tileSize) { create(detail, itemBits, tileSize); }
+    ~ConcurrentTiledMatrix();
+
+    /// Sets the matrix format. This must be done before the matrix is shared between threads.
+    void create(Size detail, Size itemBits, U8 tileSize);
+
+    /// Returns the value at the provided global index.
+    Size get(Int x, Int y, Size detail) const;
+
+    /// Sets the value at the provided global index.
+    void set(Int x, Int y, Size detail, Size value);
+
+    /// Returns the tile that contains the provided global position.
+    /// The tile may be created if it doesn't exist.
+    IdMatrix& getTile(Int x, Int y);
+
+    /// Returns the tile that contains the provided global position, or null if it doesn't exist.
+    const IdMatrix* findTile(Int x, Int y) const;
+
+    bool isEmpty() const {return itemBits == 0;}
+
+    /// Frees the directories that were replaced while growing the matrix.
+    /// This must only be called while no other threads use the matrix, as they may still be reading an old directory.
+    void trim();
+
+    /// Returns the number of replaced directories that are still kept alive.
+    Size retiredDirectories() const;
+
+private:
+    /// The number of tiles in each block, as a power of 2 per axis.
+    static const U32 kBlockSize = 4;
+
+    struct Block {
+        std::atomic<IdMatrix*> tiles[1 << (kBlockSize * 2)];
+    };
+
+    struct Directory {
+        std::atomic<Block*>* blocks;
+        Directory* previous; /// The directory this one replaced.
+        I32 x;
+        I32 y;
+        U32 width;
+        U32 height;
+    };
+
+    /// Returns the block at the provided block index, creating it and growing the directory if needed.
+    Block& blockAt(Int blockX, Int blockY);
+
+    /// Returns the block at the provided block index, or null if it doesn't exist.
+    Block* findBlock(Int blockX, Int blockY) const;
+
+    /// Returns the tile at the provided tile index, creating it if needed.
+    IdMatrix& tileAt(Int tileX, Int tileY);
+
+    /// Returns the tile at the provided tile index, or null if it doesn't exist.
+    IdMatrix* findTileAt(Int tileX, Int tileY) const;
+
+    Int tileIndex(Int position) const {
+        return position >> tileSize;
+    }
+
+    Size indexInTile(Int position) const {
+        return position & ((Int(1) << tileSize) - 1);
+    }
+
+    static Size indexInBlock(Int tileX, Int tileY) {
+        auto mask = (Int(1) << kBlockSize) - 1;
+        return (Size)(((tileY & mask) << kBlockSize) | (tileX & mask));
+    }
+
+    std::atomic<Directory*> directory {nullptr};
+
+    /// Taken when creating blocks or replacing the directory.
+    std::mutex lock;
+
+    U8 tileSize = 0;
+    U8 itemBits = 0;
+    U8 baseDetail = 0;
+};
+
+} // namespace generator
+
+#endif // GENERATOR_CONCURRENTMATRIX_H
@@ -0,0 +1,103 @@
+#include "Coverage.h"
+
+namespace generator {
+
+/// Returns the bits of the cells between the provided columns within a block row.
+static U64 rowMask(I32 start, I32 end) {
+    auto columns = U64(0xff) >> (8 - (end - start));
+    return columns << start;
+}
+
+template<class F> void Coverage::mapBlocks(I32 cellX, I32 cellY, I32 cellXEnd, I32 cellYEnd, F&& f) {
+    const I32 blockCells = 1 << kBlockShift;
+    for(auto blockY = cellY >> kBlockShift; blockY <= (cellYEnd - 1) >> kBlockShift; blockY++) {
+        auto yStart = cellY - blockY * blockCells;
+        auto yEnd = cellYEnd - blockY * blockCells;
+        if(yStart < 0) yStart = 0;
+        if(yEnd > blockCells) yEnd = blockCells;
+
+        for(auto blockX = cellX >> kBlockShift; blockX <= (cellXEnd - 1) >> kBlockShift; blockX++) {
+            auto xStart = cellX - blockX * blockCells;
+            auto xEnd = cellXEnd - blockX * blockCells;
+            if(xStart < 0) xStart = 0;
+            if(xEnd > blockCells) xEnd = blockCells;
+
+            auto row = rowMask(xStart, xEnd);
+            U64 mask = 0;
+            for(auto y = yStart; y < yEnd; y++) mask |= row << (y * blockCells);
+            f(blockX, blockY, mask);
+        }
+    }
+}
+
+bool Coverage::covers(I32 x, I32 y, U32 width, U32 height, U32 detail) const {
+    if(!width || !height) return true;
+    if(detail >= kDetailLevels) detail = kDetailLevels - 1;
+
+    auto cellX = x >> cellShift;
+    auto cellY = y >> cellShift;
+    auto cellXEnd = ((x + (I32)width - 1) >> cellShift) + 1;
+    auto cellYEnd = ((y + (I32)height - 1) >> cellShift) + 1;
+
+    bool covered = true;
+    mapBlocks(cellX, cellY, cellXEnd, cellYEnd, [&](I32 blockX, I32 blockY, U64 mask) {
+        if(!covered) return;
+
+        auto block = blocks.find(blockX, blockY);
+        if(!block) {
+            covered = false;
+            return;
+        }
+
+        if((block->cells[detail] & mask) != mask) covered = false;
+    });
+    return covered;
+}
+
+void Coverage::cover(I32 x, I32 y, U32 width, U32 height, U32 detail) {
+    if(detail >= kDetailLevels) detail = kDetailLevels - 1;
+
+    // Only include cells that are completely inside the region.
+    auto round = (I32(1) << cellShift) - 1;
+    auto cellX = (x + round) >> cellShift;
+    auto cellY = (y + round) >> cellShift;
+    auto cellXEnd = (x + (I32)width) >> cellShift;
+    auto cellYEnd = (y + (I32)height) >> cellShift;
+    if(cellXEnd <= cellX || cellYEnd <= cellY) return;
+
+    mapBlocks(cellX, cellY, cellXEnd, cellYEnd, [&](I32 blockX, I32 blockY, U64 mask) {
+        blocks.at(blockX, blockY).cells[detail] |= mask;
+    });
+}
+
+void Coverage::coverBlock(I32 blockX, I32 blockY, const U64* cells) {
+    U64 any = 0;
+    for(U32 d = 0; d < kDetailLevels; d++) any |= cells[d];
+    if(!any) return;
+
+    auto& block = blocks.at(blockX, blockY);
+    for(U32 d = 0; d < kDetailLevels; d++) block.cells[d] |= cells[d];
+}
+
+void Coverage::clear(I32 x, I32 y, U32 width, U32 height) {
+    if(!width || !height) return;
+
+    auto cellX = x >> cellShift;
+    auto cellY = y >> cellShift;
+    auto cellXEnd = ((x + (I32)width - 1) >> cellShift) + 1;
+    auto cellYEnd = ((y + (I32)height - 1) >> cellShift) + 1;
+
+    mapBlocks(cellX, cellY, cellXEnd, cellYEnd, [&](I32 blockX, I32 blockY, U64 mask) {
+        auto block = blocks.find(blockX, blockY);
+        if(!block) return;
+
+        U64 remaining = 0;
+        for(auto& cells: block->cells) {
+            cells &= ~mask;
+            remaining |= cells;
+        }
+        if(!remaining) blocks.remove(blockX, blockY);
+    });
+}
+
+} // namespace generator
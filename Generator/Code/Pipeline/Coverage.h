@@ -0,0 +1,67 @@
+
+#ifndef GENERATOR_COVERAGE_H
+#define GENERATOR_COVERAGE_H
+
+#include <Base.h>
+#include "TileMap.h"
+
+namespace generator {
+
+/**
+ * Tracks which parts of a stream have been generated.
+ * The world is split into square cells of 2^cellShift units, and each cell has a flag for each detail level.
+ * Cells are grouped into blocks of 8x8, which keep one 64-bit bitmap per detail.
+ * Matrices index the samples of each detail separately, so data generated at one detail says nothing about the others,
+ * and a cell only counts as covered at the exact detail it was generated at.
+ */
+struct Coverage {
+    static const U32 kDetailLevels = 16;
+
+    Coverage(U8 cellShift): cellShift(cellShift) {}
+    Coverage(const Coverage&) = delete;
+
+    /// Returns the alignment of regions generated at the provided detail, as a shift.
+    /// This is the cell size, or a single sample if that is larger.
+    U32 alignment(U32 detail) const {return detail > cellShift ? detail : cellShift;}
+
+    /// Checks if every cell that intersects the provided region was generated at the provided detail.
+    bool covers(I32 x, I32 y, U32 width, U32 height, U32 detail) const;
+
+    /// Marks every cell inside the provided region as generated at the provided detail.
+    /// Cells that are only partially inside the region are not changed.
+    void cover(I32 x, I32 y, U32 width, U32 height, U32 detail);
+
+    /// Marks every cell that intersects the provided region as not generated at any detail.
+    void clear(I32 x, I32 y, U32 width, U32 height);
+
+    /// Returns the number of blocks with any covered cells.
+    U32 blockCount() const {return blocks.size();}
+
+    /// Calls the provided function for each block with any covered cells, as f(blockX, blockY, cells),
+    /// where cells contains the bitmap of the block for each detail.
+    template<class F> void forEachBlock(F&& f) const {
+        blocks.forEach([&](I32 x, I32 y, const Block& block) {f(x, y, block.cells);});
+    }
+
+    /// Marks the cells in the provided bitmaps of a block as covered, in the layout used by forEachBlock().
+    void coverBlock(I32 blockX, I32 blockY, const U64* cells);
+
+    const U8 cellShift;
+
+private:
+    static const U32 kBlockShift = 3;
+
+    struct Block {
+        U64 cells[kDetailLevels] = {};
+    };
+
+    /// Calls the provided function for each block that intersects the provided range of cells,
+    /// as f(blockX, blockY, mask) where the mask contains the bits of the cells in range.
+    template<class F> static void mapBlocks(I32 cellX, I32 cellY, I32 cellXEnd, I32 cellYEnd, F&& f);
+
+    TileMap<Block> blocks;
+};
+
+} // namespace generator
+
+#endif // GENERATOR_COVERAGE_H
@@ -1,7 +1,204 @@
 #include "Generator.h"
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include "Pipeline.h"
+#include "Profile.h"
 
 namespace generator {
 
-Size StreamCounter::currentId = 0;
+static bool contains(const std::vector<StreamId>& streams, StreamId stream) {
+    for(auto s: streams) {
+        if(s.id == stream.id) return true;
+    }
+    return false;
+}
 
-}
\ No newline at end of file
+bool Stage::dependsOn(Size b, Size a, Pipeline& pipeline) const {
+    auto& first = *generators[a];
+    auto& second = *generators[b];
+    if(first.outputStreams.empty() || second.outputStreams.empty()) return true;
+
+    for(auto s: first.outputStreams) {
+        if(contains(second.outputStreams, s) || contains(second.auxiliaryStreams, s)) return true;
+    }
+
+    for(auto s: second.outputStreams) {
+        if(contains(first.auxiliaryStreams, s)) return true;
+    }
+
+    // Reading a stream with a tile store can load tiles into it, so those reads have to be ordered as well.
+    for(auto s: first.auxiliaryStreams) {
+        auto matrix = pipeline.data.get(s);
+        if(matrix && matrix->hasStore() && contains(second.auxiliaryStreams, s)) return true;
+    }
+    return false;
+}
+
+/// The generators of a single stage run, which the calling thread and the workers take as they become ready.
+struct RunState {
+    std::mutex lock;
+    std::condition_variable finished;
+    std::function<void(Size)> run;
+
+    /// The number of unfinished dependencies of each generator, and the generators that wait for each one.
+    std::vector<Size> waiting;
+    std::vector<std::vector<Size>> dependents;
+
+    std::vector<Size> ready;
+    Size remaining = 0;
+};
+
+/// Runs ready generators until there are none left.
+/// Workers that start after the run is finished find nothing to do, which is why the state is shared.
+static void runReady(const std::shared_ptr<RunState>& state, ThreadPool& workers) {
+    std::unique_lock<std::mutex> guard(state->lock);
+    while(!state->ready.empty()) {
+        auto i = state->ready.back();
+        state->ready.pop_back();
+
+        guard.unlock();
+        state->run(i);
+        guard.lock();
+
+        // Keep running one of the generators that became ready here, and let the workers take the others.
+        auto previous = state->ready.size();
+        for(auto d: state->dependents[i]) {
+            if(!--state->waiting[d]) state->ready.push_back(d);
+        }
+        for(auto n = previous + 1; n < state->ready.size(); n++) workers.submit([state, &workers] {runReady(state, workers);});
+
+        state->remaining--;
+        state->finished.notify_all();
+    }
+}
+
+void Stage::generate(const Segment& segment, Pipeline& pipeline) {
+    if(generators.empty() || !segment.width || !segment.height) return;
+    GENERATOR_ZONE("Stage.generate");
+
+    // Generators without declared outputs may write anything, so the coverage of this stage cannot be tracked.
+    std::vector<StreamId> outputs;
+    for(auto& g: generators) {
+        if(g->outputStreams.empty()) {
+            run(segment, pipeline);
+            return;
+        }
+
+        for(auto s: g->outputStreams) {
+            if(!contains(outputs, s)) outputs.push_back(s);
+        }
+    }
+
+    // Streams are created before their coverage is read, as persistent streams load the coverage they saved.
+    for(auto s: outputs) pipeline.data.getOrCreate(s, segment.detail);
+
+    std::vector<Coverage*> coverages;
+    U32 shift = 0;
+    for(auto s: outputs) {
+        auto& coverage = pipeline.data.coverage(s);
+        coverages.push_back(&coverage);
+        shift = Tritium::Math::max(shift, coverage.alignment(segment.detail));
+    }
+
+    auto cell = I32(1) << shift;
+    auto isCovered = [&](I32 x, I32 y) {
+        for(auto c: coverages) {
+            if(!c->covers(x * cell, y * cell, (U32)cell, (U32)cell, segment.detail)) return false;
+        }
+        return true;
+    };
+
+    // Generate each run of missing cells within a row at once.
+    // The generated parts are extended to whole cells, so that they can be marked as covered.
+    auto xStart = segment.x >> shift;
+    auto yStart = segment.y >> shift;
+    auto xEnd = ((segment.x + (I32)segment.width - 1) >> shift) + 1;
+    auto yEnd = ((segment.y + (I32)segment.height - 1) >> shift) + 1;
+
+    for(auto y = yStart; y < yEnd; y++) {
+        for(auto x = xStart; x < xEnd; x++) {
+            if(isCovered(x, y)) continue;
+
+            auto first = x;
+            while(x + 1 < xEnd && !isCovered(x + 1, y)) x++;
+
+            Segment part {first * cell, y * cell, (U32)(x + 1 - first) << shift, (U32)cell, segment.baseScale, segment.detail};
+            run(part, pipeline);
+            for(auto c: coverages) c->cover(part.x, part.y, part.width, part.height, segment.detail);
+        }
+    }
+}
+
+void Stage::run(const Segment& segment, Pipeline& pipeline) {
+    auto count = generators.size();
+
+    // Create all outputs before resolving any streams, so that generators that read another output can find it.
+    for(auto& g: generators) {
+        for(auto s: g->outputStreams) pipeline.data.getOrCreate(s, segment.detail);
+    }
+
+    // Auxiliary streams that are generated by another stage are pulled in for the segment first.
+    // Streams that this stage writes itself are only read as they are.
+    std::vector<TiledMatrix*> auxiliaries;
+    std::vector<Size> offsets(count);
+    for(Size i = 0; i < count; i++) {
+        offsets[i] = auxiliaries.size();
+        for(auto s: generators[i]->auxiliaryStreams) {
+            auto written = false;
+            for(auto& g: generators) written = written || contains(g->outputStreams, s);
+
+            auto& data = pipeline.data;
+            auxiliaries.push_back(written ? data.get(s) : data.require(s, segment.x, segment.y, segment.width, segment.height));
+        }
+    }
+    auxiliaries.push_back(nullptr);
+
+    auto run = [&](Size i) {
+        generators[i]->generate(segment, auxiliaries.data() + offsets[i], pipeline);
+    };
+
+    if(count == 1 || !pipeline.workers.size()) {
+        for(Size i = 0; i < count; i++) run(i);
+        return;
+    }
+
+    auto state = std::make_shared<RunState>();
+    state->run = run;
+
+    // Each generator becomes ready once all generators it depends on have finished.
+    state->waiting.resize(count, 0);
+    state->dependents.resize(count);
+    for(Size b = 0; b < count; b++) {
+        for(Size a = 0; a < b; a++) {
+            if(dependsOn(b, a, pipeline)) {
+                state->dependents[a].push_back(b);
+                state->waiting[b]++;
+            }
+        }
+        if(!state->waiting[b]) state->ready.push_back(b);
+    }
+
+    // The workers help with the generators, while the calling thread runs whatever is ready itself.
+    // Stages are generated while holding the data lock, so this must never run any other queued task:
+    // those may need that lock, and the workers may all be blocked on it.
+    state->remaining = count;
+    auto& workers = pipeline.workers;
+    auto helpers = state->ready.size() - 1;
+    for(Size i = 0; i < helpers; i++) workers.submit([state, &workers] {runReady(state, workers);});
+
+    std::unique_lock<std::mutex> guard(state->lock);
+    while(state->remaining) {
+        if(state->ready.empty()) {
+            state->finished.wait(guard);
+            continue;
+        }
+
+        guard.unlock();
+        runReady(state, workers);
+        guard.lock();
+    }
+}
+
+} // namespace generator
@@ -4,26 +4,46 @@
 
 #include <vector>
 #include <memory>
-#ifndef _WIN32
-#include <alloca.h>
-#endif //!_WIN32
 
 #include <Base.h>
 #include "Matrix.h"
 
 namespace generator {
 
+/// The number of stream slots in a pipeline. Each stream id is the index of its slot.
+static const U16 kMaxStreams = 64;
+
+/// The first stream id that is not used by the built-in stages.
+static const U16 kFirstCustomStream = 16;
+
+/// Identifies a stream at runtime.
 struct StreamId {
     U16 id;
     U16 itemBits;
 };
 
-struct StreamCounter {
-    static Size currentId;
+/**
+ * A stream with an id, item width and value type that are known at compile time.
+ * Ids are chosen when the stream is defined rather than during static initialization,
+ * so they are the same in every build and persisted stream data stays valid.
+ * Streams accessed through their type use their slot directly, and reads return the value type.
+ */
+template<U16 Id, U16 Bits, class T> struct Stream {
+    static_assert(Id < kMaxStreams, "Stream ids must be less than kMaxStreams.");
+    static_assert(Bits <= sizeof(T) * 8, "The value type of a stream must be able to hold each item.");
+
+    using Value = T;
+    static constexpr U16 id = Id;
+    static constexpr U16 itemBits = Bits;
+
+    constexpr operator StreamId() const {return StreamId {Id, Bits};}
 };
 
-#define DefineStream(name, bits) const StreamId name {(U16)StreamCounter::currentId++, (U16)bits};
-#define DeclareStream(name) extern const StreamId name;
+template<U16 Id, U16 Bits, class T> constexpr U16 Stream<Id, Bits, T>::id;
+template<U16 Id, U16 Bits, class T> constexpr U16 Stream<Id, Bits, T>::itemBits;
+
+/// Defines a stream with a fixed id. Each stream must have a unique id; custom streams start at kFirstCustomStream.
+#define DefineStream(name, id, bits, type) constexpr Stream<id, bits, type> name {};
 
 
 struct Pipeline;
@@ -52,20 +72,35 @@ struct Segment {
 
 /// The common interface for generators inside a stage.
 struct Generator {
-    Generator(std::vector<StreamId>&& auxiliaryStreams = std::vector<StreamId>{}): auxiliaryStreams(::move(auxiliaryStreams)) {}
+    Generator(std::vector<StreamId>&& auxiliaryStreams = std::vector<StreamId>{}, std::vector<StreamId>&& outputStreams = std::vector<StreamId>{}):
+        auxiliaryStreams(::move(auxiliaryStreams)), outputStreams(::move(outputStreams)) {}
+    virtual ~Generator() = default;
+
+    /// Generates data for the provided segment.
+    /// The auxiliaries contain the matrix of each auxiliary stream in order, or null if that stream doesn't exist yet.
     virtual void generate(const Segment& segment, TiledMatrix** auxiliaries, Pipeline& pipeline) = 0;
 
+    /// The streams this generator reads.
     const std::vector<StreamId> auxiliaryStreams;
+
+    /// The streams this generator writes.
+    /// Generators that don't declare any outputs are assumed to write anything, and never run concurrently with others.
+    const std::vector<StreamId> outputStreams;
 };
 
-/// The common interface for generation stages inside the pipeline.
+/**
+ * The common interface for generation stages inside the pipeline.
+ * Generators in a stage run concurrently when the streams they use allow it.
+ * A generator waits for any earlier generator that writes a stream it uses, or that reads a stream it writes,
+ * so the results are the same as running them one by one in the order they were added.
+ *
+ * The parts of each output stream that were generated are recorded in its coverage,
+ * and only the parts of a segment that are missing from any output are generated again.
+ * These parts are aligned to coverage cells, so they may extend outside the requested segment.
+ * Stages that contain a generator without declared outputs cannot track coverage, and always generate the whole segment.
+ */
 struct Stage {
-    virtual void generate(const Segment& segment, Pipeline& pipeline) {
-        for(auto& g: generators) {
-            auto streams = (TiledMatrix**)alloca(sizeof(TiledMatrix*) * g->auxiliaryStreams.size());
-            g->generate(segment, streams, pipeline);
-        }
-    }
+    virtual void generate(const Segment& segment, Pipeline& pipeline);
 
     Stage& operator += (std::unique_ptr<Generator> generator) {
         generators.push_back(::move(generator));
@@ -73,6 +108,12 @@ struct Stage {
     }
 
 private:
+    /// Runs each generator for the provided segment.
+    void run(const Segment& segment, Pipeline& pipeline);
+
+    /// Checks if the generator at index b has to wait for the one at index a.
+    bool dependsOn(Size b, Size a, Pipeline& pipeline) const;
+
     std::vector<std::unique_ptr<Generator>> generators;
 };
 
@@ -4,8 +4,6 @@
 
 namespace generator {
 
-DefineStream(BaseHeight, 16);
-	
 void HeightGenerator::generate(const Segment& segment, TiledMatrix** auxiliaries, Pipeline& pipeline) {
     auto heightTiles = pipeline.data.getOrCreate(BaseHeight, segment.detail);
     generate(segment, *heightTiles, auxiliaries, pipeline);
@@ -6,14 +6,15 @@
 
 namespace generator {
 
-DeclareStream(BaseHeight);
+DefineStream(BaseHeight, 0, 16, U16);
 
 /**
  * Helper base class for height generators.
  * This will automatically send the height map to the overloaded generate().
  */
 struct HeightGenerator: Generator {
-    using Generator::Generator;
+    HeightGenerator(std::vector<StreamId>&& auxiliaryStreams = std::vector<StreamId>{}):
+        Generator(::move(auxiliaryStreams), std::vector<StreamId>{BaseHeight}) {}
     static const Size kDefaultOceanHeight = 100;
 
     void generate(const Segment& segment, TiledMatrix** auxiliaries, Pipeline& pipeline) override;
@@ -23,9 +24,7 @@ struct HeightGenerator: Generator {
      * The default implementation uses the default ocean height as base.
      */
     virtual void generate(const Segment& segment, TiledMatrix& heightMap, TiledMatrix** auxiliaries, Pipeline& pipeline) {
-        segment.map([&](auto x, auto y) {
-            heightMap.set(x, y, segment.detail, kDefaultOceanHeight);
-        });
+        heightMap.fillRegion(segment.x, segment.y, segment.width, segment.height, segment.detail, kDefaultOceanHeight);
     }
 };
 
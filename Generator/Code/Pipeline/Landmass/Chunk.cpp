@@ -1,5 +1,6 @@
 #include "Chunk.h"
 #include "ChunkMatrix.h"
+#include "../Profile.h"
 
 namespace generator {
 namespace landmass {
@@ -17,6 +18,7 @@ inline U32 findVertexIndex(const Chunk& chunk, Vertex v) {
 
 void Chunk::buildCenters(Filler& filler) {
     if(stage >= Points) return;
+    GENERATOR_ZONE("landmass.Chunk.buildCenters");
 
     // Generate the source points we will construct the diagram form.
     FillContext context {cellCenters, x, y, (I32)size};
@@ -28,6 +30,7 @@ void Chunk::buildCenters(Filler& filler) {
 void Chunk::buildVertices(ChunkMatrix& matrix, Filler& filler) {
     if(stage >= Vertices) return;
     buildCenters(filler);
+    GENERATOR_ZONE("landmass.Chunk.buildVertices");
 
     /*
      * Create a voronoi diagram from the cell centers we created.
@@ -99,6 +102,7 @@ void Chunk::buildVertices(ChunkMatrix& matrix, Filler& filler) {
 void Chunk::buildEdges(ChunkMatrix& matrix, Filler& filler) {
     if(stage >= Edges) return;
     buildVertices(matrix, filler);
+    GENERATOR_ZONE("landmass.Chunk.buildEdges");
 
     mapNeighbours(matrix, [&](Chunk& chunk) {
         // Make sure that the neighbour exists and has generated its vertices.
@@ -217,6 +221,7 @@ void Chunk::buildEdges(ChunkMatrix& matrix, Filler& filler) {
 void Chunk::connectEdges(ChunkMatrix& matrix, Filler& filler) {
     if(stage >= Connections) return;
     buildEdges(matrix, filler);
+    GENERATOR_ZONE("landmass.Chunk.connectEdges");
 
     mapNeighbours(matrix, [&](Chunk& chunk) {
         // Make sure that the neighbour exists and has generated its edges.
@@ -247,6 +252,7 @@ void Chunk::connectEdges(ChunkMatrix& matrix, Filler& filler) {
 
 void Chunk::build(ChunkMatrix& matrix, Filler& filler, AttributeId* attributes, Size attributeCount) {
     if(stage >= Attributes) return;
+    GENERATOR_ZONE("landmass.Chunk.build");
 	
     connectEdges(matrix, filler);
     this->attributes.create(attributes, attributeCount, cellCenters.size(), edges.size(), vertices.size());
@@ -2,6 +2,7 @@
 
 #include <Base.h>
 #include "Voronoi.h"
+#include "../TileMap.h"
 
 namespace generator {
 namespace landmass {
@@ -23,21 +24,15 @@ struct ChunkMatrix {
     /// The tile may be created if it doesn't exist.
     Chunk& getChunk(I32 x, I32 y);
 
-    bool isEmpty() const { return (width | height) == 0; }
+    bool isEmpty() const { return tiles.size() == 0; }
 
     U32 getTileSize() {return 1u << this->tileSize;}
     U32 getGridSize() {return this->gridSize;}
     U32 getGridSpread() {return 1u << this->gridSpread;}
 
 private:
-    /// Resizes the matrix to include the provided position.
-    void resize(I32 x, I32 y);
-
-    Chunk** tiles = nullptr;
-    I32 x = 0;
-    I32 y = 0;
-    U16 width = 0;
-    U16 height = 0;
+    /// The chunks that have been created, indexed by chunk position.
+    TileMap<Chunk*> tiles;
     U16 gridSize;
     U8 gridSpread;
     U8 tileSize;
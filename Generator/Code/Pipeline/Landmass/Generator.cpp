@@ -1,10 +1,12 @@
 
 #include "Generator.h"
+#include "../Profile.h"
 
 namespace generator {
 namespace landmass {
 
 void LandmassStage::generate(Chunk& chunk, Size stage, I32 seed) {
+    GENERATOR_ZONE("landmass.generate");
     chunk.build(matrix, filler, attributes.data(), attributes.size());
 
     // Make sure all neighbours have generated any data this stage may depend on.
@@ -35,6 +37,21 @@ Chunk& LandmassStage::generate(I32 x, I32 y, I32 seed) {
     return chunk;
 }
 
+void LandmassStage::generateStage(I32 x, I32 y, Size stage, I32 seed) {
+    GENERATOR_ZONE("landmass.generateStage");
+    auto& chunk = matrix.getChunk(x, y);
+    if(!stage) {
+        chunk.build(matrix, filler, attributes.data(), attributes.size());
+        return;
+    }
+
+    // The chunk may already have been generated through generate().
+    if(chunk.generatorStage >= stage) return;
+
+    generators[stage - 1]->generate(chunk, matrix, seed);
+    chunk.generatorStage = (U8)stage;
+}
+
 LandmassStage& LandmassStage::operator += (std::unique_ptr<Generator> generator) {
     for(Attribute* a: generator->usedAttributes) {
         U32 i = 0;
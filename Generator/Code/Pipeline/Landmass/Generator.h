@@ -13,6 +13,7 @@ namespace landmass {
 
 struct Generator {
     Generator(std::vector<Attribute*>&& attributes = std::vector<Attribute*>{}): usedAttributes(::move(attributes)) {}
+    virtual ~Generator() = default;
     virtual void generate(Chunk& chunk, ChunkMatrix& matrix, I32 seed) = 0;
 
     AttributeId attribute(U32 index) {return attributes[index];}
@@ -32,12 +33,26 @@ struct LandmassStage {
     /// Generates a chunk of voronoi data at the provided position.
     virtual Chunk& generate(I32 x, I32 y, I32 seed);
 
+    /**
+     * Generates a single stage into the voronoi chunk at the provided position.
+     * Stage 0 builds the chunk, and stage n runs the n-th generator.
+     * Before generating stage n, this chunk and its 8 neighbours must be at stage n - 1.
+     * This is used to schedule each stage as a separate job.
+     */
+    void generateStage(I32 x, I32 y, Size stage, I32 seed);
+
+    /// Returns the number of generator stages, which is the stage a fully generated chunk is at.
+    Size stageCount() const {return generators.size();}
+
     /// Adds an attribute generator to be applied to generated voronoi chunks.
     LandmassStage& operator += (std::unique_ptr<Generator> generator);
 
     /// Returns the attribute id for this attribute if it was generated.
     Maybe<AttributeId> attribute(Attribute*);
 
+    /// Returns the ids of the attributes that are stored in each chunk.
+    const std::vector<AttributeId>& usedAttributes() const {return attributes;}
+
     Filler& filler;
     ChunkMatrix matrix;
 
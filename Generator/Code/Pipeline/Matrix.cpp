@@ -1,32 +1,115 @@
 #include <memory>
+#include <vector>
 #include "Matrix.h"
 #include <Math/Math.h>
 
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+
 namespace generator {
 
+/// Interpolates between two rows of values as a + (b - a) * t.
+static void lerpRows(const F32* a, const F32* b, Size count, F32 t, F32* out) {
+    Size i = 0;
+#ifdef __SSE4_1__
+    auto factor = _mm_set1_ps(t);
+    for(; i + 4 <= count; i += 4) {
+        auto va = _mm_loadu_ps(a + i);
+        auto vb = _mm_loadu_ps(b + i);
+        _mm_storeu_ps(out + i, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), factor)));
+    }
+#endif
+    for(; i < count; i++) out[i] = a[i] + (b[i] - a[i]) * t;
+}
+
+/// Interpolates each output between the row values at index[i] and index[i] + 1, using the weight t[i].
+static void lerpColumns(const F32* row, const U32* index, const F32* t, Size count, F32* out) {
+    Size i = 0;
+#ifdef __SSE4_1__
+    for(; i + 4 <= count; i += 4) {
+        auto left = _mm_setr_ps(row[index[i]], row[index[i + 1]], row[index[i + 2]], row[index[i + 3]]);
+        auto right = _mm_setr_ps(row[index[i] + 1], row[index[i + 1] + 1], row[index[i + 2] + 1], row[index[i + 3] + 1]);
+        _mm_storeu_ps(out + i, _mm_add_ps(left, _mm_mul_ps(_mm_sub_ps(right, left), _mm_loadu_ps(t + i))));
+    }
+#endif
+    for(; i < count; i++) {
+        auto left = row[index[i]];
+        out[i] = left + (row[index[i] + 1] - left) * t[i];
+    }
+}
+
 void IdMatrix::create(Size w, Size h, Size detail, Size itemBits) {
-    free(items);
+    release();
 
-    this->itemBits = (U8)itemBits;
+    width = (U32)w;
+    height = (U32)h;
+    valueBits = (U8)itemBits;
     this->detail = (U8)detail;
+    setFormat(itemBits);
+
+    format = Format::Uniform;
+    uniform = 0;
+}
+
+void IdMatrix::view(Size w, Size h, Size detail, Size itemBits, Size* words) {
+    release();
+
+    width = (U32)w;
+    height = (U32)h;
+    valueBits = (U8)itemBits;
+    this->detail = (U8)detail;
+    setFormat(itemBits);
+
+    format = Format::Full;
+    items = words;
+    ownsItems = false;
+}
+
+void IdMatrix::setFormat(Size itemBits) {
+    this->itemBits = (U8)itemBits;
     itemsPerWord = (U8)1 << Tritium::Math::findLastBit(sizeof(Size) * 8 / itemBits);
     itemShift = Tritium::Math::findLastBit(sizeof(Size) * 8 / itemBits);
 
-    wordsPerRow = (U32)(w >> itemShift);
-    items = (Size*)malloc(sizeof(Size) * wordsPerRow * h);
+    wordsPerRow = (U32)(width >> itemShift);
+}
+
+void IdMatrix::release() {
+    if(ownsItems) free(items);
+    free(palette);
+    items = nullptr;
+    palette = nullptr;
+    paletteCount = 0;
+    ownsItems = true;
 }
 
 Size IdMatrix::get(Size x, Size y, Size detail) const {
+    if(format == Format::Uniform) return uniform;
+
     auto row = y >> ((Int)detail - (Int)this->detail);
     auto offset = x >> ((Int)detail - (Int)this->detail);
     auto index = row * wordsPerRow + (offset >> itemShift);
     auto mask = (Size(1) << itemBits) - 1;
     auto maskOffset = offset & (itemsPerWord - 1);
 
-    return items[index] >> (maskOffset * itemBits) & mask;
+    auto item = items[index] >> (maskOffset * itemBits) & mask;
+    return format == Format::Palette ? palette[item] : item;
 }
 
 void IdMatrix::set(Size x, Size y, Size detail, Size value) {
+    if(format == Format::Uniform) {
+        if(value == uniform) return;
+        toPalette();
+    }
+
+    if(format == Format::Palette) {
+        if(addToPalette(value)) {
+            value = paletteIndex(value);
+        } else {
+            expand();
+        }
+    }
+
     auto row = y >> ((Int)detail - (Int)this->detail);
     auto offset = x >> ((Int)detail - (Int)this->detail);
     auto index = row * wordsPerRow + (offset >> itemShift);
@@ -40,12 +123,112 @@ void IdMatrix::set(Size x, Size y, Size detail, Size value) {
     items[index] = c;
 }
 
-TiledMatrix::~TiledMatrix() {
-    for(Size i = 0; i < (Size)width * (Size)height; i++) {
-        tiles[i].~IdMatrix();
+void IdMatrix::fill(Size value) {
+    // Views cannot release their storage, so they are filled in place.
+    if(!ownsItems) {
+        for(Size y = 0; y < height; y++) fillItems(0, y, width, value);
+        return;
     }
-    free(tiles);
-    tiles = nullptr;
+
+    release();
+    setFormat(valueBits);
+    format = Format::Uniform;
+    uniform = value;
+}
+
+Size IdMatrix::memoryUsage() const {
+    if(!ownsItems || !items) return 0;
+
+    auto bytes = sizeof(Size) * wordsPerRow * height;
+    if(palette) bytes += sizeof(Size) * kPaletteSize;
+    return bytes;
+}
+
+bool IdMatrix::addToPalette(Size value) {
+    for(U32 i = 0; i < paletteCount; i++) {
+        if(palette[i] == value) return true;
+    }
+
+    if(paletteCount == kPaletteSize) return false;
+
+    // Widen the indices when they are full, as long as they stay smaller than the values.
+    if(paletteCount == (1u << itemBits)) {
+        auto indexBits = itemBits * 2;
+        if(indexBits >= valueBits) return false;
+        repack(indexBits);
+    }
+
+    palette[paletteCount++] = value;
+    return true;
+}
+
+void IdMatrix::toPalette() {
+    // Rows have to contain at least one whole word of indices.
+    Size indexBits = 1;
+    while(indexBits * width < sizeof(Size) * 8) indexBits *= 2;
+    if(indexBits >= valueBits) {
+        expand();
+        return;
+    }
+
+    setFormat(indexBits);
+    items = (Size*)calloc(wordsPerRow * height, sizeof(Size));
+    palette = (Size*)malloc(sizeof(Size) * kPaletteSize);
+    palette[0] = uniform;
+    paletteCount = 1;
+    format = Format::Palette;
+}
+
+void IdMatrix::repack(Size indexBits) {
+    auto oldItems = items;
+    auto oldWordsPerRow = wordsPerRow;
+    auto oldBits = itemBits;
+    auto oldPerWord = itemsPerWord;
+
+    setFormat(indexBits);
+    items = (Size*)malloc(sizeof(Size) * wordsPerRow * height);
+
+    std::vector<U8> row(width);
+    for(Size y = 0; y < height; y++) {
+        packing::unpackWords(oldItems + y * oldWordsPerRow, oldWordsPerRow, oldBits, oldPerWord, row.data());
+        packing::packWords(row.data(), wordsPerRow, itemBits, itemsPerWord, items + y * wordsPerRow);
+    }
+    free(oldItems);
+}
+
+void IdMatrix::expand() {
+    if(format == Format::Full) return;
+
+    auto oldFormat = format;
+    auto oldItems = items;
+    auto oldPalette = palette;
+    auto oldWordsPerRow = wordsPerRow;
+    auto oldBits = itemBits;
+    auto oldPerWord = itemsPerWord;
+
+    setFormat(valueBits);
+    items = (Size*)malloc(sizeof(Size) * wordsPerRow * height);
+    palette = nullptr;
+    paletteCount = 0;
+    format = Format::Full;
+
+    if(oldFormat == Format::Uniform) {
+        for(Size y = 0; y < height; y++) fillItems(0, y, width, uniform);
+    } else {
+        std::vector<Size> row(width);
+        for(Size y = 0; y < height; y++) {
+            packing::unpackWords(oldItems + y * oldWordsPerRow, oldWordsPerRow, oldBits, oldPerWord, row.data());
+            for(auto& value: row) value = oldPalette[value];
+            writePacked(0, y, width, row.data());
+        }
+    }
+
+    free(oldItems);
+    free(oldPalette);
+}
+
+TiledMatrix::~TiledMatrix() {
+    delete[] mips;
 }
 
 void TiledMatrix::create(Size detail, Size itemBits, U8 tileSize) {
@@ -53,93 +236,190 @@ void TiledMatrix::create(Size detail, Size itemBits, U8 tileSize) {
     this->itemBits = (U8)itemBits;
     this->baseDetail = (U8)detail;
 
-    for(Size i = 0; i < (Size)width * (Size)height; i++) {
-        tiles[i].create(tileSize, tileSize, detail, itemBits);
+    auto size = Size(1) << tileSize;
+    tiles.forEach([=](I32 x, I32 y, IdMatrix& tile) {
+        tile.create(size, size, detail, itemBits);
+    });
+}
+
+void TiledMatrix::enableMips(Size levels, MipFilter filter) {
+    delete[] mips;
+    mips = nullptr;
+    mipLevels = (U8)levels;
+    mipFilter = filter;
+    if(!levels) return;
+
+    mips = new TiledMatrix[levels];
+    for(Size i = 0; i < levels; i++) {
+        mips[i].create(0, itemBits, tileSize);
+        mips[i].mipSource = this;
+        mips[i].sourceLevel = (U8)(i + 1);
+        mips[i].epoch = epoch;
     }
+
+    // Build the levels for any data that already exists.
+    auto size = Int(1) << tileSize;
+    tiles.forEach([&](I32 x, I32 y, const IdMatrix& tile) {
+        if(!tile.isEmpty()) updateMips(x * size, y * size, (x + 1) * size - 1, (y + 1) * size - 1);
+    });
 }
 
-void TiledMatrix::resize(Int x, Int y) {
-    auto left = Tritium::Math::min((I32)x, this->x);
-    auto right = Tritium::Math::max((I32)x + 1, this->x + width);
-    auto bottom = Tritium::Math::min((I32)y, this->y);
-    auto top = Tritium::Math::max((I32)y + 1, this->y + height);
+void TiledMatrix::updateMips(Int left, Int bottom, Int right, Int top) const {
+    for(Size level = 1; level <= mipLevels; level++) updateMipLevel(level, left, bottom, right, top);
+}
 
-    auto w = right - left;
-    auto h = top - bottom;
-    auto dx = (Size)(this->x - left);
-    auto dy = (Size)(this->y - bottom);
+void TiledMatrix::updateMipLevel(Size level, Int left, Int bottom, Int right, Int top) const {
+    // Small updates (such as from set()) use the stack to avoid allocating.
+    U32 stackBuffer[64];
+    std::vector<U32> heapBuffer;
 
-    auto newTiles = (IdMatrix*)malloc(sizeof(IdMatrix) * w * h);
+    auto shift = baseDetail + level;
+    auto x = left >> shift;
+    auto y = bottom >> shift;
+    auto width = (Size)((right >> shift) - x + 1);
+    auto height = (Size)((top >> shift) - y + 1);
 
-    // Initialize new rows below the existing data.
-    for(Size row = 0; row < dy; row++) {
-        for(Size column = 0; column < w; column++) {
-            new (newTiles + row * w + column) IdMatrix;
-        }
+    // Each sample in this level is built from a square of 4 samples in the previous one.
+    auto count = width * height;
+    U32* children = stackBuffer;
+    if(count * 5 > 64) {
+        heapBuffer.resize(count * 5);
+        children = heapBuffer.data();
+    }
+    U32* samples = children + count * 4;
+
+    if(level == 1) {
+        auto step = Int(1) << baseDetail;
+        readRegion(x * 2 * step, y * 2 * step, width * 2 * step, height * 2 * step, baseDetail, children);
+    } else {
+        mips[level - 2].readRegion(x * 2, y * 2, width * 2, height * 2, 0, children);
     }
 
-    // Initialize the area with existing rows.
+    auto stride = width * 2;
     for(Size row = 0; row < height; row++) {
-        // Initialize new values before the row.
-        for(Size column = 0; column < dx; column++) {
-            new (newTiles + (dy + row) * w + column) IdMatrix;
+        for(Size column = 0; column < width; column++) {
+            auto c = children + row * 2 * stride + column * 2;
+            auto a = c[0], b = c[1], d = c[stride], e = c[stride + 1];
+
+            U32 value;
+            if(mipFilter == MipFilter::Min) {
+                value = Tritium::Math::min(Tritium::Math::min(a, b), Tritium::Math::min(d, e));
+            } else if(mipFilter == MipFilter::Max) {
+                value = Tritium::Math::max(Tritium::Math::max(a, b), Tritium::Math::max(d, e));
+            } else {
+                value = (U32)(((U64)a + b + d + e + 2) >> 2);
+            }
+            samples[row * width + column] = value;
         }
+    }
 
-        // Copy the existing row.
-        memcpy(newTiles + (row + dy) * w + dx, tiles + row * width, sizeof(IdMatrix) * width);
+    mips[level - 1].writeRegion(x, y, width, height, 0, samples);
+}
 
-        // Initialize new values at the end of the row.
-        for(Size column = dx + width; column < w; column++) {
-            new (newTiles + row * w + column) IdMatrix;
-        }
+IdMatrix& TiledMatrix::createTile(IdMatrix& tile, Int tileX, Int tileY) const {
+    auto size = Size(1) << tileSize;
+    auto wordCount = tileBytes() / sizeof(Size);
+    auto stored = store && store->contains((I32)tileX, (I32)tileY);
+
+    auto words = store ? store->map((I32)tileX, (I32)tileY, wordCount, true) : nullptr;
+    if(words) {
+        tile.view(size, size, baseDetail, itemBits, words);
+    } else {
+        tile.create(size, size, baseDetail, itemBits);
+        if(stored) store->load((I32)tileX, (I32)tileY, tile.words(), wordCount);
     }
 
-    // Initialize new rows above the existing data.
-    for(Size row = height + dy; row < h; row++) {
-        for(Size column = 0; column < w; column++) {
-            new (newTiles + row * w + column) IdMatrix;
-        }
+    // Evicted mip tiles are rebuilt from the level below.
+    if(mipSource && evictedMips.remove((I32)tileX, (I32)tileY)) {
+        auto worldSize = Int(1) << (tileSize + sourceLevel + mipSource->baseDetail);
+        mipSource->updateMipLevel(sourceLevel, tileX * worldSize, tileY * worldSize, (tileX + 1) * worldSize - 1, (tileY + 1) * worldSize - 1);
     }
 
-    // Update the matrix state.
-    free(tiles);
-    tiles = newTiles;
-    this->x = (I32)left;
-    this->y = (I32)bottom;
-    width = (U16)w;
-    height = (U16)h;
+    // The mip levels may not contain this tile if it was stored by an earlier run.
+    if(stored && mipLevels) {
+        auto worldSize = Int(1) << tileSize;
+        updateMips(tileX * worldSize, tileY * worldSize, (tileX + 1) * worldSize - 1, (tileY + 1) * worldSize - 1);
+    }
+    return tile;
 }
 
-IdMatrix& TiledMatrix::getTile(Int x, Int y) {
-    auto tileX = tileIndex(x) - this->x;
-    auto tileY = tileIndex(y) - this->y;
-    if(tileX < 0 || tileY < 0 || width <= tileX || height <= tileY) {
-        resize(tileIndex(x), tileIndex(y));
-		tileX = tileIndex(x) - this->x;
-		tileY = tileIndex(y) - this->y;
+Size TiledMatrix::tileBytes() const {
+    auto size = Size(1) << tileSize;
+    auto itemsPerWord = Size(1) << Tritium::Math::findLastBit(sizeof(Size) * 8 / itemBits);
+    return sizeof(Size) * (size / itemsPerWord) * size;
+}
+
+IdMatrix& TiledMatrix::tileAt(Int tileX, Int tileY) {
+    auto& tile = tiles.at((I32)tileX, (I32)tileY, epoch);
+    if(tile.isEmpty()) createTile(tile, tileX, tileY);
+    return tile;
+}
+
+const IdMatrix* TiledMatrix::findTile(Int tileX, Int tileY) const {
+    auto tile = tiles.find((I32)tileX, (I32)tileY, epoch);
+    if(tile && !tile->isEmpty()) return tile;
+
+    // Bring back the tile if it was evicted earlier.
+    if((store && store->contains((I32)tileX, (I32)tileY)) || (mipSource && evictedMips.find((I32)tileX, (I32)tileY))) {
+        return &createTile(tiles.at((I32)tileX, (I32)tileY, epoch), tileX, tileY);
     }
+    return nullptr;
+}
 
-    auto& tile = tiles[width * tileY + tileX];
-    if(tile.isEmpty()) {
-        auto size = Size(1) << tileSize;
-        tile.create(size, size, baseDetail, itemBits);
+bool TiledMatrix::evictTile(I32 tileX, I32 tileY) {
+    auto tile = tiles.find(tileX, tileY);
+    if(!tile) return false;
+
+    // Mapped tiles are already in the store.
+    if(store && !tile->isEmpty() && tile->isOwner()) {
+        auto words = tile->words();
+        store->store(tileX, tileY, words, tileBytes() / sizeof(Size));
     }
-    return tile;
+    if(mipSource && !tile->isEmpty()) evictedMips.at(tileX, tileY) = true;
+    return tiles.remove(tileX, tileY);
+}
+
+void TiledMatrix::setEpoch(U32 epoch) {
+    this->epoch = epoch;
+    for(Size i = 0; i < mipLevels; i++) mips[i].setEpoch(epoch);
+}
+
+Size TiledMatrix::memoryUsage() const {
+    Size bytes = 0;
+    tiles.forEach([&](I32 x, I32 y, const IdMatrix& tile) {
+        bytes += tile.memoryUsage();
+    });
+    for(Size i = 0; i < mipLevels; i++) bytes += mips[i].memoryUsage();
+    return bytes;
+}
+
+Size TiledMatrix::tileMemory(I32 tileX, I32 tileY) const {
+    auto tile = tiles.find(tileX, tileY);
+    return tile ? tile->memoryUsage() : 0;
+}
+
+IdMatrix& TiledMatrix::getTile(Int x, Int y) {
+    return tileAt(tileIndex(x), tileIndex(y));
 }
 
 Size TiledMatrix::get(Int x, Int y, Size detail) const {
-    auto tileX = tileIndex(x) - this->x;
-    auto tileY = tileIndex(y) - this->y;
-    if(tileX < 0 || tileY < 0 || width <= tileX || height <= tileY) return 0;
+    if(detail > baseDetail && mipLevels) {
+        auto level = Tritium::Math::min(detail - baseDetail, (Size)mipLevels);
+        auto shift = baseDetail + level;
+        return mips[level - 1].get(x >> shift, y >> shift, 0);
+    }
 
-    return tiles[width * tileY + tileX].get(indexInTile(x), indexInTile(y), detail);
+    auto tile = findTile(tileIndex(x), tileIndex(y));
+    if(!tile) return 0;
+
+    return tile->get(indexInTile(x), indexInTile(y), detail);
 }
 
 Float TiledMatrix::getBilinear(Int x, Int y, Size detail) const {
     // 1/(x2-x1)(y2-y1) * (q11(x2-x)(y2-y)+q21(x-x1)(y2-y)+q12(x2-x)(y-y1)+q22(x-x1)(y-y1))
     auto offset = Size(1) << baseDetail;
-    auto baseX = x >> baseDetail << baseDetail;
-    auto baseY = y >> baseDetail << baseDetail;
+    auto baseX = x & ~Int(offset - 1);
+    auto baseY = y & ~Int(offset - 1);
     auto bl = get(baseX, baseY, detail);
     auto tl = get(baseX, baseY + offset, detail);
     auto br = get(baseX + offset, baseY, detail);
@@ -151,8 +431,155 @@ Float TiledMatrix::getBilinear(Int x, Int y, Size detail) const {
     return (Float)(blFactor + brFactor + tlFactor + trFactor) / (Float)(offset * offset);
 }
 
+void TiledMatrix::sampleBilinear(Int x, Int y, Size width, Size height, Size detail, F32* values) const {
+    auto columns = sampleCount(width, detail);
+    auto rows = sampleCount(height, detail);
+    if(!columns || !rows) return;
+
+    // Find the base samples surrounding the region, including the ones past the last position.
+    auto offset = Int(1) << baseDetail;
+    auto cellMask = ~(offset - 1);
+    auto left = x & cellMask;
+    auto bottom = y & cellMask;
+    auto sourceColumns = (Size)((((x + (Int)((columns - 1) << detail)) & cellMask) - left) >> baseDetail) + 2;
+    auto sourceRows = (Size)((((y + (Int)((rows - 1) << detail)) & cellMask) - bottom) >> baseDetail) + 2;
+
+    std::vector<U32> source(sourceColumns * sourceRows);
+    readRegion(left, bottom, sourceColumns << baseDetail, sourceRows << baseDetail, baseDetail, source.data());
+
+    // Everything after this works on floats, as each source value is used by several results.
+    std::vector<F32> cells(source.size() + sourceColumns);
+    for(Size i = 0; i < source.size(); i++) cells[i] = (F32)source[i];
+    auto blend = cells.data() + source.size();
+
+    // The source column and weight only depend on the result column, so they are shared by all rows.
+    std::vector<U32> index(columns);
+    std::vector<F32> weight(columns);
+    auto scale = 1.f / (F32)offset;
+    for(Size column = 0; column < columns; column++) {
+        auto px = x + (Int)(column << detail);
+        index[column] = (U32)(((px & cellMask) - left) >> baseDetail);
+        weight[column] = (F32)(px - (px & cellMask)) * scale;
+    }
+
+    for(Size row = 0; row < rows; row++) {
+        auto py = y + (Int)(row << detail);
+        auto sourceRow = (Size)(((py & cellMask) - bottom) >> baseDetail);
+        auto below = cells.data() + sourceRow * sourceColumns;
+        lerpRows(below, below + sourceColumns, sourceColumns, (F32)(py - (py & cellMask)) * scale, blend);
+        lerpColumns(blend, index.data(), weight.data(), columns, values + row * columns);
+    }
+}
+
+void TiledMatrix::sampleBilinear(const Int* xs, const Int* ys, Size count, F32* values) const {
+    if(!count) return;
+
+    auto offset = Int(1) << baseDetail;
+    auto cellMask = ~(offset - 1);
+    auto left = xs[0] & cellMask, right = left;
+    auto bottom = ys[0] & cellMask, top = bottom;
+    for(Size i = 1; i < count; i++) {
+        left = Tritium::Math::min(left, xs[i] & cellMask);
+        right = Tritium::Math::max(right, xs[i] & cellMask);
+        bottom = Tritium::Math::min(bottom, ys[i] & cellMask);
+        top = Tritium::Math::max(top, ys[i] & cellMask);
+    }
+
+    // Scattered positions would fetch more source values than they use, so they are sampled separately.
+    auto sourceColumns = (Size)((right - left) >> baseDetail) + 2;
+    auto sourceRows = (Size)((top - bottom) >> baseDetail) + 2;
+    if(sourceColumns * sourceRows > count * 4 + 64) {
+        for(Size i = 0; i < count; i++) values[i] = (F32)getBilinear(xs[i], ys[i], baseDetail);
+        return;
+    }
+
+    std::vector<U32> source(sourceColumns * sourceRows);
+    readRegion(left, bottom, sourceColumns << baseDetail, sourceRows << baseDetail, baseDetail, source.data());
+
+    auto scale = 1.f / (F32)offset;
+    auto sample = [&](Size i, F32* corners, F32& tx, F32& ty) {
+        auto column = (Size)(((xs[i] & cellMask) - left) >> baseDetail);
+        auto row = (Size)(((ys[i] & cellMask) - bottom) >> baseDetail);
+        auto cell = source.data() + row * sourceColumns + column;
+        corners[0] = (F32)cell[0];
+        corners[1] = (F32)cell[1];
+        corners[2] = (F32)cell[sourceColumns];
+        corners[3] = (F32)cell[sourceColumns + 1];
+        tx = (F32)(xs[i] - (xs[i] & cellMask)) * scale;
+        ty = (F32)(ys[i] - (ys[i] & cellMask)) * scale;
+    };
+
+    Size i = 0;
+#ifdef __SSE4_1__
+    for(; i + 4 <= count; i += 4) {
+        alignas(16) F32 corners[4][4];
+        alignas(16) F32 tx[4], ty[4];
+        for(Size j = 0; j < 4; j++) {
+            F32 c[4];
+            sample(i + j, c, tx[j], ty[j]);
+            for(Size k = 0; k < 4; k++) corners[k][j] = c[k];
+        }
+
+        auto fx = _mm_load_ps(tx);
+        auto bl = _mm_load_ps(corners[0]);
+        auto tl = _mm_load_ps(corners[2]);
+        auto below = _mm_add_ps(bl, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(corners[1]), bl), fx));
+        auto above = _mm_add_ps(tl, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(corners[3]), tl), fx));
+        _mm_storeu_ps(values + i, _mm_add_ps(below, _mm_mul_ps(_mm_sub_ps(above, below), _mm_load_ps(ty))));
+    }
+#endif
+    for(; i < count; i++) {
+        F32 c[4], tx, ty;
+        sample(i, c, tx, ty);
+        auto below = c[0] + (c[1] - c[0]) * tx;
+        auto above = c[2] + (c[3] - c[2]) * tx;
+        values[i] = below + (above - below) * ty;
+    }
+}
+
 void TiledMatrix::set(Int x, Int y, Size detail, Size value) {
+    if(detail > baseDetail && mipLevels) {
+        auto size = Size(1) << detail;
+        fillRegion((x >> detail) << detail, (y >> detail) << detail, size, size, baseDetail, value);
+        return;
+    }
+
     getTile(x, y).set(indexInTile(x), indexInTile(y), detail, value);
+    if(mipLevels) updateMips(x, y, x, y);
+}
+
+void TiledMatrix::fillRegion(Int x, Int y, Size width, Size height, Size detail, Size value) {
+    // Coarse samples are read from the pyramid, so they are written to every base sample in their block.
+    if(detail > baseDetail && mipLevels) {
+        auto left = (x >> detail) << detail;
+        auto bottom = (y >> detail) << detail;
+        auto right = ((lastSample(x, width, detail) >> detail) + 1) << detail;
+        auto top = ((lastSample(y, height, detail) >> detail) + 1) << detail;
+        fillRegion(left, bottom, (Size)(right - left), (Size)(top - bottom), baseDetail, value);
+        return;
+    }
+
+    mapTiles(x, y, width, height, detail, [&](const TileSpan& span) {
+        auto& tile = tileAt(span.tileX, span.tileY);
+
+        // Tiles that are covered completely become uniform.
+        auto tileWidth = Size(1) << tileSize;
+        if(span.step == 1 && span.x == 0 && span.y == 0 && span.width == tileWidth && span.height == tileWidth) {
+            tile.fill(value);
+            return;
+        }
+
+        for(Size row = 0; row < span.height; row++) {
+            auto itemY = span.y + row * span.step;
+            if(span.step == 1) {
+                tile.fillItems(span.x, itemY, span.width, value);
+            } else {
+                for(Size i = 0; i < span.width; i++) tile.set(span.x + i * span.step, itemY, baseDetail, value);
+            }
+        }
+    });
+
+    if(mipLevels) updateMips(x, y, lastSample(x, width, detail), lastSample(y, height, detail));
 }
 
 } // namespace generator
\ No newline at end of file
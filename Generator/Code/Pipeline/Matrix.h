@@ -4,10 +4,31 @@
 
 #include "Base.h"
 #include <stdlib.h>
+#include <vector>
+#include <Math/Math.h>
+#include "Packing.h"
+#include "TileMap.h"
+#include "TileStore.h"
 
 namespace generator {
 
+/**
+ * A matrix of packed items with a fixed number of bits.
+ * Matrices start out uniform, where every item has the same value and no storage is allocated.
+ * The first differing write turns them into a palette of up to 16 values with packed indices,
+ * which is in turn promoted to full storage once the palette overflows or stops saving memory.
+ */
 struct IdMatrix {
+    /// The largest number of values in a palette matrix.
+    static const U32 kPaletteSize = 16;
+
+    enum class Format: U8 {
+        None,
+        Uniform,
+        Palette,
+        Full
+    };
+
     IdMatrix() = default;
     IdMatrix(const IdMatrix&) = delete;
 
@@ -16,21 +37,238 @@ struct IdMatrix {
     }
 
     ~IdMatrix() {
-        free(items);
+        release();
     }
 
+    /// Creates a matrix of the provided size where every item is 0.
     void create(Size w, Size h, Size detail, Size itemBits);
+
+    /// Uses existing packed words as the contents of this matrix, without taking ownership of them.
+    /// The words must be laid out as in a matrix created with the same format, and outlive it.
+    /// Matrices created this way always use full storage.
+    void view(Size w, Size h, Size detail, Size itemBits, Size* words);
+
+    /// Checks if the contents of this matrix were allocated by it, rather than provided through view().
+    bool isOwner() const {return ownsItems;}
     Size get(Size x, Size y, Size detail) const;
     void set(Size x, Size y, Size detail, Size value);
-    bool isEmpty() const {return !items;}
+    bool isEmpty() const {return format == Format::None;}
+
+    Format storage() const {return format;}
+    bool isUniform() const {return format == Format::Uniform;}
+
+    /// Returns the value of every item in a uniform matrix.
+    Size uniformValue() const {return uniform;}
+
+    /// Sets every item in the matrix to the same value, releasing any storage if possible.
+    void fill(Size value);
+
+    /// Returns the number of bytes allocated for this matrix.
+    Size memoryUsage() const;
+
+    /// Returns the packed words of this matrix, laid out row by row.
+    /// Compressed matrices are promoted to full storage first.
+    Size* words() {
+        expand();
+        return items;
+    }
+
+    /// Returns the number of packed words in each row when using full storage.
+    U32 rowWords() const {return (U32)(width >> fullShift());}
+
+    /// Reads a run of consecutive items in a row, starting at item (x, y).
+    /// Whole words are decoded at once instead of resolving each item separately.
+    template<class T> void readItems(Size x, Size y, Size count, T* values) const {
+        if(format == Format::Uniform) {
+            for(Size i = 0; i < count; i++) values[i] = (T)uniform;
+            return;
+        }
+
+        readPacked(x, y, count, values);
+        if(format == Format::Palette) {
+            for(Size i = 0; i < count; i++) values[i] = (T)palette[(Size)values[i]];
+        }
+    }
+
+    /// Writes a run of consecutive items in a row, starting at item (x, y).
+    /// Whole words are encoded and stored at once; only partially covered words are read back.
+    template<class T> void writeItems(Size x, Size y, Size count, const T* values) {
+        if(format == Format::Uniform) {
+            Size i = 0;
+            while(i < count && (Size)values[i] == uniform) i++;
+            if(i == count) return;
+            toPalette();
+        }
+
+        if(format == Format::Palette) {
+            // Make sure that every value is in the palette before writing any indices.
+            Size i = 0;
+            while(i < count && addToPalette((Size)values[i])) i++;
+
+            if(i == count) {
+                U8 indices[64];
+                for(Size start = 0; start < count; start += 64) {
+                    auto n = Tritium::Math::min(count - start, (Size)64);
+                    for(Size j = 0; j < n; j++) indices[j] = paletteIndex((Size)values[start + j]);
+                    writePacked(x + start, y, n, indices);
+                }
+                return;
+            }
+            expand();
+        }
+
+        writePacked(x, y, count, values);
+    }
+
+    /// Sets a run of consecutive items in a row to the same value.
+    void fillItems(Size x, Size y, Size count, Size value) {
+        if(format == Format::Uniform) {
+            if(value == uniform) return;
+            toPalette();
+        }
+
+        if(format == Format::Palette) {
+            if(addToPalette(value)) {
+                auto index = (Size)paletteIndex(value);
+                packItems(x, y, count, [=]() {return index;});
+                return;
+            }
+            expand();
+        }
+
+        packItems(x, y, count, [=]() {return value;});
+    }
 
 private:
+    /// Reads packed items directly, which are palette indices in palette matrices.
+    template<class T> void readPacked(Size x, Size y, Size count, T* values) const {
+        auto head = leadingItems(x, count);
+        unpackItems(x, y, head, [&](Size value) {*values++ = (T)value;});
+        x += head;
+        count -= head;
+
+        auto words = count >> itemShift;
+        packing::unpackWords(items + y * wordsPerRow + (x >> itemShift), words, itemBits, itemsPerWord, values);
+        values += words << itemShift;
+        x += words << itemShift;
+        count -= words << itemShift;
+
+        unpackItems(x, y, count, [&](Size value) {*values++ = (T)value;});
+    }
+
+    /// Writes packed items directly, which are palette indices in palette matrices.
+    template<class T> void writePacked(Size x, Size y, Size count, const T* values) {
+        auto head = leadingItems(x, count);
+        packItems(x, y, head, [&]() {return (Size)*values++;});
+        x += head;
+        count -= head;
+
+        auto words = count >> itemShift;
+        packing::packWords(values, words, itemBits, itemsPerWord, items + y * wordsPerRow + (x >> itemShift));
+        values += words << itemShift;
+        x += words << itemShift;
+        count -= words << itemShift;
+
+        packItems(x, y, count, [&]() {return (Size)*values++;});
+    }
+
+    /// Returns the number of items in a run that come before the first word boundary.
+    Size leadingItems(Size x, Size count) const {
+        auto offset = x & (itemsPerWord - 1);
+        return offset ? Tritium::Math::min((Size)(itemsPerWord - offset), count) : 0;
+    }
+
+    template<class F> void unpackItems(Size x, Size y, Size count, F&& f) const {
+        auto mask = (Size(1) << itemBits) - 1;
+        auto word = items + y * wordsPerRow + (x >> itemShift);
+        auto offset = x & (itemsPerWord - 1);
+
+        while(count) {
+            auto c = *word++ >> (offset * itemBits);
+            auto n = Tritium::Math::min((Size)(itemsPerWord - offset), count);
+            for(Size i = 0; i < n; i++) {
+                f(c & mask);
+                c >>= itemBits;
+            }
+            count -= n;
+            offset = 0;
+        }
+    }
+
+    template<class F> void packItems(Size x, Size y, Size count, F&& f) {
+        auto mask = (Size(1) << itemBits) - 1;
+        auto word = items + y * wordsPerRow + (x >> itemShift);
+        auto offset = x & (itemsPerWord - 1);
+
+        while(count) {
+            auto n = Tritium::Math::min((Size)(itemsPerWord - offset), count);
+
+            // Words that are only partially covered keep the items outside the run.
+            Size c = 0;
+            Size keep = 0;
+            if(n < itemsPerWord) {
+                keep = ((Size(1) << (n * itemBits)) - 1) << (offset * itemBits);
+                c = *word & ~keep;
+            }
+
+            for(Size i = 0; i < n; i++) {
+                c |= (f() & mask) << ((offset + i) * itemBits);
+            }
+
+            *word++ = c;
+            count -= n;
+            offset = 0;
+        }
+    }
+
+    /// Sets up the packed item layout for items of the provided size.
+    void setFormat(Size itemBits);
+    U8 fullShift() const {return Tritium::Math::findLastBit(sizeof(Size) * 8 / valueBits);}
+
+    /// Returns the palette index of a value that is in the palette.
+    U8 paletteIndex(Size value) const {
+        U8 i = 0;
+        while(palette[i] != value) i++;
+        return i;
+    }
+
+    /// Adds a value to the palette if needed, widening the indices if they are full.
+    /// Returns false if the palette cannot contain any more values.
+    bool addToPalette(Size value);
+
+    /// Turns a uniform matrix into a palette, or into full storage if a palette would not be smaller.
+    void toPalette();
+
+    /// Changes the number of bits used for each palette index.
+    void repack(Size indexBits);
+
+    /// Promotes the matrix to full storage.
+    void expand();
+
+    void release();
+
+    /// The packed items - palette indices for palette matrices and values for full ones.
     Size* items = nullptr;
+    Size* palette = nullptr;
+    Size uniform = 0;
+    U32 width = 0;
+    U32 height = 0;
     U32 wordsPerRow = 0;
     U8 itemShift;
-    U8 itemBits;
+    U8 itemBits; /// The number of bits in each packed item.
+    U8 valueBits; /// The number of bits in each value.
     U8 detail;
     U8 itemsPerWord;
+    U8 paletteCount = 0;
+    Format format = Format::None;
+    bool ownsItems = true;
+};
+
+/// The filter used to combine samples when building coarser levels of a matrix.
+enum class MipFilter: U8 {
+    Min,
+    Max,
+    Average
 };
 
 struct TiledMatrix {
@@ -41,6 +279,16 @@ struct TiledMatrix {
 
     void create(Size detail, Size itemBits, U8 tileSize);
 
+    /**
+     * Adds a pyramid of coarser levels to this matrix.
+     * Level n contains one value for each square of 2^n samples at the base detail,
+     * combined with the provided filter. The levels are updated incrementally whenever the matrix is written.
+     * Once enabled, reads at a detail higher than the base detail are served from the pyramid,
+     * and return the filtered value of the block containing the position.
+     * Writes at such a detail set every base sample in the block instead, so that they are read back the same way.
+     */
+    void enableMips(Size levels, MipFilter filter);
+
     /// Returns the value at the provided global index.
     Size get(Int x, Int y, Size detail) const;
 
@@ -48,17 +296,195 @@ struct TiledMatrix {
     /// The value is interpolated bilinearly if the matrix has a higher LOD index.
     Float getBilinear(Int x, Int y, Size detail) const;
 
+    /**
+     * Samples a region with bilinear interpolation between the values at the base detail.
+     * The region is sampled the same way as a Segment with the same bounds and detail,
+     * and the results are written row by row. Each result matches getBilinear at that position.
+     * The source values are fetched once for the whole region, which makes this much faster than sampling each position.
+     */
+    void sampleBilinear(Int x, Int y, Size width, Size height, Size detail, F32* values) const;
+
+    /// Samples a list of positions with bilinear interpolation, with the same results as getBilinear.
+    /// Positions close together share their source values.
+    void sampleBilinear(const Int* xs, const Int* ys, Size count, F32* values) const;
+
     /// Sets the value at the provided global index.
     void set(Int x, Int y, Size detail, Size value);
 
+    /// Describes the part of a region that falls inside a single tile.
+    struct TileSpan {
+        Int tileX; /// The index of the tile over the x-axis.
+        Int tileY; /// The index of the tile over the y-axis.
+        Size column; /// The first region sample inside this tile over the x-axis.
+        Size row; /// The first region sample inside this tile over the y-axis.
+        Size width; /// The number of region samples inside this tile over the x-axis.
+        Size height; /// The number of region samples inside this tile over the y-axis.
+        Size x; /// The tile item that contains the first sample over the x-axis.
+        Size y; /// The tile item that contains the first sample over the y-axis.
+        Size step; /// The distance in tile items between consecutive samples.
+    };
+
+    /// Calls the provided function once for each tile covered by a region.
+    /// The region is sampled the same way as a Segment with the same bounds and detail.
+    template<class F> void mapTiles(Int x, Int y, Size width, Size height, Size detail, F&& f) const {
+        auto columns = (Int)sampleCount(width, detail);
+        auto rows = (Int)sampleCount(height, detail);
+        auto tileWidth = Int(1) << tileSize;
+        auto round = (Int(1) << detail) - 1;
+        auto shift = detail - baseDetail;
+
+        for(Int row = 0; row < rows;) {
+            auto tileY = tileIndex(y + (row << detail));
+            auto rowEnd = Tritium::Math::min(rows, ((tileY + 1) * tileWidth - y + round) >> detail);
+
+            for(Int column = 0; column < columns;) {
+                auto tileX = tileIndex(x + (column << detail));
+                auto columnEnd = Tritium::Math::min(columns, ((tileX + 1) * tileWidth - x + round) >> detail);
+
+                TileSpan span {
+                    tileX, tileY,
+                    (Size)column, (Size)row,
+                    (Size)(columnEnd - column), (Size)(rowEnd - row),
+                    indexInTile(x + (column << detail)) >> shift,
+                    indexInTile(y + (row << detail)) >> shift,
+                    Size(1) << baseDetail
+                };
+                f(span);
+                column = columnEnd;
+            }
+            row = rowEnd;
+        }
+    }
+
+    /// Reads a region into a dense buffer with one value per sample, laid out row by row.
+    /// Each covered tile is visited once; samples outside any existing tile are set to 0.
+    template<class T> void readRegion(Int x, Int y, Size width, Size height, Size detail, T* values) const {
+        auto stride = sampleCount(width, detail);
+        if(detail > baseDetail && mipLevels) {
+            auto level = Tritium::Math::min(detail - baseDetail, (Size)mipLevels);
+            auto shift = baseDetail + level;
+            auto rows = sampleCount(height, detail);
+            mips[level - 1].readRegion(x >> shift, y >> shift, stride, rows, 0, values);
+            return;
+        }
+
+        mapTiles(x, y, width, height, detail, [&](const TileSpan& span) {
+            auto tile = findTile(span.tileX, span.tileY);
+            for(Size row = 0; row < span.height; row++) {
+                auto out = values + (span.row + row) * stride + span.column;
+                auto itemY = span.y + row * span.step;
+                if(!tile) {
+                    for(Size i = 0; i < span.width; i++) out[i] = 0;
+                } else if(span.step == 1) {
+                    tile->readItems(span.x, itemY, span.width, out);
+                } else {
+                    for(Size i = 0; i < span.width; i++) out[i] = (T)tile->get(span.x + i * span.step, itemY, baseDetail);
+                }
+            }
+        });
+    }
+
+    /// Writes a region from a dense buffer with one value per sample, laid out row by row.
+    /// Each covered tile is visited once and is created if it doesn't exist.
+    template<class T> void writeRegion(Int x, Int y, Size width, Size height, Size detail, const T* values) {
+        auto stride = sampleCount(width, detail);
+        if(detail > baseDetail && mipLevels) {
+            // Repeat each sample over the base samples in its block.
+            auto rows = sampleCount(height, detail);
+            auto shift = detail - baseDetail;
+            auto baseStride = stride << shift;
+            std::vector<T> blocks(baseStride * (rows << shift));
+            for(Size row = 0; row < rows << shift; row++) {
+                auto in = values + (row >> shift) * stride;
+                auto out = blocks.data() + row * baseStride;
+                for(Size column = 0; column < baseStride; column++) out[column] = in[column >> shift];
+            }
+
+            writeRegion((x >> detail) << detail, (y >> detail) << detail, stride << detail, rows << detail, baseDetail, blocks.data());
+            return;
+        }
+
+        mapTiles(x, y, width, height, detail, [&](const TileSpan& span) {
+            auto& tile = tileAt(span.tileX, span.tileY);
+            for(Size row = 0; row < span.height; row++) {
+                auto in = values + (span.row + row) * stride + span.column;
+                auto itemY = span.y + row * span.step;
+                if(span.step == 1) {
+                    tile.writeItems(span.x, itemY, span.width, in);
+                } else {
+                    for(Size i = 0; i < span.width; i++) tile.set(span.x + i * span.step, itemY, baseDetail, (Size)in[i]);
+                }
+            }
+        });
+
+        if(mipLevels) updateMips(x, y, lastSample(x, width, detail), lastSample(y, height, detail));
+    }
+
+    /// Sets each sample in a region to the same value.
+    void fillRegion(Int x, Int y, Size width, Size height, Size detail, Size value);
+
+    /// Returns the number of samples a region dimension is split into at the provided detail.
+    static Size sampleCount(Size size, Size detail) {
+        return (size + (Size(1) << detail) - 1) >> detail;
+    }
+
     /// Returns the tile that contains the provided global position.
     /// The tile may be created if it doesn't exist.
     IdMatrix& getTile(Int x, Int y);
 
     bool isEmpty() const {return itemBits == 0;}
+
+    /// Returns the detail the matrix stores its samples at.
+    Size getDetail() const {return baseDetail;}
+
+    /// Returns the number of coarser levels kept for this matrix.
+    Size getMipLevels() const {return mipLevels;}
+
+    /// Sets the storage that evicted tiles are written to and loaded from when accessed again.
+    /// The store is not owned by the matrix.
+    void setStore(TileStore* store) {this->store = store;}
+    bool hasStore() const {return store != nullptr;}
+
+    /// Sets the access stamp that is applied to each tile used from now on, including the tiles of the mip levels.
+    void setEpoch(U32 epoch);
+
+    /// Returns the number of bytes allocated by the tiles in this matrix and its mip levels.
+    /// Uniform and mapped tiles don't allocate any memory.
+    Size memoryUsage() const;
+
+    /// Returns the number of bytes allocated by the provided tile.
+    Size tileMemory(I32 tileX, I32 tileY) const;
+
+    /// Removes a tile from memory, writing it to the store if there is one.
+    /// Tiles of a mip level are rebuilt from the level below when they are used again.
+    /// Any references to the tile are invalidated.
+    bool evictTile(I32 tileX, I32 tileY);
+
+    /// Returns the provided mip level, from 1 to getMipLevels().
+    TiledMatrix& mipLevel(Size level) {return mips[level - 1];}
+
+    /// Calls the provided function with the index and access stamp of each tile, as f(tileX, tileY, stamp).
+    template<class F> void forEachTileStamp(F&& f) const {
+        tiles.forEachStamp(f);
+    }
+
 private:
-    /// Resizes the tileset to include the provided position.
-    void resize(Int x, Int y);
+    /// Returns the tile at the provided tile index, creating it if needed.
+    IdMatrix& tileAt(Int tileX, Int tileY);
+
+    /// Rebuilds the part of each mip level that depends on the provided area, given as inclusive global bounds.
+    void updateMips(Int left, Int bottom, Int right, Int top) const;
+
+    /// Rebuilds the part of a single mip level that depends on the provided area, given as inclusive global bounds.
+    void updateMipLevel(Size level, Int left, Int bottom, Int right, Int top) const;
+
+    /// Returns the global position of the last sample in a region dimension.
+    static Int lastSample(Int position, Size size, Size detail) {
+        return position + (Int)((sampleCount(size, detail) - 1) << detail);
+    }
+
+    /// Returns the tile at the provided tile index, or null if it doesn't exist.
+    const IdMatrix* findTile(Int tileX, Int tileY) const;
 
     Int tileIndex(Int position) const {
         return position >> tileSize;
@@ -68,14 +494,32 @@ private:
         return position & ((Int(1) << tileSize) - 1);
     }
 
-    IdMatrix* tiles = nullptr;
-    I32 x = 0;
-    I32 y = 0;
-    U16 width = 0;
-    U16 height = 0;
+    /// Creates an empty tile at the provided tile index, loading its contents from the store if possible.
+    /// Stores that support mapping provide the tile words directly.
+    IdMatrix& createTile(IdMatrix& tile, Int tileX, Int tileY) const;
+
+    /// Returns the number of bytes used by each tile.
+    Size tileBytes() const;
+
+    /// The tiles that are in memory, indexed by tile position.
+    /// Tiles may be loaded from the store on any access, which is why this is mutable.
+    mutable TileMap<IdMatrix> tiles;
+    TileStore* store = nullptr;
+    U32 epoch = 0;
+
+    /// The coarser levels of this matrix, if enabled. Each level uses its own sample positions as index.
+    TiledMatrix* mips = nullptr;
+
+    /// The matrix this is a mip level of, and the tiles of this level that were evicted and have to be rebuilt from it.
+    const TiledMatrix* mipSource = nullptr;
+    mutable TileMap<bool> evictedMips;
+    U8 sourceLevel = 0;
+
     U8 tileSize = 0;
     U8 itemBits = 0;
     U8 baseDetail = 0;
+    U8 mipLevels = 0;
+    MipFilter mipFilter = MipFilter::Average;
 };
 
 } // namespace generator
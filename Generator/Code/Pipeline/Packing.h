@@ -0,0 +1,347 @@
+
+#ifndef GENERATOR_PACKING_H
+#define GENERATOR_PACKING_H
+
+#include <Base.h>
+#include <string.h>
+#include <type_traits>
+
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+
+/*
+ * Kernels for converting between bit-packed matrix rows and plain arrays.
+ * Packed rows consist of Size words, each containing a power-of-two number of items
+ * where item i of a word is stored at bit i * itemBits.
+ * The kernels only handle whole words - callers are responsible for partially covered words at the row edges.
+ */
+
+namespace generator {
+namespace packing {
+
+/// Decodes whole packed words with any item width.
+template<class T> void unpackScalar(const Size* words, Size wordCount, Size itemBits, Size itemsPerWord, T* out) {
+    auto mask = (Size(1) << itemBits) - 1;
+    for(Size w = 0; w < wordCount; w++) {
+        auto c = words[w];
+        for(Size i = 0; i < itemsPerWord; i++) {
+            *out++ = (T)(c & mask);
+            c >>= itemBits;
+        }
+    }
+}
+
+/// Encodes whole packed words with any item width. Values are truncated to the item width.
+template<class T> void packScalar(const T* in, Size wordCount, Size itemBits, Size itemsPerWord, Size* words) {
+    auto mask = (Size(1) << itemBits) - 1;
+    for(Size w = 0; w < wordCount; w++) {
+        Size c = 0;
+        for(Size i = 0; i < itemsPerWord; i++) {
+            c |= ((Size)*in++ & mask) << (i * itemBits);
+        }
+        words[w] = c;
+    }
+}
+
+#ifdef __SSE4_1__
+
+/// The element types that have vectorized kernels.
+template<class T> struct IsLane {static const bool value = false;};
+template<> struct IsLane<U8> {static const bool value = true;};
+template<> struct IsLane<U16> {static const bool value = true;};
+template<> struct IsLane<U32> {static const bool value = true;};
+
+static_assert(sizeof(Size) == 8, "The vectorized kernels expect 64-bit words.");
+
+inline __m128i load64(const void* p) {return _mm_loadl_epi64((const __m128i*)p);}
+inline __m128i load128(const void* p) {return _mm_loadu_si128((const __m128i*)p);}
+inline void store64(void* p, __m128i v) {_mm_storel_epi64((__m128i*)p, v);}
+inline void store128(void* p, __m128i v) {_mm_storeu_si128((__m128i*)p, v);}
+
+inline __m128i load32(const void* p) {
+    I32 v;
+    memcpy(&v, p, sizeof(v));
+    return _mm_cvtsi32_si128(v);
+}
+
+inline void store32(void* p, __m128i v) {
+    auto i = _mm_cvtsi128_si32(v);
+    memcpy(p, &i, sizeof(i));
+}
+
+/// Gathers the low byte of each 16-bit lane into the low 8 bytes.
+inline __m128i lowBytes16(__m128i v) {
+    return _mm_shuffle_epi8(v, _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1));
+}
+
+/// Gathers the low byte of each 32-bit lane into the low 4 bytes.
+inline __m128i lowBytes32(__m128i v) {
+    return _mm_shuffle_epi8(v, _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+}
+
+/// Gathers the low half of each 32-bit lane into the low 8 bytes.
+inline __m128i lowHalves32(__m128i v) {
+    return _mm_shuffle_epi8(v, _mm_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1));
+}
+
+/// Expands the 16 2-bit items in the low 4 bytes into one byte each.
+inline __m128i expand2(__m128i v) {
+    auto bytes = _mm_shuffle_epi8(v, _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3));
+
+    // Each byte is shifted by 0, 2, 4 or 6 depending on its item index.
+    // Shifting 16-bit lanes is fine, as we only keep the two lowest bits of each byte.
+    auto select = _mm_set1_epi32(0xff);
+    auto r = _mm_and_si128(bytes, select);
+    r = _mm_or_si128(r, _mm_and_si128(_mm_srli_epi16(bytes, 2), _mm_slli_epi32(select, 8)));
+    r = _mm_or_si128(r, _mm_and_si128(_mm_srli_epi16(bytes, 4), _mm_slli_epi32(select, 16)));
+    r = _mm_or_si128(r, _mm_and_si128(_mm_srli_epi16(bytes, 6), _mm_slli_epi32(select, 24)));
+    return _mm_and_si128(r, _mm_set1_epi8(3));
+}
+
+/// Compresses 16 byte-sized items into 2-bit items in the low 4 bytes.
+inline __m128i compress2(__m128i v) {
+    v = _mm_and_si128(v, _mm_set1_epi8(3));
+    auto pairs = _mm_maddubs_epi16(v, _mm_set1_epi16(0x0401));
+    auto quads = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00100001));
+    return lowBytes32(quads);
+}
+
+/*
+ * 2-bit items.
+ */
+
+inline void unpack2(const Size* words, Size wordCount, U8* out) {
+    for(Size w = 0; w < wordCount; w++, out += 32) {
+        auto v = load64(words + w);
+        store128(out, expand2(v));
+        store128(out + 16, expand2(_mm_srli_si128(v, 4)));
+    }
+}
+
+inline void unpack2(const Size* words, Size wordCount, U16* out) {
+    for(Size w = 0; w < wordCount; w++, out += 32) {
+        auto v = load64(words + w);
+        auto a = expand2(v);
+        auto b = expand2(_mm_srli_si128(v, 4));
+        store128(out, _mm_cvtepu8_epi16(a));
+        store128(out + 8, _mm_cvtepu8_epi16(_mm_srli_si128(a, 8)));
+        store128(out + 16, _mm_cvtepu8_epi16(b));
+        store128(out + 24, _mm_cvtepu8_epi16(_mm_srli_si128(b, 8)));
+    }
+}
+
+inline void unpack2(const Size* words, Size wordCount, U32* out) {
+    for(Size w = 0; w < wordCount; w++) {
+        auto v = load64(words + w);
+        for(Size half = 0; half < 2; half++, v = _mm_srli_si128(v, 4)) {
+            auto a = expand2(v);
+            for(Size i = 0; i < 4; i++, out += 4, a = _mm_srli_si128(a, 4)) {
+                store128(out, _mm_cvtepu8_epi32(a));
+            }
+        }
+    }
+}
+
+inline void pack2(const U8* in, Size wordCount, Size* words) {
+    for(Size w = 0; w < wordCount; w++, in += 32) {
+        auto lo = compress2(load128(in));
+        auto hi = compress2(load128(in + 16));
+        store64(words + w, _mm_unpacklo_epi32(lo, hi));
+    }
+}
+
+inline void pack2(const U16* in, Size wordCount, Size* words) {
+    auto mask = _mm_set1_epi16(3);
+    for(Size w = 0; w < wordCount; w++, in += 32) {
+        auto a = _mm_packus_epi16(_mm_and_si128(load128(in), mask), _mm_and_si128(load128(in + 8), mask));
+        auto b = _mm_packus_epi16(_mm_and_si128(load128(in + 16), mask), _mm_and_si128(load128(in + 24), mask));
+        store64(words + w, _mm_unpacklo_epi32(compress2(a), compress2(b)));
+    }
+}
+
+inline void pack2(const U32* in, Size wordCount, Size* words) {
+    auto mask = _mm_set1_epi32(3);
+    for(Size w = 0; w < wordCount; w++, in += 32) {
+        __m128i bytes[2];
+        for(Size half = 0; half < 2; half++) {
+            auto p = in + half * 16;
+            auto a = _mm_packus_epi32(_mm_and_si128(load128(p), mask), _mm_and_si128(load128(p + 4), mask));
+            auto b = _mm_packus_epi32(_mm_and_si128(load128(p + 8), mask), _mm_and_si128(load128(p + 12), mask));
+            bytes[half] = compress2(_mm_packus_epi16(a, b));
+        }
+        store64(words + w, _mm_unpacklo_epi32(bytes[0], bytes[1]));
+    }
+}
+
+/*
+ * 8-bit items.
+ */
+
+inline void unpack8(const Size* words, Size wordCount, U8* out) {
+    memcpy(out, words, wordCount * sizeof(Size));
+}
+
+inline void unpack8(const Size* words, Size wordCount, U16* out) {
+    for(Size w = 0; w < wordCount; w++, out += 8) {
+        store128(out, _mm_cvtepu8_epi16(load64(words + w)));
+    }
+}
+
+inline void unpack8(const Size* words, Size wordCount, U32* out) {
+    for(Size w = 0; w < wordCount; w++, out += 8) {
+        auto v = load64(words + w);
+        store128(out, _mm_cvtepu8_epi32(v));
+        store128(out + 4, _mm_cvtepu8_epi32(_mm_srli_si128(v, 4)));
+    }
+}
+
+inline void pack8(const U8* in, Size wordCount, Size* words) {
+    memcpy(words, in, wordCount * sizeof(Size));
+}
+
+inline void pack8(const U16* in, Size wordCount, Size* words) {
+    for(Size w = 0; w < wordCount; w++, in += 8) {
+        store64(words + w, lowBytes16(load128(in)));
+    }
+}
+
+inline void pack8(const U32* in, Size wordCount, Size* words) {
+    for(Size w = 0; w < wordCount; w++, in += 8) {
+        store64(words + w, _mm_unpacklo_epi32(lowBytes32(load128(in)), lowBytes32(load128(in + 4))));
+    }
+}
+
+/*
+ * 16-bit items.
+ */
+
+inline void unpack16(const Size* words, Size wordCount, U8* out) {
+    for(Size w = 0; w < wordCount; w++, out += 4) {
+        store32(out, lowBytes16(load64(words + w)));
+    }
+}
+
+inline void unpack16(const Size* words, Size wordCount, U16* out) {
+    memcpy(out, words, wordCount * sizeof(Size));
+}
+
+inline void unpack16(const Size* words, Size wordCount, U32* out) {
+    for(Size w = 0; w < wordCount; w++, out += 4) {
+        store128(out, _mm_cvtepu16_epi32(load64(words + w)));
+    }
+}
+
+inline void pack16(const U8* in, Size wordCount, Size* words) {
+    for(Size w = 0; w < wordCount; w++, in += 4) {
+        store64(words + w, _mm_cvtepu8_epi16(load32(in)));
+    }
+}
+
+inline void pack16(const U16* in, Size wordCount, Size* words) {
+    memcpy(words, in, wordCount * sizeof(Size));
+}
+
+inline void pack16(const U32* in, Size wordCount, Size* words) {
+    for(Size w = 0; w < wordCount; w++, in += 4) {
+        store64(words + w, lowHalves32(load128(in)));
+    }
+}
+
+/*
+ * 32-bit items.
+ */
+
+inline void unpack32(const Size* words, Size wordCount, U8* out) {
+    for(Size w = 0; w < wordCount; w++, out += 2) {
+        auto v = lowBytes32(load64(words + w));
+        auto i = (U16)_mm_cvtsi128_si32(v);
+        memcpy(out, &i, sizeof(i));
+    }
+}
+
+inline void unpack32(const Size* words, Size wordCount, U16* out) {
+    for(Size w = 0; w < wordCount; w++, out += 2) {
+        store32(out, lowHalves32(load64(words + w)));
+    }
+}
+
+inline void unpack32(const Size* words, Size wordCount, U32* out) {
+    memcpy(out, words, wordCount * sizeof(Size));
+}
+
+inline void pack32(const U8* in, Size wordCount, Size* words) {
+    for(Size w = 0; w < wordCount; w++, in += 2) {
+        U16 i;
+        memcpy(&i, in, sizeof(i));
+        store64(words + w, _mm_cvtepu8_epi32(_mm_cvtsi32_si128(i)));
+    }
+}
+
+inline void pack32(const U16* in, Size wordCount, Size* words) {
+    for(Size w = 0; w < wordCount; w++, in += 2) {
+        store64(words + w, _mm_cvtepu16_epi32(load32(in)));
+    }
+}
+
+inline void pack32(const U32* in, Size wordCount, Size* words) {
+    memcpy(words, in, wordCount * sizeof(Size));
+}
+
+/// Uses a vectorized kernel if there is one for this item width.
+template<class T> typename std::enable_if<IsLane<T>::value, bool>::type
+unpackVector(const Size* words, Size wordCount, Size itemBits, T* out) {
+    switch(itemBits) {
+        case 2: unpack2(words, wordCount, out); return true;
+        case 8: unpack8(words, wordCount, out); return true;
+        case 16: unpack16(words, wordCount, out); return true;
+        case 32: unpack32(words, wordCount, out); return true;
+        default: return false;
+    }
+}
+
+template<class T> typename std::enable_if<IsLane<T>::value, bool>::type
+packVector(const T* in, Size wordCount, Size itemBits, Size* words) {
+    switch(itemBits) {
+        case 2: pack2(in, wordCount, words); return true;
+        case 8: pack8(in, wordCount, words); return true;
+        case 16: pack16(in, wordCount, words); return true;
+        case 32: pack32(in, wordCount, words); return true;
+        default: return false;
+    }
+}
+
+template<class T> typename std::enable_if<!IsLane<T>::value, bool>::type
+unpackVector(const Size*, Size, Size, T*) {return false;}
+
+template<class T> typename std::enable_if<!IsLane<T>::value, bool>::type
+packVector(const T*, Size, Size, Size*) {return false;}
+
+#endif // __SSE4_1__
+
+/**
+ * Decodes whole packed words into an array of values.
+ * The common item widths (2, 8, 16 and 32 bits) are decoded with vector instructions
+ * into U8, U16 and U32 arrays if available; anything else uses the scalar path.
+ */
+template<class T> void unpackWords(const Size* words, Size wordCount, Size itemBits, Size itemsPerWord, T* out) {
+#ifdef __SSE4_1__
+    if(unpackVector(words, wordCount, itemBits, out)) return;
+#endif
+    unpackScalar(words, wordCount, itemBits, itemsPerWord, out);
+}
+
+/**
+ * Encodes an array of values into whole packed words.
+ * Values are truncated to the item width, the same way as reading them back would.
+ */
+template<class T> void packWords(const T* in, Size wordCount, Size itemBits, Size itemsPerWord, Size* words) {
+#ifdef __SSE4_1__
+    if(packVector(in, wordCount, itemBits, words)) return;
+#endif
+    packScalar(in, wordCount, itemBits, itemsPerWord, words);
+}
+
+}} // namespace generator::packing
+
+#endif // GENERATOR_PACKING_H
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include "Pipeline.h"
+#include "Profile.h"
 #include "Voxel.h"
 #include "Biome/BiomeStage.h"
 
@@ -9,37 +11,367 @@ static Segment toSegment(Area area) {
 }
 
 TiledMatrix* Pipeline::Data::get(StreamId stream) {
-    if(stream.id >= count) return nullptr;
+    if(stream.id >= kMaxStreams) return nullptr;
     if(matrices[stream.id].isEmpty()) return nullptr;
     return matrices + stream.id;
 }
 
 TiledMatrix* Pipeline::Data::getOrCreate(StreamId stream, Size detail) {
-    if(stream.id >= count) resize(stream.id + 1);
-    if(matrices[stream.id].isEmpty()) matrices[stream.id].create(detail, stream.itemBits, tileSize);
-    return matrices + stream.id;
+    if(stream.id >= kMaxStreams) return nullptr;
+
+    auto& matrix = matrices[stream.id];
+    if(matrix.isEmpty()) {
+        matrix.create(detail, stream.itemBits, tileSize);
+        matrix.setEpoch(epoch);
+        matrix.setStore(createStore(stream, detail));
+        if(stream.id < mipConfigs.size() && mipConfigs[stream.id].levels) {
+            matrix.enableMips(mipConfigs[stream.id].levels, mipConfigs[stream.id].filter);
+        }
+    }
+    return &matrix;
+}
+
+void Pipeline::Data::setSource(StreamId stream, Stage& stage, U8 detail) {
+    if(stream.id >= kMaxStreams) return;
+    if(stream.id >= sources.size()) sources.resize(stream.id + 1, Source {nullptr, stream, 0});
+    sources[stream.id] = Source {&stage, stream, detail};
+}
+
+TiledMatrix* Pipeline::Data::require(StreamId stream, I32 x, I32 y, U32 width, U32 height) {
+    if(!pipeline || stream.id >= sources.size() || !sources[stream.id].stage || !width || !height) return get(stream);
+
+    // The stream is created before its coverage is read, as persistent streams load the coverage they saved.
+    auto& source = sources[stream.id];
+    auto matrix = getOrCreate(source.stream, source.detail);
+    auto& covered = coverage(stream);
+    if(covered.covers(x, y, width, height, source.detail)) return matrix;
+
+    // Extend the region to whole cells, so that it can be marked as covered.
+    // The stage skips the cells it already generated, but stages that cannot track their coverage generate everything.
+    auto shift = covered.alignment(source.detail);
+    auto left = (x >> shift) << shift;
+    auto bottom = (y >> shift) << shift;
+    auto right = (((x + (I32)width - 1) >> shift) + 1) << shift;
+    auto top = (((y + (I32)height - 1) >> shift) + 1) << shift;
+
+    Segment segment {left, bottom, (U32)(right - left), (U32)(top - bottom), 1.f, source.detail};
+    source.stage->generate(segment, *pipeline);
+    covered.cover(segment.x, segment.y, segment.width, segment.height, source.detail);
+    return matrix;
+}
+
+void Pipeline::Data::require(I32 x, I32 y, U32 width, U32 height) {
+    for(auto& source: sources) {
+        if(source.stage) require(source.stream, x, y, width, height);
+    }
+}
+
+bool Pipeline::Data::isGenerated(I32 x, I32 y, U32 width, U32 height) {
+    for(Size i = 0; i < sources.size(); i++) {
+        if(!sources[i].stage) continue;
+        if(i >= coverages.size() || !coverages[i]) return false;
+        if(!coverages[i]->covers(x, y, width, height, sources[i].detail)) return false;
+    }
+    return true;
+}
+
+void Pipeline::Data::setMips(StreamId stream, Size levels, MipFilter filter) {
+    if(stream.id >= mipConfigs.size()) mipConfigs.resize(stream.id + 1, MipConfig {0, MipFilter::Average});
+    mipConfigs[stream.id] = MipConfig {(U8)levels, filter};
+
+    if(auto matrix = get(stream)) matrix->enableMips(levels, filter);
+}
+
+TileStore* Pipeline::Data::createStore(StreamId stream, Size detail) {
+    auto name = "/stream" + std::to_string(stream.id);
+
+    // Persistent files also keep evicted tiles, so they take precedence over spilling.
+    if(!storageDirectory.empty()) {
+        auto path = storageDirectory + name + ".tiles";
+        std::unique_ptr<TileFile> file(new TileFile(path.c_str(), stream.id, (U8)stream.itemBits, tileSize, (U8)detail));
+        if(file->isOpen()) {
+            file->keepCoverage(coverage(stream));
+            stores.push_back(::move(file));
+            return stores.back().get();
+        }
+    }
+
+    if(!spillDirectory.empty()) {
+        auto path = spillDirectory + name + ".spill";
+        std::unique_ptr<SpillFile> file(new SpillFile(path.c_str()));
+        if(file->isOpen()) {
+            stores.push_back(::move(file));
+            return stores.back().get();
+        }
+    }
+    return nullptr;
+}
+
+Coverage& Pipeline::Data::coverage(StreamId stream) {
+    if(stream.id >= coverages.size()) coverages.resize(stream.id + 1);
+
+    auto& coverage = coverages[stream.id];
+    if(!coverage) coverage.reset(new Coverage(coverageShift));
+    return *coverage;
+}
+
+void Pipeline::Data::flush() {
+    for(auto& store: stores) store->flush();
+}
+
+void Pipeline::Data::trim() {
+    epoch++;
+    for(U32 i = 0; i < kMaxStreams; i++) {
+        matrices[i].setEpoch(epoch);
+    }
+
+    auto usage = memoryUsage();
+    if(!memoryBudget || usage <= memoryBudget) return;
+
+    struct Candidate {
+        U32 age;
+        U32 stream;
+        U32 level;
+        I32 x;
+        I32 y;
+    };
+
+    // Tiles used since the previous trim have the previous epoch and are still in use.
+    // Mip tiles are evicted the same way, and are rebuilt from the level below when used again.
+    std::vector<Candidate> candidates;
+    for(U32 i = 0; i < kMaxStreams; i++) {
+        for(U32 level = 0; level <= matrices[i].getMipLevels(); level++) {
+            auto& matrix = level ? matrices[i].mipLevel(level) : matrices[i];
+            matrix.forEachTileStamp([&](I32 x, I32 y, U32 stamp) {
+                auto age = epoch - stamp;
+                if(age > 1) candidates.push_back(Candidate {age, i, level, x, y});
+            });
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        return a.age > b.age;
+    });
+
+    for(auto& candidate: candidates) {
+        if(usage <= memoryBudget) break;
+
+        auto& stream = matrices[candidate.stream];
+        auto& matrix = candidate.level ? stream.mipLevel(candidate.level) : stream;
+        auto bytes = matrix.tileMemory(candidate.x, candidate.y);
+        if(!bytes) continue;
+
+        usage -= bytes;
+        auto stored = matrix.hasStore();
+        matrix.evictTile(candidate.x, candidate.y);
+        if(candidate.level) {
+            mipsEvicted = true;
+            continue;
+        }
+
+        // Without a store the tile data is lost, so that area has to be generated again.
+        if(!stored && candidate.stream < coverages.size() && coverages[candidate.stream]) {
+            auto tileWidth = U32(1) << tileSize;
+            coverages[candidate.stream]->clear(candidate.x * (I32)tileWidth, candidate.y * (I32)tileWidth, tileWidth, tileWidth);
+        }
+    }
 }
 
-void Pipeline::Data::resize(Size count) {
-    matrices = (TiledMatrix*)realloc(matrices, sizeof(TiledMatrix) * count);
-    for(Size i = this->count; i < count; i++) {
-        new (matrices + i) TiledMatrix;
+Size Pipeline::Data::memoryUsage() const {
+    Size usage = 0;
+    for(U32 i = 0; i < kMaxStreams; i++) {
+        usage += matrices[i].memoryUsage();
     }
-    this->count = (U32)count;
+    return usage;
 }
 
 void Pipeline::fillChunk(Chunk& chunk) {
-    auto& land = landmass.generate(chunk.area.x, chunk.area.y, seed);
+    GENERATOR_ZONE("Pipeline.fillChunk");
 
+    // No stream tiles are referenced between chunks, which makes this a safe point to evict unused ones.
+    {
+        std::lock_guard<std::shared_timed_mutex> guard(dataLock);
+        data.trim();
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(landmassLock);
+        landmass.generate(chunk.area.x, chunk.area.y, seed);
+    }
+
+    fillTerrain(chunk);
+}
+
+JobHandle Pipeline::submit(Chunk& chunk, Priority priority) {
+    // Only trim if no job is reading stream data, rather than waiting for them.
+    if(dataLock.try_lock()) {
+        data.trim();
+        dataLock.unlock();
+    }
+
+    JobHandle land;
+    {
+        std::lock_guard<std::mutex> guard(scheduleLock);
+        land = scheduleLandmass(chunk.area.x, chunk.area.y, landmass.stageCount());
+    }
+
+    return workers.schedule([this, &chunk] {fillTerrain(chunk);}, &land, 1, priority);
+}
+
+Size Pipeline::landmassJobCount() {
+    std::lock_guard<std::mutex> guard(scheduleLock);
+    return landmassJobs.size();
+}
+
+JobHandle Pipeline::scheduleLandmass(I32 x, I32 y, Size stage) {
+    auto existing = landmassJobs.find(x, y);
+    if(existing && existing->size() > stage && (*existing)[stage]) return (*existing)[stage];
+
+    // The jobs of finished chunks were dropped, and are not needed again.
+    if(!existing && finishedLandmass.find(x, y)) return nullptr;
+
+    auto& jobs = landmassJobs.at(x, y);
+    if(jobs.size() <= stage) jobs.resize(stage + 1);
+
+    // Each stage needs the chunk and its neighbours at the previous stage.
+    std::vector<JobHandle> dependencies;
+    if(stage > 0) {
+        dependencies.push_back(scheduleLandmass(x, y, stage - 1));
+        for(auto offset: landmass::neighbourOffsets) {
+            dependencies.push_back(scheduleLandmass(x + offset.x, y + offset.y, stage - 1));
+        }
+    }
+
+    // Once the final stage is done, the chunk is finished and its jobs are no longer needed.
+    auto last = stage == landmass.stageCount();
+    auto job = workers.schedule([=] {
+        {
+            std::lock_guard<std::mutex> guard(landmassLock);
+            landmass.generateStage(x, y, stage, seed);
+        }
+        if(last) {
+            std::lock_guard<std::mutex> guard(scheduleLock);
+            landmassJobs.remove(x, y);
+            finishedLandmass.at(x, y) = true;
+        }
+    }, dependencies);
+
+    // Scheduling the dependencies may have moved the job list.
+    landmassJobs.find(x, y)->at(stage) = job;
+    return job;
+}
+
+void Pipeline::fillChunks(Chunk** chunks, Size count) {
+    if(!count) return;
+    GENERATOR_ZONE("Pipeline.fillChunks");
+
+    {
+        std::lock_guard<std::shared_timed_mutex> guard(dataLock);
+        data.trim();
+    }
+
+    // Sort the chunks by stream tile and then by position, so that chunks that use the same tiles are filled together.
+    // Chunks at the same position end up next to each other, which lets them share their landmass chunk.
+    std::vector<Chunk*> sorted(chunks, chunks + count);
+    auto tileShift = data.getTileSize();
+    std::sort(sorted.begin(), sorted.end(), [=](const Chunk* a, const Chunk* b) {
+        auto ax = a->area.x >> tileShift, ay = a->area.y >> tileShift;
+        auto bx = b->area.x >> tileShift, by = b->area.y >> tileShift;
+        if(ay != by) return ay < by;
+        if(ax != bx) return ax < bx;
+        if(a->area.y != b->area.y) return a->area.y < b->area.y;
+        return a->area.x < b->area.x;
+    });
+
+    {
+        std::lock_guard<std::mutex> guard(landmassLock);
+        const Chunk* previous = nullptr;
+        for(auto chunk: sorted) {
+            if(!previous || previous->area.x != chunk->area.x || previous->area.y != chunk->area.y) {
+                landmass.generate(chunk->area.x, chunk->area.y, seed);
+            }
+            previous = chunk;
+        }
+    }
+
+    fillTerrain(sorted.data(), sorted.size());
+}
+
+/// Calls f(x, y, width, height) for each region of the streams that the terrain of a chunk reads.
+template<class F> static void mapTerrainRegions(const Area& area, F&& f) {
+    // The biome is looked up at the chunk position, while the biomes themselves read the whole chunk area.
+    f(area.x, area.y, 1u, 1u);
+    f(area.x * (I32)area.width, area.y * (I32)area.height, (U32)area.worldWidth(), (U32)area.worldHeight());
+}
+
+bool Pipeline::isTerrainGenerated(Chunk** chunks, Size count) {
+    bool generated = true;
+    for(Size i = 0; i < count && generated; i++) {
+        mapTerrainRegions(chunks[i]->area, [&](I32 x, I32 y, U32 width, U32 height) {
+            generated = generated && data.isGenerated(x, y, width, height);
+        });
+    }
+    return generated;
+}
+
+void Pipeline::requireTerrain(Chunk** chunks, Size count) {
+    for(Size i = 0; i < count; i++) {
+        mapTerrainRegions(chunks[i]->area, [&](I32 x, I32 y, U32 width, U32 height) {
+            data.require(x, y, width, height);
+        });
+    }
+}
+
+void Pipeline::generateTerrain(Chunk** chunks, Size count) {
     // Get the closest vertex and its direct neighbours, then calculate biome strengths for each voxel pillar.
 
 
-    // Generate the terrain for this chunk.
-    if(auto biomes = data.get(Biomes)) {
-        auto id = (BiomeId)biomes->get(chunk.area.x, chunk.area.y, 0);
-        auto biome = findBiome(id);
+    // Generate the terrain for each chunk.
+    auto biomes = data.get(Biomes);
+    if(!biomes) return;
+
+    GenerateChunk biome = nullptr;
+    BiomeId biomeId = 0;
+    for(Size i = 0; i < count; i++) {
+        auto& chunk = *chunks[i];
+        auto id = biomes.get(chunk.area.x, chunk.area.y, 0);
+        if(!biome || id != biomeId) {
+            biome = findBiome(id);
+            biomeId = id;
+        }
         biome(chunk, *this);
     }
 }
 
+void Pipeline::fillTerrain(Chunk** chunks, Size count) {
+    GENERATOR_ZONE("Pipeline.fillTerrain");
+
+    // The terrain is read under the same lock as the coverage check, so that a trim in between cannot evict the data it reads.
+    // Stores and evicted mips are only added under the exclusive lock and never removed, so readsModify() stays true once set.
+    for(;;) {
+        // Chunks that were filled before already generated the stream data they share,
+        // so those are read under the shared lock, alongside other jobs.
+        {
+            std::shared_lock<std::shared_timed_mutex> guard(dataLock);
+            auto modifies = data.readsModify();
+            if(!modifies && isTerrainGenerated(chunks, count)) {
+                generateTerrain(chunks, count);
+                return;
+            }
+        }
+
+        // Another job may have generated the same cells while waiting for the lock,
+        // in which case require() finds them covered and doesn't generate them again.
+        // Stream tiles are created while generating, which other jobs cannot read concurrently, so this lock is exclusive.
+        // The independent generators of each stage still run in parallel, without running any other jobs on this thread.
+        // Streams also modify themselves when evicted tiles are read, in which case the terrain is read under this lock as well.
+        std::lock_guard<std::shared_timed_mutex> guard(dataLock);
+        requireTerrain(chunks, count);
+        if(data.readsModify()) {
+            generateTerrain(chunks, count);
+            return;
+        }
+    }
+}
+
 } // namespace generator
\ No newline at end of file
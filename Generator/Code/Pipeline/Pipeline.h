@@ -2,20 +2,42 @@
 #ifndef GENERATOR_PIPELINE_H
 #define GENERATOR_PIPELINE_H
 
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include "Coverage.h"
 #include "Generator.h"
+#include "ThreadPool.h"
+#include "TileFile.h"
 #include "Landmass/Generator.h"
 
 namespace generator {
 
 struct Chunk;
 
+/// A reference to the matrix of a typed stream, which reads and writes values of the stream type.
+/// This converts to the matrix pointer, which is null if the stream doesn't exist.
+template<class T> struct StreamMatrix {
+    StreamMatrix(TiledMatrix* matrix): matrix(matrix) {}
+
+    T get(Int x, Int y, Size detail) const {return (T)matrix->get(x, y, detail);}
+    void set(Int x, Int y, Size detail, T value) const {matrix->set(x, y, detail, (Size)value);}
+
+    TiledMatrix* operator -> () const {return matrix;}
+    operator TiledMatrix* () const {return matrix;}
+
+    TiledMatrix* matrix;
+};
+
 /**
  * Contains the modules used for each generation stage.
  * Manages sending the generated data through each stage to produce an end result.
  */
 struct Pipeline {
-    Pipeline(landmass::Filler& landmassFiller, I32 seed, U32 gridSize, U32 gridSpread, U8 tileSize = 10):
-        data(tileSize), seed(seed), landmass(landmassFiller, gridSize, gridSpread) {}
+    Pipeline(landmass::Filler& landmassFiller, I32 seed, U32 gridSize, U32 gridSpread, U8 tileSize = 10,
+             Size threadCount = ThreadPool::defaultThreadCount()):
+        data(tileSize, this), seed(seed), landmass(landmassFiller, gridSize, gridSpread), workers(threadCount) {}
 
     /**
      * Fills a chunk of voxel data from this pipeline.
@@ -23,17 +45,147 @@ struct Pipeline {
      */
     void fillChunk(Chunk& chunk);
 
+    /**
+     * Fills a set of chunks of voxel data from this pipeline.
+     * The chunks are sorted spatially, and the landmass and stream data they share is prepared once.
+     * Chunks in the same stream tile are then filled back-to-back, which is much faster than
+     * calling fillChunk() for each of them when many chunks are needed at once.
+     */
+    void fillChunks(Chunk** chunks, Size count);
+
+    /**
+     * Starts filling a chunk of voxel data in the background, and returns the job that does this.
+     * The landmass around the chunk is generated by separate jobs for each landmass stage,
+     * which can be shared between chunks. The chunk must not be used until the job is done.
+     * This never waits for running jobs, and can be called while other chunks are being filled.
+     * Low priority chunks are only filled while no other work is queued, and can be cancelled through their job.
+     * The landmass jobs are always scheduled normally, as other chunks may need them as well.
+     */
+    JobHandle submit(Chunk& chunk, Priority priority = Priority::Normal);
+
+    /// Returns the number of landmass chunks that have scheduled jobs. Finished landmass chunks don't keep any.
+    Size landmassJobCount();
+
     // Contains the intermediate data maps generated by each stage.
     struct Data {
-        Data(U8 tileSize): tileSize(tileSize) {}
+        Data(U8 tileSize, Pipeline* pipeline = nullptr): pipeline(pipeline), tileSize(tileSize) {}
+        Data(const Data&) = delete;
+
+        /// Returns the matrix of the provided stream, or null if it doesn't exist.
         TiledMatrix* get(StreamId stream);
         TiledMatrix* getOrCreate(StreamId stream, Size detail);
 
+        /// Returns the matrix of a typed stream. The stream slot is known at compile time, so this is a direct lookup.
+        template<U16 Id, U16 Bits, class T> StreamMatrix<T> get(Stream<Id, Bits, T>) {
+            return matrices[Id].isEmpty() ? nullptr : matrices + Id;
+        }
+
+        template<U16 Id, U16 Bits, class T> StreamMatrix<T> getOrCreate(Stream<Id, Bits, T> stream, Size detail) {
+            return getOrCreate(StreamId(stream), detail);
+        }
+
+        /**
+         * Sets the stage that generates a stream, and the detail it generates the stream at.
+         * Streams with a source are generated on demand when they are required,
+         * so only the parts that are actually read are ever generated.
+         * Sources can only be used by the data of a pipeline.
+         */
+        void setSource(StreamId stream, Stage& stage, U8 detail);
+
+        /**
+         * Makes sure that the provided region of a stream is generated, and returns its matrix.
+         * Any part of the region that is missing from the coverage of a stream with a source is generated by that stage,
+         * extended to whole coverage cells. Each cell is generated once, after which this only checks the coverage.
+         * Returns get(stream) for streams without a source.
+         * This modifies the stream, so it must not be called while other threads read it.
+         */
+        TiledMatrix* require(StreamId stream, I32 x, I32 y, U32 width, U32 height);
+
+        template<U16 Id, U16 Bits, class T> StreamMatrix<T> require(Stream<Id, Bits, T> stream, I32 x, I32 y, U32 width, U32 height) {
+            return require(StreamId(stream), x, y, width, height);
+        }
+
+        /// Makes sure that the provided region of every stream with a source is generated.
+        void require(I32 x, I32 y, U32 width, U32 height);
+
+        /// Checks if the provided region of every stream with a source is generated.
+        /// When this is true, require() for that region doesn't modify anything.
+        bool isGenerated(I32 x, I32 y, U32 width, U32 height);
+
+        /// Keeps a mip pyramid with the provided number of levels for this stream.
+        /// This is applied when the stream is created, or immediately if it already exists.
+        void setMips(StreamId stream, Size levels, MipFilter filter);
+
+        /// Sets the number of bytes the stream tiles may use before trim() evicts the least recently used ones.
+        /// A budget of 0 disables eviction.
+        void setMemoryBudget(Size bytes) {memoryBudget = bytes;}
+
+        /// Evicted tiles of streams created from now on are written to a file in this directory and reloaded when needed.
+        /// Without a spill directory, evicted tiles are dropped and regenerated when their stage runs again.
+        void setSpillDirectory(const char* path) {spillDirectory = path;}
+
+        /// Streams created from now on are stored persistently in a memory-mapped file in this directory.
+        /// The stream coverage is saved along with the tiles when they are flushed or closed,
+        /// so tiles generated by an earlier run are used from the file instead of being regenerated.
+        void setStorageDirectory(const char* path) {storageDirectory = path;}
+
+        /// Returns the coverage of the provided stream, which records the parts that were generated.
+        /// Stages use this to skip parts that are already finished.
+        Coverage& coverage(StreamId stream);
+
+        /// Sets the size of the coverage cells of streams used from now on to 2^shift world units.
+        /// Stages generate whole cells at a time, so larger cells mean fewer but larger generation calls.
+        void setCoverageCell(U8 shift) {coverageShift = shift;}
+
+        /// Writes any modified tiles in persistent storage to disk, along with the coverage of their streams.
+        void flush();
+
+        /// Starts a new access epoch and evicts old tiles until the memory budget is met.
+        /// Tiles used since the previous call are never evicted.
+        /// This must only be called while no references to stream tiles are held.
+        void trim();
+
+        /// Returns the number of bytes used by the tiles of all streams, including their mip levels.
+        Size memoryUsage() const;
+
+        /// Returns the width of the stream tiles, as a power of two.
+        U8 getTileSize() const {return tileSize;}
+
+        /// Checks if reading stream data can modify it, which makes concurrent reads unsafe.
+        /// This is the case once any stream keeps its tiles in a store, or has evicted mip tiles that are rebuilt on use.
+        /// Both only change under the exclusive data lock, so this must be checked while holding the data lock.
+        bool readsModify() const {return !stores.empty() || mipsEvicted;}
+
     private:
-        void resize(Size count);
+        struct MipConfig {
+            U8 levels;
+            MipFilter filter;
+        };
+
+        struct Source {
+            Stage* stage;
+            StreamId stream;
+            U8 detail;
+        };
+
+        TileStore* createStore(StreamId stream, Size detail);
 
-        TiledMatrix* matrices = nullptr;
-        U32 count = 0;
+        std::vector<MipConfig> mipConfigs;
+        std::vector<Source> sources;
+        Pipeline* pipeline;
+        /// The coverages are declared before the stores, as persistent stores save them when they are closed.
+        std::vector<std::unique_ptr<Coverage>> coverages;
+        std::vector<std::unique_ptr<TileStore>> stores;
+        std::string spillDirectory;
+        std::string storageDirectory;
+        Size memoryBudget = 0;
+        U32 epoch = 0;
+        U8 coverageShift = 6;
+        bool mipsEvicted = false;
+
+        /// The matrix of each stream slot. Streams are created in place, so their matrices never move.
+        /// These are declared after the stores, so that they are destroyed first.
+        TiledMatrix matrices[kMaxStreams];
         U8 tileSize;
     } data;
 
@@ -48,6 +200,57 @@ struct Pipeline {
     U8 heightDetail = 7;
     U8 biomeDetail = 5;
     U8 structureDetail = 5;
+
+private:
+    /// Generates the terrain of a chunk once its landmass exists.
+    void fillTerrain(Chunk& chunk) {auto p = &chunk; fillTerrain(&p, 1);}
+
+    /// Generates the terrain of a set of chunks once their landmass exists.
+    /// The stream data and the biome of the previous chunk are reused if they are the same.
+    void fillTerrain(Chunk** chunks, Size count);
+
+    /// Checks if the stream data the terrain of a set of chunks reads is generated.
+    /// This must be called while holding the data lock.
+    bool isTerrainGenerated(Chunk** chunks, Size count);
+
+    /// Generates any missing stream data the terrain of a set of chunks reads.
+    /// This must be called while holding the data lock exclusively.
+    void requireTerrain(Chunk** chunks, Size count);
+
+    /// Generates the voxels of a set of chunks from the stream data, which must be generated.
+    /// This must be called while holding the data lock, exclusively if reading modifies the streams.
+    void generateTerrain(Chunk** chunks, Size count);
+
+    /**
+     * Returns the job that generates the provided landmass stage of a landmass chunk, scheduling it if needed.
+     * Returns null if the final stage job of the landmass chunk is already done.
+     * This must be called while holding the schedule lock, and never takes the landmass lock.
+     */
+    JobHandle scheduleLandmass(I32 x, I32 y, Size stage);
+
+    /**
+     * Only one landmass job runs at a time. Each stage reads and modifies the neighbours of its chunk,
+     * and looking up a neighbour may create it in the landmass matrix, which is shared by every chunk.
+     * Finer locks would have to cover each neighbourhood as well as the matrix, so this is kept global.
+     * Landmass chunks are only generated once and their stages are small, so the terrain work dominates.
+     * This is never taken together with the schedule lock, so submitting chunks never waits for a running stage.
+     */
+    std::mutex landmassLock;
+
+    /// Stream data is read by chunk jobs and modified when trimming.
+    std::shared_timed_mutex dataLock;
+
+    /// The landmass job of each scheduled stage, indexed by landmass chunk position.
+    /// Entries are removed once their final stage is done, after which the landmass chunk is added to the finished chunks.
+    /// Chunks generated outside of jobs are not tracked, and schedule jobs that find each stage already done.
+    TileMap<std::vector<JobHandle>> landmassJobs;
+    TileMap<bool> finishedLandmass;
+    std::mutex scheduleLock;
+
+public:
+    // Runs the generators of each stage and the chunk jobs concurrently.
+    // This is declared last, so that any queued jobs finish before the rest of the pipeline is destroyed.
+    ThreadPool workers;
 };
 
 } // namespace generator
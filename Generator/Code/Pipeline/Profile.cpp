@@ -0,0 +1,214 @@
+#include "Profile.h"
+#include <Math/Math.h>
+#include <algorithm>
+
+namespace generator {
+namespace profile {
+
+/// The number of events each thread keeps. This must be a power of two.
+static const Size kBufferSize = 8192;
+
+/// A recorded zone event. The fields are atomic, so that the buffer can be read while its thread records into it.
+struct Event {
+    std::atomic<const Zone*> zone;
+    std::atomic<U64> start;
+    std::atomic<U64> duration;
+    std::atomic<U64> allocations;
+};
+
+/// The ring buffer of events recorded by a single thread.
+struct Buffer {
+    Event events[kBufferSize];
+
+    /// The total number of events recorded by this thread. Only the owning thread writes this.
+    std::atomic<U64> head {0};
+    U32 thread;
+
+    /// Set while a thread records into this buffer. Buffers of threads that exited are reused by new threads.
+    std::atomic<bool> used {true};
+
+    /// Buffers form a list, which is only ever added to.
+    Buffer* next;
+};
+
+/// A copy of an event, taken when reading the buffers.
+struct Sample {
+    const Zone* zone;
+    U64 start;
+    U64 duration;
+    U64 allocations;
+    U32 thread;
+};
+
+static std::atomic<Zone*> zones {nullptr};
+static std::atomic<Buffer*> buffers {nullptr};
+static std::atomic<U32> threadCount {0};
+static std::atomic<Size (*)()> allocationCounter {nullptr};
+
+/// Releases the buffer of a thread when it exits. The recorded events stay in the buffer until it is reused.
+struct BufferOwner {
+    ~BufferOwner() {
+        if(buffer) buffer->used.store(false, std::memory_order_release);
+    }
+
+    Buffer* buffer = nullptr;
+};
+
+static thread_local BufferOwner threadBuffer;
+
+static Buffer* currentBuffer() {
+    if(threadBuffer.buffer) return threadBuffer.buffer;
+
+    // Threads are created and destroyed with each thread pool, so reuse the buffers of threads that exited.
+    for(auto buffer = buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next) {
+        bool used = false;
+        if(buffer->used.compare_exchange_strong(used, true, std::memory_order_acquire)) {
+            threadBuffer.buffer = buffer;
+            return buffer;
+        }
+    }
+
+    auto buffer = new Buffer;
+    buffer->thread = threadCount.fetch_add(1, std::memory_order_relaxed);
+    buffer->next = buffers.load(std::memory_order_relaxed);
+    while(!buffers.compare_exchange_weak(buffer->next, buffer, std::memory_order_release, std::memory_order_relaxed)) {}
+    threadBuffer.buffer = buffer;
+    return buffer;
+}
+
+static Size countAllocations() {
+    auto counter = allocationCounter.load(std::memory_order_relaxed);
+    return counter ? counter() : 0;
+}
+
+Zone::Zone(const char* name): name(name) {
+    for(auto& bucket: buckets) bucket.store(0, std::memory_order_relaxed);
+
+    next = zones.load(std::memory_order_relaxed);
+    while(!zones.compare_exchange_weak(next, this, std::memory_order_release, std::memory_order_relaxed)) {}
+}
+
+void Zone::add(U64 duration, U64 allocations) {
+    count.fetch_add(1, std::memory_order_relaxed);
+    totalTime.fetch_add(duration, std::memory_order_relaxed);
+    totalAllocations.fetch_add(allocations, std::memory_order_relaxed);
+
+    auto max = maxTime.load(std::memory_order_relaxed);
+    while(duration > max && !maxTime.compare_exchange_weak(max, duration, std::memory_order_relaxed)) {}
+
+    auto bucket = Tritium::Math::min((Size)Tritium::Math::findLastBit(duration | 1), kHistogramBuckets - 1);
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+F64 ZoneStats::percentile(F64 p) const {
+    if(!count) return 0;
+
+    // Use the middle of the bucket that contains the percentile, as the durations within it are unknown.
+    auto target = (U64)(p * (count - 1));
+    U64 seen = 0;
+    for(Size i = 0; i < kHistogramBuckets; i++) {
+        seen += buckets[i];
+        if(seen > target) return Tritium::Math::min(F64(U64(1) << i) * 1.5, (F64)maxTime);
+    }
+    return (F64)maxTime;
+}
+
+void setAllocationCounter(Size (*counter)()) {
+    allocationCounter.store(counter, std::memory_order_relaxed);
+}
+
+Scope::Scope(Zone& zone): zone(zone), start(now()), startAllocations(countAllocations()) {}
+
+Scope::~Scope() {
+    auto duration = now() - start;
+    auto allocations = countAllocations() - startAllocations;
+    zone.add(duration, allocations);
+
+    auto buffer = currentBuffer();
+    auto head = buffer->head.load(std::memory_order_relaxed);
+    auto& event = buffer->events[head & (kBufferSize - 1)];
+    event.zone.store(&zone, std::memory_order_relaxed);
+    event.start.store(start, std::memory_order_relaxed);
+    event.duration.store(duration, std::memory_order_relaxed);
+    event.allocations.store(allocations, std::memory_order_relaxed);
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+std::vector<ZoneStats> summarize() {
+    std::vector<ZoneStats> stats;
+    for(auto zone = zones.load(std::memory_order_acquire); zone; zone = zone->next) {
+        ZoneStats s;
+        s.name = zone->name;
+        s.count = zone->count.load(std::memory_order_relaxed);
+        s.totalTime = zone->totalTime.load(std::memory_order_relaxed);
+        s.maxTime = zone->maxTime.load(std::memory_order_relaxed);
+        s.allocations = zone->totalAllocations.load(std::memory_order_relaxed);
+        for(Size i = 0; i < kHistogramBuckets; i++) s.buckets[i] = zone->buckets[i].load(std::memory_order_relaxed);
+        if(s.count) stats.push_back(s);
+    }
+
+    // The zone list is newest first.
+    std::reverse(stats.begin(), stats.end());
+    return stats;
+}
+
+/// Copies the events that are currently in a buffer.
+static void readBuffer(Buffer& buffer, std::vector<Sample>& samples) {
+    auto end = buffer.head.load(std::memory_order_acquire);
+    auto begin = end > kBufferSize ? end - kBufferSize : 0;
+    auto first = samples.size();
+    for(auto i = begin; i < end; i++) {
+        auto& event = buffer.events[i & (kBufferSize - 1)];
+        samples.push_back(Sample {
+            event.zone.load(std::memory_order_relaxed),
+            event.start.load(std::memory_order_relaxed),
+            event.duration.load(std::memory_order_relaxed),
+            event.allocations.load(std::memory_order_relaxed),
+            buffer.thread
+        });
+    }
+
+    // Events that were overwritten while copying may be torn, so those are dropped.
+    auto head = buffer.head.load(std::memory_order_acquire);
+    if(head - begin > kBufferSize) {
+        auto overwritten = Tritium::Math::min(head - begin - kBufferSize, end - begin);
+        samples.erase(samples.begin() + first, samples.begin() + first + overwritten);
+    }
+}
+
+void writeTrace(FILE* file) {
+    std::vector<Sample> samples;
+    for(auto buffer = buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next) {
+        readBuffer(*buffer, samples);
+    }
+
+    U64 origin = samples.empty() ? 0 : samples[0].start;
+    for(auto& s: samples) origin = Tritium::Math::min(origin, s.start);
+
+    // Chrome traces use microsecond timestamps.
+    fprintf(file, "{\"traceEvents\": [");
+    for(Size i = 0; i < samples.size(); i++) {
+        auto& s = samples[i];
+        fprintf(file, "%s\n  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, "
+                "\"args\": {\"allocations\": %llu}}",
+                i ? "," : "", s.zone->name, s.thread, (s.start - origin) / 1000.0, s.duration / 1000.0,
+                (unsigned long long)s.allocations);
+    }
+    fprintf(file, "\n], \"displayTimeUnit\": \"ns\"}\n");
+}
+
+void reset() {
+    for(auto zone = zones.load(std::memory_order_acquire); zone; zone = zone->next) {
+        zone->count.store(0, std::memory_order_relaxed);
+        zone->totalTime.store(0, std::memory_order_relaxed);
+        zone->maxTime.store(0, std::memory_order_relaxed);
+        zone->totalAllocations.store(0, std::memory_order_relaxed);
+        for(auto& bucket: zone->buckets) bucket.store(0, std::memory_order_relaxed);
+    }
+
+    for(auto buffer = buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next) {
+        buffer->head.store(0, std::memory_order_release);
+    }
+}
+
+}} // namespace generator::profile
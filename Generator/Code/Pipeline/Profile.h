@@ -0,0 +1,114 @@
+
+#ifndef GENERATOR_PROFILE_H
+#define GENERATOR_PROFILE_H
+
+#include <Base.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+namespace generator {
+namespace profile {
+
+/// The number of duration histogram buckets. Bucket i counts durations in [2^i, 2^(i+1)) nanoseconds.
+static const Size kHistogramBuckets = 40;
+
+struct ZoneStats;
+
+/**
+ * A named section of code that is measured each time it runs.
+ * Zones are created through GENERATOR_ZONE, and register themselves the first time they run.
+ * Each zone keeps an aggregated duration histogram, which is never lost when the event buffers wrap around.
+ */
+struct Zone {
+    Zone(const char* name);
+    Zone(const Zone&) = delete;
+
+    const char* name;
+
+private:
+    friend struct Scope;
+    friend std::vector<ZoneStats> summarize();
+    friend void reset();
+
+    void add(U64 duration, U64 allocations);
+
+    std::atomic<U64> count {0};
+    std::atomic<U64> totalTime {0};
+    std::atomic<U64> maxTime {0};
+    std::atomic<U64> totalAllocations {0};
+    std::atomic<U64> buckets[kHistogramBuckets];
+
+    /// Registered zones form a list, which is only ever added to.
+    Zone* next;
+};
+
+/// Aggregated measurements of a single zone.
+struct ZoneStats {
+    const char* name;
+    U64 count;
+    U64 totalTime; /// The total duration in nanoseconds.
+    U64 maxTime;
+    U64 allocations; /// The total number of allocations made inside the zone.
+    U64 buckets[kHistogramBuckets];
+
+    /// Returns an estimate of the provided duration percentile in nanoseconds, from the histogram.
+    F64 percentile(F64 p) const;
+};
+
+/// Returns the current time in nanoseconds, as used for events.
+inline U64 now() {
+    return (U64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// Sets the function used to count allocations inside zones.
+/// The counter is called on the thread that runs a zone, and should return the number of allocations made by that thread,
+/// so that zones are not charged for allocations made concurrently by other threads.
+/// Allocations are only counted by processes that track them, such as the benchmarks.
+void setAllocationCounter(Size (*counter)());
+
+/**
+ * Measures a zone from construction until destruction, and records an event for it in the thread's buffer.
+ * Each thread records into its own fixed-size ring buffer without locking, so the oldest events are overwritten
+ * once a thread has recorded more than the buffer holds.
+ */
+struct Scope {
+    Scope(Zone& zone);
+    ~Scope();
+
+private:
+    Zone& zone;
+    U64 start;
+    Size startAllocations;
+};
+
+/// Returns the measurements of each zone that has run, in registration order.
+std::vector<ZoneStats> summarize();
+
+/// Writes the events currently in the thread buffers as a Chrome trace, which can be opened in chrome://tracing.
+void writeTrace(FILE* file);
+
+/// Clears the zone measurements and recorded events.
+/// This must not be called while zones are running.
+void reset();
+
+}} // namespace generator::profile
+
+#define GENERATOR_ZONE_NAME(name, line) name##line
+#define GENERATOR_ZONE_LINE(name, line) GENERATOR_ZONE_NAME(name, line)
+
+/**
+ * Measures the rest of the current scope as a zone with the provided name.
+ * Zones are only recorded if GENERATOR_PROFILE is defined, and have no cost otherwise.
+ */
+#ifdef GENERATOR_PROFILE
+#define GENERATOR_ZONE(name) \
+    static generator::profile::Zone GENERATOR_ZONE_LINE(profileZone, __LINE__) {name}; \
+    generator::profile::Scope GENERATOR_ZONE_LINE(profileScope, __LINE__) {GENERATOR_ZONE_LINE(profileZone, __LINE__)}
+#else
+#define GENERATOR_ZONE(name) ((void)0)
+#endif
+
+#endif // GENERATOR_PROFILE_H
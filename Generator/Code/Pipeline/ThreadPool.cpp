@@ -0,0 +1,160 @@
+#include "ThreadPool.h"
+
+namespace generator {
+
+/// The pool and queue index of the worker running on this thread, if any.
+static thread_local const ThreadPool* currentPool = nullptr;
+static thread_local Size currentIndex = 0;
+
+ThreadPool::ThreadPool(Size threadCount): queues(new Queue[threadCount + 2]) {
+    threads.reserve(threadCount);
+    for(Size i = 0; i < threadCount; i++) {
+        threads.emplace_back([this, i] {work(i);});
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(sleepLock);
+        stopping = true;
+    }
+    available.notify_all();
+
+    for(auto& thread: threads) thread.join();
+
+    // Without any workers, the remaining tasks are run here.
+    while(runPending()) {}
+}
+
+Size ThreadPool::defaultThreadCount() {
+    auto cores = (Size)std::thread::hardware_concurrency();
+    return cores > 1 ? cores - 1 : 1;
+}
+
+void ThreadPool::submit(std::function<void()> task, Priority priority) {
+    auto& queue = queues[priority == Priority::Low ? threads.size() + 1 : currentQueue()];
+    {
+        std::lock_guard<std::mutex> guard(queue.lock);
+        queue.tasks.push_back(::move(task));
+    }
+    queued.fetch_add(1, std::memory_order_release);
+
+    // Taking the lock makes sure that a worker that is about to sleep sees the new task.
+    { std::lock_guard<std::mutex> guard(sleepLock); }
+    available.notify_one();
+}
+
+JobHandle ThreadPool::schedule(std::function<void()> task, const JobHandle* dependencies, Size dependencyCount, Priority priority) {
+    auto job = std::make_shared<Job>();
+    job->task = ::move(task);
+    job->priority = priority;
+
+    for(Size i = 0; i < dependencyCount; i++) {
+        auto& dependency = dependencies[i];
+        if(!dependency) continue;
+
+        std::lock_guard<std::mutex> guard(dependency->lock);
+        if(!dependency->isDone()) {
+            dependency->dependents.push_back(job);
+            job->pending.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    release(job);
+    return job;
+}
+
+void ThreadPool::release(const JobHandle& job) {
+    if(job->pending.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+    submit([this, job] {
+        if(!job->claimed.exchange(true, std::memory_order_acq_rel)) job->task();
+        job->task = nullptr;
+
+        std::vector<JobHandle> dependents;
+        {
+            std::lock_guard<std::mutex> guard(job->lock);
+            job->done.store(true, std::memory_order_release);
+            dependents.swap(job->dependents);
+        }
+
+        for(auto& d: dependents) release(d);
+    }, job->priority);
+}
+
+bool ThreadPool::runPending() {
+    std::function<void()> task;
+    if(!take(currentQueue(), task)) return false;
+
+    task();
+    return true;
+}
+
+void ThreadPool::wait(const JobHandle& job) {
+    while(!job->isDone()) {
+        if(!runPending()) std::this_thread::yield();
+    }
+}
+
+Size ThreadPool::currentQueue() const {
+    return currentPool == this ? currentIndex : threads.size();
+}
+
+bool ThreadPool::take(Size index, std::function<void()>& task) {
+    if(!queued.load(std::memory_order_acquire)) return false;
+
+    // Run our own newest task first, as its data is most likely still in the cache.
+    {
+        auto& queue = queues[index];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if(!queue.tasks.empty()) {
+            task = ::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    // Steal the oldest task from the other queues, starting with the next one.
+    auto count = threads.size() + 1;
+    for(Size i = 1; i < count; i++) {
+        auto& queue = queues[(index + i) % count];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if(!queue.tasks.empty()) {
+            task = ::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    // Low priority tasks are only run once every other queue is empty, oldest first.
+    auto& low = queues[count];
+    std::lock_guard<std::mutex> guard(low.lock);
+    if(!low.tasks.empty()) {
+        task = ::move(low.tasks.front());
+        low.tasks.pop_front();
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::work(Size index) {
+    currentPool = this;
+    currentIndex = index;
+
+    for(;;) {
+        std::function<void()> task;
+        if(take(index, task)) {
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(sleepLock);
+        if(stopping && !queued.load(std::memory_order_acquire)) return;
+        available.wait(guard, [this] {return stopping || queued.load(std::memory_order_acquire) > 0;});
+    }
+}
+
+} // namespace generator
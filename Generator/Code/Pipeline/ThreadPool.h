@@ -0,0 +1,129 @@
+
+#ifndef GENERATOR_THREADPOOL_H
+#define GENERATOR_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <Base.h>
+
+namespace generator {
+
+/// The order in which queued tasks are run.
+enum class Priority: U8 {
+    Normal,
+
+    /// Low priority tasks only run while no normal task is queued.
+    Low
+};
+
+/// A task scheduled through a ThreadPool, which starts once all jobs it depends on are done.
+struct Job {
+    /// Checks if the task of this job has finished.
+    bool isDone() const {return done.load(std::memory_order_acquire);}
+
+    /**
+     * Prevents the task of this job from running, if it hasn't started yet.
+     * Returns true if the task will never run. The job is still finished as usual,
+     * so jobs that depend on it run once it would have started.
+     */
+    bool cancel() {return !claimed.exchange(true, std::memory_order_acq_rel);}
+
+private:
+    friend struct ThreadPool;
+
+    std::function<void()> task;
+    Priority priority;
+
+    /// Set once the task starts or is cancelled.
+    std::atomic<bool> claimed {false};
+
+    /// The number of unfinished dependencies, plus one while the job is being scheduled.
+    std::atomic<U32> pending {1};
+    std::atomic<bool> done {false};
+
+    /// Protects the dependents and the transition to done.
+    std::mutex lock;
+    std::vector<std::shared_ptr<Job>> dependents;
+};
+
+using JobHandle = std::shared_ptr<Job>;
+
+/**
+ * A fixed set of worker threads that run submitted tasks.
+ * Each worker has its own task queue. Tasks submitted from a worker go to its own queue and are run newest first,
+ * which keeps related work on the same thread. Workers without tasks steal the oldest tasks from other queues,
+ * and tasks submitted from other threads go to a shared queue that every worker takes from.
+ * Threads waiting for tasks to finish can help by running queued tasks themselves.
+ */
+struct ThreadPool {
+    /// Creates a pool with the provided number of worker threads.
+    /// By default, one thread is created for each core except the calling one.
+    ThreadPool(Size threadCount = defaultThreadCount());
+    ThreadPool(const ThreadPool&) = delete;
+
+    /// Finishes all queued tasks before returning.
+    ~ThreadPool();
+
+    /// Adds a task to the queue.
+    void submit(std::function<void()> task, Priority priority = Priority::Normal);
+
+    /// Schedules a task that runs once each of the provided jobs is done.
+    /// Null dependencies are ignored.
+    JobHandle schedule(std::function<void()> task, const JobHandle* dependencies = nullptr, Size dependencyCount = 0,
+                       Priority priority = Priority::Normal);
+
+    JobHandle schedule(std::function<void()> task, const std::vector<JobHandle>& dependencies, Priority priority = Priority::Normal) {
+        return schedule(::move(task), dependencies.data(), dependencies.size(), priority);
+    }
+
+    /// Runs a single queued task on the calling thread, if there is one.
+    /// Returns false if the queue was empty.
+    bool runPending();
+
+    /// Runs queued tasks on the calling thread until the provided job is done.
+    void wait(const JobHandle& job);
+
+    /// Returns the number of worker threads.
+    Size size() const {return threads.size();}
+
+    static Size defaultThreadCount();
+
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void work(Size index);
+
+    /// Takes a task from the provided queue, or steals one from another queue.
+    bool take(Size index, std::function<void()>& task);
+
+    /// Marks a dependency of this job as finished, and submits it if it was the last one.
+    void release(const JobHandle& job);
+
+    /// Returns the queue owned by the calling thread, or the shared queue if it isn't a worker of this pool.
+    Size currentQueue() const;
+
+    std::vector<std::thread> threads;
+
+    /// The queue of each worker, followed by the shared queue and the low priority queue.
+    std::unique_ptr<Queue[]> queues;
+
+    /// The total number of tasks in all queues.
+    std::atomic<Size> queued {0};
+
+    std::mutex sleepLock;
+    std::condition_variable available;
+    bool stopping = false;
+};
+
+} // namespace generator
+
+#endif // GENERATOR_THREADPOOL_H
@@ -0,0 +1,269 @@
+#include "TileFile.h"
+#include <string.h>
+#include <stddef.h>
+#include <vector>
+#include <Math/Math.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif //!_WIN32
+
+namespace generator {
+
+#ifndef _WIN32
+
+TileFile::TileFile(const char* path, U16 stream, U8 itemBits, U8 tileSize, U8 baseDetail) {
+    pageSize = (U32)sysconf(_SC_PAGESIZE);
+
+    // Each tile has the same packed layout as an IdMatrix of the tile size.
+    auto size = Size(1) << tileSize;
+    auto itemsPerWord = Size(1) << Tritium::Math::findLastBit(sizeof(Size) * 8 / itemBits);
+
+    memset(&header, 0, sizeof(Header));
+    header.magic = kMagic;
+    header.version = kVersion;
+    header.stream = stream;
+    header.itemBits = itemBits;
+    header.tileSize = tileSize;
+    header.baseDetail = baseDetail;
+    header.pageSize = pageSize;
+    header.tileBytes = sizeof(Size) * (size / itemsPerWord) * size;
+
+    file = ::open(path, O_RDWR | O_CREAT, 0644);
+    if(file < 0) return;
+
+    if(!open() && !reset()) {
+        close(file);
+        file = -1;
+    }
+}
+
+TileFile::~TileFile() {
+    if(file >= 0) saveCoverage();
+    tiles.forEach([&](I32 x, I32 y, const Tile& tile) {
+        if(tile.words) munmap(tile.words, header.tileBytes);
+    });
+    if(file >= 0) close(file);
+}
+
+bool TileFile::open() {
+    struct stat info;
+    if(fstat(file, &info) || (U64)info.st_size < pageSize) return false;
+    end = (U64)info.st_size;
+
+    Header existing;
+    if(pread(file, &existing, sizeof(Header), 0) != sizeof(Header)) return false;
+
+    // Any difference in format means that the stored tiles cannot be used.
+    auto expected = header;
+    expected.firstIndex = existing.firstIndex;
+    expected.cellShift = existing.cellShift;
+    expected.coverage = existing.coverage;
+    expected.coverageCount = existing.coverageCount;
+    expected.coverageCapacity = existing.coverageCapacity;
+    if(memcmp(&existing, &expected, sizeof(Header))) return false;
+
+    // A damaged coverage section only means that the stream is generated again, so the tiles are kept.
+    auto coverageEnd = existing.coverage + (U64)existing.coverageCapacity * sizeof(CoverageBlock);
+    if(existing.coverage % pageSize || coverageEnd > end || existing.coverageCount > existing.coverageCapacity) {
+        existing.coverage = 0;
+        existing.coverageCount = 0;
+        existing.coverageCapacity = 0;
+    }
+
+    // Validate the whole index before using any of it.
+    std::vector<U8> buffer(pageSize);
+    auto page = (IndexPage*)buffer.data();
+    std::vector<IndexEntry> entries;
+    U64 index = existing.firstIndex;
+    U64 lastIndex = 0;
+    U32 lastCount = 0;
+    U64 pages = 0;
+
+    while(index) {
+        if(index % pageSize || index + pageSize > end) return false;
+        if(pread(file, page, pageSize, (off_t)index) != (ssize_t)pageSize) return false;
+        if(page->count > entriesPerPage()) return false;
+
+        for(U32 i = 0; i < page->count; i++) {
+            auto& entry = page->entries[i];
+            if(entry.offset % pageSize || entry.offset + header.tileBytes > end) return false;
+            entries.push_back(entry);
+        }
+
+        lastIndex = index;
+        lastCount = page->count;
+        index = page->next;
+
+        // A cycle in the chain would contain more pages than the file.
+        if(++pages > end / pageSize) return false;
+    }
+
+    header = existing;
+    this->lastIndex = lastIndex;
+    lastIndexCount = lastCount;
+    for(auto& entry: entries) {
+        tiles.at(entry.x, entry.y) = Tile {entry.offset, nullptr};
+    }
+    return true;
+}
+
+bool TileFile::reset() {
+    header.firstIndex = 0;
+    header.cellShift = 0;
+    header.coverage = 0;
+    header.coverageCount = 0;
+    header.coverageCapacity = 0;
+    end = pageSize;
+    lastIndex = 0;
+    lastIndexCount = 0;
+
+    if(ftruncate(file, 0) || ftruncate(file, (off_t)end)) return false;
+    return pwrite(file, &header, sizeof(Header), 0) == sizeof(Header);
+}
+
+U64 TileFile::allocate(U64 bytes) {
+    auto offset = end;
+    if(ftruncate(file, (off_t)(end + bytes))) return 0;
+
+    end += bytes;
+    return offset;
+}
+
+TileFile::Tile* TileFile::append(I32 x, I32 y) {
+    // Start a new index page when the last one is full.
+    if(!lastIndex || lastIndexCount == entriesPerPage()) {
+        auto page = allocate(pageSize);
+        if(!page) return nullptr;
+
+        if(lastIndex) {
+            if(pwrite(file, &page, sizeof(U64), (off_t)(lastIndex + offsetof(IndexPage, next))) != sizeof(U64)) return nullptr;
+        } else {
+            auto next = header;
+            next.firstIndex = page;
+            if(pwrite(file, &next, sizeof(Header), 0) != sizeof(Header)) return nullptr;
+            header = next;
+        }
+
+        lastIndex = page;
+        lastIndexCount = 0;
+    }
+
+    auto offset = allocate(alignedTileBytes());
+    if(!offset) return nullptr;
+
+    // Write the entry before the count, so that a partial update never references missing data.
+    // Tiles that could not be added to the index are left unused.
+    IndexEntry entry {x, y, offset};
+    auto entryOffset = lastIndex + offsetof(IndexPage, entries) + lastIndexCount * sizeof(IndexEntry);
+    if(pwrite(file, &entry, sizeof(IndexEntry), (off_t)entryOffset) != sizeof(IndexEntry)) return nullptr;
+
+    auto count = lastIndexCount + 1;
+    if(pwrite(file, &count, sizeof(U32), (off_t)(lastIndex + offsetof(IndexPage, count))) != sizeof(U32)) return nullptr;
+    lastIndexCount = count;
+
+    auto& tile = tiles.at(x, y);
+    tile = Tile {offset, nullptr};
+    return &tile;
+}
+
+Size* TileFile::mapTile(Tile& tile) {
+    if(!tile.words) {
+        auto data = mmap(nullptr, header.tileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, file, (off_t)tile.offset);
+        if(data != MAP_FAILED) tile.words = (Size*)data;
+    }
+    return tile.words;
+}
+
+Size* TileFile::map(I32 x, I32 y, Size wordCount, bool create) {
+    if(!isOpen() || wordCount * sizeof(Size) != header.tileBytes) return nullptr;
+
+    auto tile = tiles.find(x, y);
+    if(!tile && create) tile = append(x, y);
+    return tile ? mapTile(*tile) : nullptr;
+}
+
+void TileFile::store(I32 x, I32 y, const Size* words, Size wordCount) {
+    if(auto data = map(x, y, wordCount, true)) memcpy(data, words, wordCount * sizeof(Size));
+}
+
+bool TileFile::load(I32 x, I32 y, Size* words, Size wordCount) {
+    auto data = map(x, y, wordCount, false);
+    if(!data) return false;
+
+    memcpy(words, data, wordCount * sizeof(Size));
+    return true;
+}
+
+void TileFile::flush() {
+    tiles.forEach([&](I32 x, I32 y, const Tile& tile) {
+        if(tile.words) msync(tile.words, header.tileBytes, MS_SYNC);
+    });
+    if(file < 0) return;
+
+    fsync(file);
+    if(saveCoverage()) fsync(file);
+}
+
+void TileFile::keepCoverage(Coverage& coverage) {
+    this->coverage = &coverage;
+    if(file < 0 || !header.coverageCount || header.cellShift != coverage.cellShift) return;
+
+    std::vector<CoverageBlock> blocks(header.coverageCount);
+    auto bytes = sizeof(CoverageBlock) * blocks.size();
+    if(pread(file, blocks.data(), bytes, (off_t)header.coverage) != (ssize_t)bytes) return;
+
+    for(auto& block: blocks) coverage.coverBlock(block.x, block.y, block.cells);
+}
+
+bool TileFile::saveCoverage() {
+    if(!coverage) return true;
+
+    std::vector<CoverageBlock> blocks;
+    coverage->forEachBlock([&](I32 x, I32 y, const U64* cells) {
+        CoverageBlock block;
+        block.x = x;
+        block.y = y;
+        memcpy(block.cells, cells, sizeof(block.cells));
+        blocks.push_back(block);
+    });
+
+    // Coverage only grows, so it is overwritten in place until it no longer fits.
+    // The header is only updated once the blocks are written.
+    auto next = header;
+    if(blocks.size() > header.coverageCapacity) {
+        auto capacity = Tritium::Math::max((U64)blocks.size(), (U64)header.coverageCapacity * 2);
+        auto bytes = (capacity * sizeof(CoverageBlock) + pageSize - 1) & ~(U64)(pageSize - 1);
+        next.coverage = allocate(bytes);
+        if(!next.coverage) return false;
+        next.coverageCapacity = (U32)(bytes / sizeof(CoverageBlock));
+    }
+    next.coverageCount = (U32)blocks.size();
+    next.cellShift = coverage->cellShift;
+
+    auto bytes = sizeof(CoverageBlock) * blocks.size();
+    if(bytes && pwrite(file, blocks.data(), bytes, (off_t)next.coverage) != (ssize_t)bytes) return false;
+    if(pwrite(file, &next, sizeof(Header), 0) != sizeof(Header)) return false;
+
+    header = next;
+    return true;
+}
+
+#else //!_WIN32
+
+// Memory mapping is not implemented on Windows yet; the file is never opened and tiles are regenerated.
+TileFile::TileFile(const char* path, U16 stream, U8 itemBits, U8 tileSize, U8 baseDetail) {}
+TileFile::~TileFile() {}
+void TileFile::store(I32 x, I32 y, const Size* words, Size wordCount) {}
+bool TileFile::load(I32 x, I32 y, Size* words, Size wordCount) {return false;}
+Size* TileFile::map(I32 x, I32 y, Size wordCount, bool create) {return nullptr;}
+void TileFile::flush() {}
+void TileFile::keepCoverage(Coverage& coverage) {}
+bool TileFile::saveCoverage() {return false;}
+
+#endif //!_WIN32
+
+} // namespace generator
@@ -0,0 +1,128 @@
+
+#ifndef GENERATOR_TILEFILE_H
+#define GENERATOR_TILEFILE_H
+
+#include <Base.h>
+#include "Coverage.h"
+#include "TileStore.h"
+
+namespace generator {
+
+/**
+ * Persistent storage for the tiles of a single stream, which is memory-mapped so that tiles are used directly from the page cache.
+ *
+ * The file starts with a header page describing the stream format,
+ * followed by a chain of index pages and the packed words of each tile.
+ * Tile data is page-aligned, so each tile is mapped separately and stays valid as the file grows.
+ * New tiles are appended to the end of the file.
+ * The coverage of the stream is saved in a separate section when flushing and closing the file,
+ * so that a later run knows which parts of the stream were generated.
+ *
+ * If the file exists with a different version or stream format, it is discarded and recreated.
+ * Mapped tiles are written back by the OS, so the file may be incomplete if the process is killed.
+ * Coverage is only saved after the tiles it refers to, so it never claims tiles that are missing.
+ */
+struct TileFile: TileStore {
+    static const U32 kMagic = 0x54444e47; // "GNDT"
+    static const U16 kVersion = 2;
+
+    /// Opens or creates the tile file at the provided path for a stream with this format.
+    TileFile(const char* path, U16 stream, U8 itemBits, U8 tileSize, U8 baseDetail);
+    TileFile(const TileFile&) = delete;
+    ~TileFile();
+
+    void store(I32 x, I32 y, const Size* words, Size wordCount) override;
+    bool load(I32 x, I32 y, Size* words, Size wordCount) override;
+    bool contains(I32 x, I32 y) override {return tiles.find(x, y) != nullptr;}
+    Size* map(I32 x, I32 y, Size wordCount, bool create) override;
+
+    bool isOpen() const {return file >= 0;}
+
+    /// Returns the number of tiles in the file.
+    U32 tileCount() const {return tiles.size();}
+
+    /// Writes any modified tiles to disk, followed by the coverage.
+    void flush() override;
+
+    void keepCoverage(Coverage& coverage) override;
+
+private:
+    struct Header {
+        U32 magic;
+        U16 version;
+        U16 stream;
+        U8 itemBits;
+        U8 tileSize;
+        U8 baseDetail;
+        U8 cellShift;   /// The coverage cell size of the saved coverage.
+        U32 pageSize;
+        U64 tileBytes;  /// The number of bytes in each tile, before page alignment.
+        U64 firstIndex; /// The offset of the first index page, or 0 if there are no tiles.
+        U64 coverage;   /// The offset of the coverage section, or 0 if there is none.
+        U32 coverageCount;    /// The number of saved coverage blocks.
+        U32 coverageCapacity; /// The number of coverage blocks that fit in the section.
+    };
+
+    struct IndexEntry {
+        I32 x;
+        I32 y;
+        U64 offset;
+    };
+
+    struct IndexPage {
+        U64 next;
+        U32 count;
+        U32 padding;
+        IndexEntry entries[1];
+    };
+
+    struct CoverageBlock {
+        I32 x;
+        I32 y;
+        U64 cells[Coverage::kDetailLevels];
+    };
+
+    struct Tile {
+        U64 offset;
+        Size* words; /// The mapped tile data, or null if it hasn't been used yet.
+    };
+
+    /// Reads the header and index of an existing file. Returns false if it cannot be used.
+    bool open();
+
+    /// Initializes an empty file with the current header.
+    bool reset();
+
+    /// Appends a new zeroed tile and adds it to the index.
+    Tile* append(I32 x, I32 y);
+
+    /// Appends a zeroed page-aligned block of the provided size, returning its offset.
+    U64 allocate(U64 bytes);
+
+    Size* mapTile(Tile& tile);
+
+    /// Writes the coverage to the file. Returns false if the file could not be updated.
+    bool saveCoverage();
+
+    U32 entriesPerPage() const {
+        return (U32)((pageSize - sizeof(IndexPage)) / sizeof(IndexEntry) + 1);
+    }
+
+    U64 alignedTileBytes() const {
+        return (header.tileBytes + pageSize - 1) & ~(U64)(pageSize - 1);
+    }
+
+    Header header;
+    TileMap<Tile> tiles;
+    Coverage* coverage = nullptr;
+
+    U64 end = 0;        /// The current file size.
+    U64 lastIndex = 0;  /// The offset of the index page that new tiles are added to.
+    U32 lastIndexCount = 0;
+    U32 pageSize = 0;
+    int file = -1;
+};
+
+} // namespace generator
+
+#endif // GENERATOR_TILEFILE_H
@@ -0,0 +1,181 @@
+
+#ifndef GENERATOR_TILEMAP_H
+#define GENERATOR_TILEMAP_H
+
+#include <atomic>
+#include <Base.h>
+#include <stdlib.h>
+
+namespace generator {
+
+/**
+ * A sparse directory of tiles, keyed by tile coordinate.
+ * This is an open-addressing hash table with linear probing,
+ * so memory use is proportional to the number of tiles rather than the area they span.
+ * The slot of the last successful lookup is cached, as most accesses hit the same tile repeatedly.
+ * Each tile also carries an access stamp, which users can update on lookup to track recently used tiles.
+ *
+ * Values are default-constructed when inserted and moved with memcpy when the table grows,
+ * so they must not contain pointers into themselves.
+ * References to values are invalidated when a new tile is inserted.
+ */
+template<class T> struct TileMap {
+    TileMap() = default;
+    TileMap(const TileMap&) = delete;
+
+    ~TileMap() {
+        for(U32 i = 0; i < capacity; i++) {
+            if(slots[i].used) slots[i].value.~T();
+        }
+        free(slots);
+    }
+
+    /// Returns the value at the provided tile, or null if it doesn't exist.
+    T* find(I32 x, I32 y) const {
+        auto i = findSlot(x, y);
+        return i < capacity ? &slots[i].value : nullptr;
+    }
+
+    /// Returns the value at the provided tile and updates its access stamp, or null if it doesn't exist.
+    T* find(I32 x, I32 y, U32 stamp) const {
+        auto i = findSlot(x, y);
+        if(i >= capacity) return nullptr;
+
+        // Only write the stamp when it changes, so that repeated lookups stay read-only.
+        auto& slot = slots[i];
+        if(slot.stamp.load(std::memory_order_relaxed) != stamp) slot.stamp.store(stamp, std::memory_order_relaxed);
+        return &slot.value;
+    }
+
+    /// Returns the value at the provided tile. The value is inserted if it doesn't exist.
+    T& at(I32 x, I32 y, U32 stamp = 0) {
+        if(auto value = find(x, y, stamp)) return *value;
+
+        // Keep the load factor at most 1/2, which keeps probe sequences short.
+        if((count + 1) * 2 > capacity) grow();
+
+        auto mask = capacity - 1;
+        auto i = hash(x, y);
+        while(slots[i].used) i = (i + 1) & mask;
+
+        auto& slot = slots[i];
+        slot.x = x;
+        slot.y = y;
+        slot.used = true;
+        slot.stamp.store(stamp, std::memory_order_relaxed);
+        new (&slot.value) T();
+        count++;
+
+        last.store(i, std::memory_order_relaxed);
+        return slot.value;
+    }
+
+    /// Removes the value at the provided tile. Returns false if it doesn't exist.
+    bool remove(I32 x, I32 y) {
+        auto i = findSlot(x, y);
+        if(i >= capacity) return false;
+
+        slots[i].value.~T();
+        slots[i].used = false;
+        count--;
+
+        // Move any following entries in the probe sequence back into the hole,
+        // unless their home slot comes after it.
+        auto mask = capacity - 1;
+        for(auto j = (i + 1) & mask; slots[j].used; j = (j + 1) & mask) {
+            auto home = hash(slots[j].x, slots[j].y);
+            auto stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+            if(stays) continue;
+
+            memcpy((void*)(slots + i), slots + j, sizeof(Slot));
+            slots[j].used = false;
+            i = j;
+        }
+
+        last.store(capacity, std::memory_order_relaxed);
+        return true;
+    }
+
+    /// Calls the provided function for each tile as f(x, y, value).
+    template<class F> void forEach(F&& f) const {
+        for(U32 i = 0; i < capacity; i++) {
+            if(slots[i].used) f(slots[i].x, slots[i].y, slots[i].value);
+        }
+    }
+
+    /// Calls the provided function for each tile as f(x, y, stamp).
+    template<class F> void forEachStamp(F&& f) const {
+        for(U32 i = 0; i < capacity; i++) {
+            if(slots[i].used) f(slots[i].x, slots[i].y, slots[i].stamp.load(std::memory_order_relaxed));
+        }
+    }
+
+    /// Returns the number of tiles in the map.
+    U32 size() const {return count;}
+
+private:
+    struct Slot {
+        bool matches(I32 x, I32 y) const {return used && this->x == x && this->y == y;}
+
+        I32 x;
+        I32 y;
+        bool used;
+        std::atomic<U32> stamp;
+        T value;
+    };
+
+    /// Returns the slot index of the provided tile, or the capacity if it doesn't exist.
+    U32 findSlot(I32 x, I32 y) const {
+        auto cached = last.load(std::memory_order_relaxed);
+        if(cached < capacity && slots[cached].matches(x, y)) return cached;
+
+        if(!capacity) return capacity;
+        auto mask = capacity - 1;
+        for(auto i = hash(x, y); slots[i].used; i = (i + 1) & mask) {
+            if(slots[i].matches(x, y)) {
+                last.store(i, std::memory_order_relaxed);
+                return i;
+            }
+        }
+        return capacity;
+    }
+
+    U32 hash(I32 x, I32 y) const {
+        // Fibonacci hashing of the combined coordinate - the high bits are the best mixed.
+        auto key = ((U64)(U32)x << 32) | (U32)y;
+        return (U32)((key * 0x9E3779B97F4A7C15ull) >> (64 - capacityBits));
+    }
+
+    void grow() {
+        auto oldSlots = slots;
+        auto oldCapacity = capacity;
+
+        capacityBits = capacity ? capacityBits + 1 : 4;
+        capacity = U32(1) << capacityBits;
+        slots = (Slot*)calloc(capacity, sizeof(Slot));
+
+        auto mask = capacity - 1;
+        for(U32 s = 0; s < oldCapacity; s++) {
+            if(!oldSlots[s].used) continue;
+
+            auto i = hash(oldSlots[s].x, oldSlots[s].y);
+            while(slots[i].used) i = (i + 1) & mask;
+            memcpy((void*)(slots + i), oldSlots + s, sizeof(Slot));
+        }
+
+        free(oldSlots);
+        last.store(capacity, std::memory_order_relaxed);
+    }
+
+    Slot* slots = nullptr;
+    U32 capacity = 0;
+    U32 count = 0;
+    U8 capacityBits = 0;
+
+    /// The slot index of the last tile that was found.
+    mutable std::atomic<U32> last {0};
+};
+
+} // namespace generator
+
+#endif // GENERATOR_TILEMAP_H
@@ -0,0 +1,37 @@
+#include "TileStore.h"
+
+namespace generator {
+
+SpillFile::SpillFile(const char* path) {
+    file = fopen(path, "w+b");
+}
+
+SpillFile::~SpillFile() {
+    if(file) fclose(file);
+}
+
+void SpillFile::store(I32 x, I32 y, const Size* words, Size wordCount) {
+    if(!file) return;
+
+    // All tiles in a stream have the same size, so existing tiles can be overwritten in place.
+    auto& offset = offsets.at(x, y);
+    if(!offset) {
+        offset = end + 1;
+        end += wordCount * sizeof(Size);
+    }
+
+    fseek(file, (long)(offset - 1), SEEK_SET);
+    fwrite(words, sizeof(Size), wordCount, file);
+}
+
+bool SpillFile::load(I32 x, I32 y, Size* words, Size wordCount) {
+    if(!file) return false;
+
+    auto offset = offsets.find(x, y);
+    if(!offset) return false;
+
+    fseek(file, (long)(*offset - 1), SEEK_SET);
+    return fread(words, sizeof(Size), wordCount, file) == wordCount;
+}
+
+} // namespace generator
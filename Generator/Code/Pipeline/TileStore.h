@@ -0,0 +1,66 @@
+
+#ifndef GENERATOR_TILESTORE_H
+#define GENERATOR_TILESTORE_H
+
+#include <stdio.h>
+#include <Base.h>
+#include "TileMap.h"
+
+namespace generator {
+
+struct Coverage;
+
+/// Interface for storage that keeps tiles evicted from a TiledMatrix.
+struct TileStore {
+    virtual ~TileStore() = default;
+
+    /// Stores the packed words of an evicted tile.
+    virtual void store(I32 x, I32 y, const Size* words, Size wordCount) = 0;
+
+    /// Loads a previously stored tile into the provided words.
+    /// Returns false if the tile was never stored.
+    virtual bool load(I32 x, I32 y, Size* words, Size wordCount) = 0;
+
+    /// Checks if the provided tile was stored.
+    virtual bool contains(I32 x, I32 y) = 0;
+
+    /// Returns the words of the provided tile directly from storage, if the store supports this.
+    /// Writes to the returned words go to the store, and they remain valid for the lifetime of the store.
+    /// If create is set, tiles that were never stored are added with their words set to zero.
+    virtual Size* map(I32 x, I32 y, Size wordCount, bool create) {return nullptr;}
+
+    /// Writes any buffered changes to disk.
+    virtual void flush() {}
+
+    /// Persistent stores load the coverage saved with their tiles into the provided coverage,
+    /// and save it along with their tiles from then on. The coverage must outlive the store.
+    virtual void keepCoverage(Coverage& coverage) {}
+};
+
+/**
+ * Spills evicted tiles to a local cache file.
+ * Tiles are appended to the file the first time they are evicted and overwritten in place afterwards.
+ * The file is only valid for the lifetime of this object.
+ */
+struct SpillFile: TileStore {
+    /// Creates the cache file at the provided path, replacing any existing file.
+    SpillFile(const char* path);
+    ~SpillFile();
+
+    void store(I32 x, I32 y, const Size* words, Size wordCount) override;
+    bool load(I32 x, I32 y, Size* words, Size wordCount) override;
+    bool contains(I32 x, I32 y) override {return offsets.find(x, y) != nullptr;}
+
+    bool isOpen() const {return file != nullptr;}
+
+private:
+    FILE* file;
+
+    /// The file offset of each stored tile, plus one so that zero indicates a missing tile.
+    TileMap<U64> offsets;
+    U64 end = 0;
+};
+
+} // namespace generator
+
+#endif // GENERATOR_TILESTORE_H
@@ -1,45 +1,286 @@
 #include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <Math/Math.h>
 #include "Voxel.h"
+#include "ChunkPool.h"
 
 namespace generator {
 
-Chunk::Chunk(Area area): area(area) {
-    auto elements = area.width * area.height;
-    voxels = (Voxel*)malloc(sizeof(Voxel) * elements * area.depth + sizeof(U16) * elements);
-    heightMap = (U16*)(voxels + elements * area.depth);
+static_assert(sizeof(Voxel) == sizeof(U32), "Voxels are filled as 32-bit words.");
+
+Chunk::Chunk(Area area, VoxelStorage storage, VoxelOrder order, ChunkPool* pool): area(area), storage(storage), order(order), pool(pool) {
+    heightMap = (U16*)allocate(heightMapBytes());
+    if(storage == VoxelStorage::Flat) {
+        voxels = (Voxel*)allocate(voxelBytes());
+        fill(Voxel {0});
+    } else if(storage == VoxelStorage::Palette) {
+        palette.push_back(Voxel {0});
+    } else {
+        resetColumns(Voxel {0});
+    }
 }
 
 Chunk::~Chunk() {
-    free(voxels);
+    deallocate(voxels, voxelBytes());
+    deallocate(indices, indexBytes(indexBits));
+    deallocate(heightMap, heightMapBytes());
     voxels = nullptr;
+    indices = nullptr;
     heightMap = nullptr;
 }
 
 Voxel Chunk::at(Size x, Size y, Size z) const {
-    return voxels[z * area.width * area.height + y * area.width + x];
+    if(storage == VoxelStorage::Columns) {
+        auto& column = columns[area.width * y + x];
+        auto first = runs.data() + column.offset;
+        return std::upper_bound(first, first + column.count, z, [](Size z, const Run& run) {return z < run.end;})->voxel;
+    }
+    return atIndex(voxelIndex(x, y, z));
 }
 
-Voxel& Chunk::at(Size x, Size y, Size z) {
-    return voxels[z * area.width * area.height + y * area.width + x];
+void Chunk::set(Size x, Size y, Size z, Voxel voxel) {
+    if(storage == VoxelStorage::Columns) {
+        writeRuns(x, y, z, z + 1, voxel);
+        return;
+    }
+    setIndex(voxelIndex(x, y, z), voxel);
 }
 
-void Chunk::set(Size x, Size y, Size z, Voxel voxel) {
-    at(x, y, z) = voxel;
+void Chunk::setIndex(Size i, Voxel voxel) {
+    if(storage == VoxelStorage::Palette) {
+        U32 index;
+        if(addToPalette(voxel, index)) {
+            if(indexBits) writePacked(indices, i, indexBits, index);
+            return;
+        }
+        expand();
+    }
+    voxels[i] = voxel;
+}
+
+void Chunk::fill(Voxel voxel) {
+    if(storage == VoxelStorage::Flat) {
+        auto count = voxelCount();
+        for(Size i = 0; i < count; i++) voxels[i] = voxel;
+        return;
+    }
+
+    if(storage == VoxelStorage::Columns) {
+        resetColumns(voxel);
+        return;
+    }
+
+    deallocate(indices, indexBytes(indexBits));
+    indices = nullptr;
+    indexBits = 0;
+    lastIndex = 0;
+    palette.clear();
+    palette.push_back(voxel);
+}
+
+void Chunk::fillColumn(Size x, Size y, Size zBegin, Size zEnd, Voxel voxel) {
+    if(zBegin >= zEnd) return;
+    if(storage == VoxelStorage::Columns) {
+        writeRuns(x, y, zBegin, zEnd, voxel);
+        return;
+    }
+
+    // Pillars are contiguous in z-first chunks, so they can be filled as a single range.
+    auto contiguous = order == VoxelOrder::ZFirst;
+    auto begin = voxelIndex(x, y, zBegin);
+    auto end = begin + (zEnd - zBegin);
+
+    if(storage == VoxelStorage::Palette) {
+        U32 index;
+        if(addToPalette(voxel, index)) {
+            if(!indexBits) return;
+            if(contiguous) fillPacked(indices, begin, end, indexBits, index);
+            else forEachInColumn(x, y, zBegin, zEnd, [&](Size i) {writePacked(indices, i, indexBits, index);});
+            return;
+        }
+        expand();
+    }
+
+    if(contiguous) {
+        // Voxels are filled as plain words, which compilers turn into vector stores.
+        U32 word;
+        memcpy(&word, &voxel, sizeof(Voxel));
+        std::fill((U32*)(voxels + begin), (U32*)(voxels + end), word);
+    } else {
+        forEachInColumn(x, y, zBegin, zEnd, [&](Size i) {voxels[i] = voxel;});
+    }
+}
+
+Size Chunk::memoryUsage() const {
+    auto bytes = heightMapBytes();
+    if(storage == VoxelStorage::Flat) return bytes + voxelBytes();
+    if(storage == VoxelStorage::Columns) return bytes + sizeof(Column) * columns.capacity() + sizeof(Run) * runs.capacity();
+
+    bytes += sizeof(Voxel) * palette.capacity();
+    if(indices) bytes += indexBytes(indexBits);
+    return bytes;
+}
+
+bool Chunk::addToPalette(Voxel voxel, U32& index) {
+    // Voxels are mostly written in runs of the same value.
+    if(palette[lastIndex] == voxel) {
+        index = lastIndex;
+        return true;
+    }
+
+    auto count = (U32)palette.size();
+    for(U32 i = 0; i < count; i++) {
+        if(palette[i] == voxel) {
+            index = lastIndex = i;
+            return true;
+        }
+    }
+
+    // Widen the indices when they are full.
+    if(count == (1u << indexBits)) {
+        auto bits = indexBits ? indexBits * 2u : 1u;
+        if(bits > kMaxIndexBits) return false;
+        repack(bits);
+    }
+
+    palette.push_back(voxel);
+    index = lastIndex = count;
+    return true;
+}
+
+void Chunk::repack(U32 bits) {
+    auto count = voxelCount();
+    auto oldIndices = indices;
+    auto oldBits = indexBits;
+
+    // Uniform chunks start out with every index at 0.
+    indices = (U32*)allocate(indexBytes(bits));
+    memset(indices, 0, indexBytes(bits));
+    if(oldIndices) {
+        for(Size i = 0; i < count; i++) writePacked(indices, i, bits, readPacked(oldIndices, i, oldBits));
+    }
+
+    indexBits = (U8)bits;
+    deallocate(oldIndices, indexBytes(oldBits));
+}
+
+void Chunk::expand() {
+    auto count = voxelCount();
+    voxels = (Voxel*)allocate(voxelBytes());
+    if(indexBits) {
+        for(Size i = 0; i < count; i++) voxels[i] = palette[readPacked(indices, i, indexBits)];
+    } else {
+        for(Size i = 0; i < count; i++) voxels[i] = palette[0];
+    }
+
+    deallocate(indices, indexBytes(indexBits));
+    indices = nullptr;
+    indexBits = 0;
+    lastIndex = 0;
+    std::vector<Voxel>().swap(palette);
+    storage = VoxelStorage::Flat;
+}
+
+void* Chunk::allocate(Size bytes) {
+    return pool ? pool->allocate(bytes) : malloc(bytes);
+}
+
+void Chunk::deallocate(void* block, Size bytes) {
+    if(!block) return;
+    if(pool) pool->recycle(block, bytes);
+    else free(block);
+}
+
+void Chunk::fillPacked(U32* words, Size begin, Size end, U32 bits, U32 value) {
+    auto perWord = 32u / bits;
+    while(begin < end && begin % perWord) writePacked(words, begin++, bits, value);
+
+    U32 pattern = 0;
+    for(U32 i = 0; i < perWord; i++) pattern |= value << (i * bits);
+    for(; begin + perWord <= end; begin += perWord) words[begin / perWord] = pattern;
+
+    while(begin < end) writePacked(words, begin++, bits, value);
+}
+
+void Chunk::resetColumns(Voxel voxel) {
+    auto count = (Size)area.width * area.height;
+    columns.resize(count);
+    runs.assign(count * kColumnRuns, Run {voxel, (U16)area.depth});
+    for(Size i = 0; i < count; i++) columns[i] = Column {(U32)(i * kColumnRuns), 1, (U16)kColumnRuns};
+}
+
+void Chunk::writeRuns(Size x, Size y, Size zBegin, Size zEnd, Voxel voxel) {
+    if(zBegin >= zEnd) return;
+
+    auto& column = columns[area.width * y + x];
+    auto first = runs.data() + column.offset;
+    auto count = (Size)column.count;
+    auto endsAfter = [](Size z, const Run& run) {return z < run.end;};
+
+    // Run i contains zBegin, and the runs before j end within the range.
+    auto i = (Size)(std::upper_bound(first, first + count, zBegin, endsAfter) - first);
+    if(first[i].voxel == voxel && first[i].end >= zEnd) return;
+    auto j = (Size)(std::upper_bound(first + i, first + count, zEnd, endsAfter) - first);
+
+    // The part of run i below the range is kept, and equal neighbouring runs are merged.
+    auto prefix = i;
+    Run head {first[i].voxel, (U16)zBegin};
+    Run middle {voxel, (U16)zEnd};
+    bool hasHead = (i ? first[i - 1].end : 0) < zBegin;
+    bool hasMiddle = true;
+
+    if(hasHead && head.voxel == voxel) hasHead = false;
+    else if(!hasHead && i > 0 && first[i - 1].voxel == voxel) prefix--;
+    if(j < count && first[j].voxel == voxel) hasMiddle = false;
+
+    auto suffix = count - j;
+    auto newCount = prefix + hasHead + hasMiddle + suffix;
+
+    // Pillars that don't fit are moved to the end, leaving their previous runs unused.
+    auto target = first;
+    if(newCount > column.capacity) {
+        auto capacity = Tritium::Math::max(newCount, (Size)column.capacity * 2);
+        auto offset = runs.size();
+        runs.resize(offset + capacity, Run {Voxel {0}, 0});
+
+        first = runs.data() + column.offset;
+        target = runs.data() + offset;
+        memcpy(target, first, sizeof(Run) * prefix);
+        column.offset = (U32)offset;
+        column.capacity = (U16)capacity;
+    }
+
+    memmove(target + prefix + hasHead + hasMiddle, first + j, sizeof(Run) * suffix);
+    if(hasHead) target[prefix] = head;
+    if(hasMiddle) target[prefix + hasHead] = middle;
+    column.count = (U16)newCount;
 }
 
 void Chunk::updateHeightMap() {
-    for(Size x = 0; x < area.width; x++) {
-        for(Size y = 0; y < area.height; y++) {
+    // Neighbouring pillars along the x-axis are closest in memory for every voxel order.
+    for(Size y = 0; y < area.height; y++) {
+        for(Size x = 0; x < area.width; x++) {
             U16 height = 0;
-            for(Int z = area.depth - 1; z >= 0; z--) {
-                if(at(x, y, (Size)z).blockType) {
-                    height = (U16)z;
-                    break;
-                }
-            }
+            forEachSpan(x, y, [&](const VoxelSpan& span) {
+                if(span.voxel.blockType) height = span.end - 1;
+            });
             heightMap[area.width * y + x] = height;
         }
     }
 }
 
-} // namespace generator
\ No newline at end of file
+void ColumnLayers::add(Voxel voxel, Int end) {
+    auto& area = chunk.area;
+    auto bottom = (Int)(area.z * area.depth);
+
+    // Local voxel z is at bottom + (z << lod) in world units, and is part of the layer if that is below the end.
+    auto localEnd = end > bottom ? (Size)((end - bottom + (Int(1) << area.lod) - 1) >> area.lod) : 0;
+    localEnd = Tritium::Math::min(localEnd, (Size)area.depth);
+    if(localEnd <= z) return;
+
+    chunk.fillColumn(x, y, z, localEnd, voxel);
+    z = localEnd;
+}
+
+} // namespace generator
@@ -3,6 +3,8 @@
 #define GENERATOR_VOXEL_H
 
 #include <Base.h>
+#include <vector>
+#include <Math/Math.h>
 
 namespace generator {
 
@@ -37,64 +39,345 @@ struct Voxel {
     U8 skyLight : 4; /// The light level originating from the sky that reaches this voxel.
 };
 
-/// Represents a chunk of generated voxel data.
+inline bool operator == (Voxel a, Voxel b) {
+    return a.blockType == b.blockType && a.metadata == b.metadata && a.baseLight == b.baseLight && a.skyLight == b.skyLight;
+}
+
+inline bool operator != (Voxel a, Voxel b) {return !(a == b);}
+
+/// The way the voxels of a chunk are stored.
+enum class VoxelStorage: U8 {
+    Flat, /// Each voxel is stored directly.
+    Palette, /// Each voxel is a packed index into the distinct voxels of the chunk.
+    Columns /// Each pillar is a list of runs of identical voxels, which suits height map terrain.
+};
+
+/// The order in which voxels are laid out in flat and palette chunks.
+enum class VoxelOrder: U8 {
+    XFirst, /// Rows follow the x-axis and slices follow the y-axis, as in a 3D texture.
+    ZFirst, /// Each pillar is contiguous, which suits generating and reading whole pillars.
+    Bricks /// The chunk is split into 4x4x4 bricks that are contiguous in Morton order, which keeps neighbours close in every direction.
+};
+
+/// A run of identical voxels in a pillar, from begin up to (but not including) end.
+struct VoxelSpan {
+    Voxel voxel;
+    U16 begin;
+    U16 end;
+};
+
+struct Chunk;
+struct ChunkPool;
+
+/// Receives the layers of a single pillar in Chunk::buildColumns(), from the bottom up.
+struct ColumnLayers {
+    ColumnLayers(Chunk& chunk, Size x, Size y): chunk(chunk), x(x), y(y) {}
+
+    /// Fills the pillar with the provided voxel from the end of the previous layer up to (but not including) the provided world z-value.
+    /// Layers that end below the previous one are ignored.
+    void add(Voxel voxel, Int end);
+
+private:
+    friend struct Chunk;
+
+    Chunk& chunk;
+    Size x;
+    Size y;
+    Size z = 0; /// The local z-value where the next layer starts.
+};
+
+/**
+ * Represents a chunk of generated voxel data.
+ * Palette chunks start out uniform, where every voxel is the same and no indices are allocated.
+ * Indices are widened as the palette grows, and the chunk is promoted to flat storage once they would need more than 8 bits,
+ * as the indices and palette would no longer be much smaller than the voxels themselves.
+ * Column chunks store the runs of each pillar, which takes memory proportional to the number of pillars
+ * when most of them are solid up to some height.
+ * Chunks created through a ChunkPool allocate their heightmap, voxels and palette indices from it.
+ */
 struct Chunk {
+    /// The largest number of bits used for palette indices.
+    static const U32 kMaxIndexBits = 8;
+
+    /// The number of runs initially reserved for each pillar in column chunks.
+    static const U32 kColumnRuns = 4;
+
     /// A chunk ID value that can be used by clients to identify this chunk.
     Size id = 0;
 
     /// Creates a chunk of the provided size and initializes the voxels to air.
-    Chunk(Area area);
+    /// The voxel order is not used by column chunks, which store each pillar separately.
+    Chunk(Area area, VoxelStorage storage = VoxelStorage::Flat, VoxelOrder order = VoxelOrder::XFirst, ChunkPool* pool = nullptr);
+    Chunk(const Chunk&) = delete;
     ~Chunk();
 
     /// Returns the voxel at the provided local position.
     Voxel at(Size x, Size y, Size z) const;
 
-    /// Returns a modifiable voxel at the provided local position.
-    Voxel& at(Size x, Size y, Size z);
-
     /// Sets voxel data at the provided local position.
     void set(Size x, Size y, Size z, Voxel voxel);
 
+    /// Sets every voxel in the chunk. Palette chunks become uniform again.
+    void fill(Voxel voxel);
+
+    /// Sets the voxels in the range [zBegin, zEnd) of the pillar at the provided local position.
+    void fillColumn(Size x, Size y, Size zBegin, Size zEnd, Voxel voxel);
+
     /// The area this chunk consists of.
     const Area area;
 
     /// Updates the heightmap of terrain height in the chunk.
     void updateHeightMap();
 
+    /// Returns the highest filled z-value of the pillar at the provided local position, as of the last updateHeightMap().
+    Size heightAt(Size x, Size y) const {return heightMap[area.width * y + x];}
+
+    /**
+     * Calls the provided function with each run of identical voxels in the pillar at the provided local position, from the bottom up.
+     * Column chunks provide their runs directly, while other chunks are encoded while iterating.
+     */
+    template<class F> void forEachSpan(Size x, Size y, F&& f) const {
+        if(storage == VoxelStorage::Columns) {
+            auto& column = columns[area.width * y + x];
+            U16 begin = 0;
+            for(U32 i = 0; i < column.count; i++) {
+                auto& run = runs[column.offset + i];
+                f(VoxelSpan {run.voxel, begin, run.end});
+                begin = run.end;
+            }
+            return;
+        }
+
+        U16 begin = 0;
+        U16 z = 0;
+        auto current = at(x, y, 0);
+        forEachInColumn(x, y, 0, area.depth, [&](Size i) {
+            auto voxel = atIndex(i);
+            if(voxel != current) {
+                f(VoxelSpan {current, begin, z});
+                current = voxel;
+                begin = z;
+            }
+            z++;
+        });
+        f(VoxelSpan {current, begin, (U16)area.depth});
+    }
+
+    VoxelStorage getStorage() const {return storage;}
+    VoxelOrder getOrder() const {return order;}
+
+    /// Returns the number of distinct voxels in a palette chunk. Voxels that were overwritten may still be included.
+    Size paletteSize() const {return palette.size();}
+
+    /// Returns the number of bytes allocated for the voxels and heightmap of this chunk.
+    Size memoryUsage() const;
+
     /// Calls the provided builder for each voxel in this area. The mapper should return a voxel for that location.
+    /// The voxels are visited in the order they are stored in.
     template<class F> void build(F&& f) {
         auto step = Size(1) << area.lod;
         auto x = area.x * area.width;
         auto y = area.y * area.height;
         auto z = area.z * area.depth;
+
+        forEachIndex([&](Size column, Size row, Size zi, Size i) {
+            auto wx = x + column * step, wy = y + row * step, wz = z + zi * step;
+            if(storage == VoxelStorage::Flat) {
+                voxels[i] = f(voxels[i], wx, wy, wz);
+            } else if(storage == VoxelStorage::Columns) {
+                Voxel voxel = at(column, row, zi);
+                set(column, row, zi, f(voxel, wx, wy, wz));
+            } else {
+                Voxel voxel = atIndex(i);
+                setIndex(i, f(voxel, wx, wy, wz));
+            }
+        });
+    }
+
+    /**
+     * Calls the provided builder once for each pillar in this area, as f(x, y, layers) with the pillar position in world units.
+     * The builder should add the layers of the pillar to the provided ColumnLayers, and the pillar is filled with air above them.
+     * This is much faster than build() for terrain where each pillar consists of a few layers.
+     */
+    template<class F> void buildColumns(F&& f) {
+        auto step = Size(1) << area.lod;
+        auto x = area.x * area.width;
+        auto y = area.y * area.height;
         Size height = area.height;
         Size width = area.width;
-        Size depth = area.depth;
 
         for(Size row = 0; row < height; row++) {
             for(Size column = 0; column < width; column++) {
-                for(Size zi = 0; zi < depth; zi++) {
-                    Voxel& voxel = at(column, row, zi);
-                    voxel = f(voxel, x + column * step, y + row * step, z + zi * step);
-                }
+                ColumnLayers layers(*this, column, row);
+                f(x + column * step, y + row * step, layers);
+                fillColumn(column, row, layers.z, area.depth, Voxel {0});
             }
         }
     }
 
 private:
+    /// A run of identical voxels in a pillar of a column chunk, which starts at the end of the previous one.
+    struct Run {
+        Voxel voxel;
+        U16 end;
+    };
 
-    /**
-     * The voxel data for this chunk, laid out as a 3D texture.
-     * Rows follow the x-axis,
-     * Slices follow the y-axis.
-     */
-    Voxel* voxels;
+    /// The runs of a single pillar in a column chunk.
+    struct Column {
+        U32 offset; /// The index of the first run of this pillar.
+        U16 count;
+        U16 capacity;
+    };
+
+    /// Returns the index of a local position in the voxel layout.
+    Size voxelIndex(Size x, Size y, Size z) const {
+        switch(order) {
+            case VoxelOrder::XFirst: return (z * area.height + y) * area.width + x;
+            case VoxelOrder::ZFirst: return (y * area.width + x) * area.depth + z;
+            default: return ((((z >> 2) * bricks(area.height) + (y >> 2)) * bricks(area.width) + (x >> 2)) << 6) | brickOffset(x, y, z);
+        }
+    }
+
+    /// Returns the number of bricks needed to cover a chunk dimension.
+    static Size bricks(Size size) {return (size + 3) >> 2;}
+
+    /// Returns the index of a position within its brick, interleaving the two low bits of each coordinate as zyxzyx.
+    static Size brickOffset(Size x, Size y, Size z) {
+        return (x & 1) | (y & 1) << 1 | (z & 1) << 2 | (x & 2) << 2 | (y & 2) << 3 | (z & 2) << 4;
+    }
+
+    /// Returns the number of voxels in the layout, which includes the padding of partial bricks.
+    Size voxelCount() const {
+        if(order == VoxelOrder::Bricks) return bricks(area.width) * bricks(area.height) * bricks(area.depth) << 6;
+        return (Size)area.width * area.height * area.depth;
+    }
+
+    Size voxelBytes() const {return sizeof(Voxel) * voxelCount();}
+    Size indexBytes(U32 bits) const {return sizeof(U32) * ((voxelCount() * bits + 31) / 32);}
+    Size heightMapBytes() const {return sizeof(U16) * area.width * area.height;}
+
+    /// Allocates and frees blocks from the pool of this chunk, or the heap if it has none.
+    void* allocate(Size bytes);
+    void deallocate(void* block, Size bytes);
+
+    /// Reads and writes voxels in flat and palette chunks by their index in the layout.
+    Voxel atIndex(Size i) const {
+        if(storage == VoxelStorage::Flat) return voxels[i];
+        return indexBits ? palette[readPacked(indices, i, indexBits)] : palette[0];
+    }
+
+    void setIndex(Size i, Voxel voxel);
+
+    /// Calls the provided function with the layout index of each voxel in the range [zBegin, zEnd) of a pillar.
+    template<class F> void forEachInColumn(Size x, Size y, Size zBegin, Size zEnd, F&& f) const {
+        if(order == VoxelOrder::Bricks) {
+            for(Size z = zBegin; z < zEnd; z++) f(voxelIndex(x, y, z));
+            return;
+        }
+
+        auto stride = order == VoxelOrder::ZFirst ? 1 : (Size)area.width * area.height;
+        auto i = voxelIndex(x, y, zBegin);
+        for(Size z = zBegin; z < zEnd; z++, i += stride) f(i);
+    }
+
+    /// Calls the provided function with each local position and its layout index, in the order of the layout.
+    /// Column chunks are visited pillar by pillar.
+    template<class F> void forEachIndex(F&& f) const {
+        Size width = area.width;
+        Size height = area.height;
+        Size depth = area.depth;
+        Size i = 0;
+
+        if(order == VoxelOrder::XFirst && storage != VoxelStorage::Columns) {
+            for(Size z = 0; z < depth; z++) {
+                for(Size y = 0; y < height; y++) {
+                    for(Size x = 0; x < width; x++) f(x, y, z, i++);
+                }
+            }
+        } else if(order == VoxelOrder::Bricks && storage != VoxelStorage::Columns) {
+            for(Size bz = 0; bz < depth; bz += 4) {
+                for(Size by = 0; by < height; by += 4) {
+                    for(Size bx = 0; bx < width; bx += 4) {
+                        auto zEnd = Tritium::Math::min(bz + 4, depth);
+                        auto yEnd = Tritium::Math::min(by + 4, height);
+                        auto xEnd = Tritium::Math::min(bx + 4, width);
+                        for(Size z = bz; z < zEnd; z++) {
+                            for(Size y = by; y < yEnd; y++) {
+                                for(Size x = bx; x < xEnd; x++) f(x, y, z, i + brickOffset(x, y, z));
+                            }
+                        }
+                        i += 64;
+                    }
+                }
+            }
+        } else {
+            for(Size y = 0; y < height; y++) {
+                for(Size x = 0; x < width; x++) {
+                    for(Size z = 0; z < depth; z++) f(x, y, z, i++);
+                }
+            }
+        }
+    }
+
+    /// Returns the palette index of a voxel, adding it to the palette if needed.
+    /// Returns false if the palette cannot contain any more voxels.
+    bool addToPalette(Voxel voxel, U32& index);
+
+    /// Changes the number of bits used for each palette index.
+    void repack(U32 bits);
+
+    /// Promotes the chunk to flat storage.
+    void expand();
+
+    /// Makes every pillar of a column chunk a single run of the provided voxel.
+    void resetColumns(Voxel voxel);
+
+    /// Sets the voxels in the range [zBegin, zEnd) of a pillar in a column chunk, merging them with the surrounding runs.
+    void writeRuns(Size x, Size y, Size zBegin, Size zEnd, Voxel voxel);
+
+    /// Reads and writes items in packed index words.
+    static U32 readPacked(const U32* words, Size i, U32 bits) {
+        auto perWord = 32u / bits;
+        return (words[i / perWord] >> ((i % perWord) * bits)) & ((1u << bits) - 1);
+    }
+
+    static void writePacked(U32* words, Size i, U32 bits, U32 value) {
+        auto perWord = 32u / bits;
+        auto shift = (i % perWord) * bits;
+        auto& word = words[i / perWord];
+        word = (word & ~(((1u << bits) - 1) << shift)) | (value << shift);
+    }
+
+    /// Writes the same value to the items in the range [begin, end), a whole word at a time where possible.
+    static void fillPacked(U32* words, Size begin, Size end, U32 bits, U32 value);
+
+    /// The voxel data for flat chunks, laid out in the voxel order.
+    Voxel* voxels = nullptr;
+
+    /// The packed palette index of each voxel for palette chunks, in the same layout.
+    /// This is null while every voxel is the same.
+    U32* indices = nullptr;
+
+    /// The distinct voxels in a palette chunk.
+    std::vector<Voxel> palette;
+
+    /// The runs of each pillar in a column chunk, stored in rows like the heightmap.
+    /// Pillars that outgrow their capacity are moved to the end of the runs.
+    std::vector<Column> columns;
+    std::vector<Run> runs;
 
     /**
      * The highest z-value that is filled for each terrain pillar.
      * This contains fractional values to allow using it for heightmap generation (when not using voxels).
      */
     U16* heightMap;
+
+    /// The palette index that was written last, which is likely to be written again.
+    U32 lastIndex = 0;
+    U8 indexBits = 0;
+    VoxelStorage storage;
+    VoxelOrder order;
+    ChunkPool* pool;
 };
 
 } // namespace generator
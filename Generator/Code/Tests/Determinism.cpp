@@ -0,0 +1,88 @@
+#include <catch.hpp>
+#include "../World/Determinism.h"
+#include "../Pipeline/Biome/BiomeStage.h"
+#include "../Pipeline/Height/HeightStage.h"
+
+using namespace generator;
+using namespace generator::determinism;
+
+static landmass::Attribute vertexValue {16, landmass::AttributeType::Vertex};
+
+/// Stores a value for each vertex, which depends on the neighbour chunks having the same diagram.
+struct VertexValueGenerator: landmass::Generator {
+	VertexValueGenerator(): Generator({&vertexValue}) {}
+
+	void generate(landmass::Chunk& chunk, landmass::ChunkMatrix& matrix, I32 seed) override {
+		auto id = attribute(0);
+		for(U32 i = 0; i < chunk.vertices.size(); i++) {
+			U32 value = (U32)seed;
+			for(auto e: chunk.vertexEdges[i]) value = value * 31 + chunk.neighbour(matrix, e.chunkIndex).edges.size();
+			chunk.attributes.set(id, i, (value + (U32)chunk.vertices[i].x) & 0xffff);
+		}
+	}
+};
+
+/// Generates a height map from a hash of each position.
+struct HashHeight: HeightGenerator {
+	void generate(const Segment& segment, TiledMatrix& heightMap, TiledMatrix** auxiliaries, Pipeline& pipeline) override {
+		segment.map([&](Int x, Int y) {
+			auto h = (U32)(x * 73856093) ^ (U32)(y * 19349663) ^ (U32)pipeline.seed;
+			heightMap.set(x, y, segment.detail, 4 + h % 24);
+		});
+	}
+};
+
+struct DefaultBiomes: BiomeGenerator {
+	void generate(const Segment& segment, TiledMatrix& map, TiledMatrix** auxiliaries, Pipeline& pipeline) override {
+		map.fillRegion(segment.x, segment.y, segment.width, segment.height, segment.detail, DefaultBiome::id);
+	}
+};
+
+TEST_CASE("Determinism across threads and orders") {
+	// A coarse filler keeps the voronoi diagrams small.
+	landmass::RandomHexFiller filler(512, 1);
+
+	// Stages don't keep any generated data, so each pipeline can use the same ones.
+	Stage heights;
+	heights += std::unique_ptr<Generator>(new HashHeight);
+	Stage biomes;
+	biomes += std::unique_ptr<Generator>(new DefaultBiomes);
+
+	Region region;
+	region.x = -1;
+	region.y = 0;
+	region.width = 3;
+	region.height = 2;
+	region.chunkWidth = 16;
+	region.chunkDepth = 32;
+	region.streams = {BaseHeight, Biomes};
+	region.createPipeline = [&](Size threadCount) {
+		std::unique_ptr<Pipeline> pipeline(new Pipeline(filler, 7, 32, 4, 10, threadCount));
+		pipeline->landmass += std::unique_ptr<landmass::Generator>(new VertexValueGenerator);
+		pipeline->data.setSource(BaseHeight, heights, 0);
+		pipeline->data.setSource(Biomes, biomes, 0);
+		return pipeline;
+	};
+
+	SECTION("hashes cover the generated data") {
+		auto hashes = generate(region, Run {1, Order::Rows, 0});
+		REQUIRE(hashes.size() == 6);
+		REQUIRE(hashes[0].x == -1);
+		REQUIRE(hashes[0].y == 0);
+		REQUIRE(hashes[0].voxels != hashes[1].voxels);
+		REQUIRE(hashes[0].streams != hashes[1].streams);
+	}
+
+	SECTION("each run generates the same region") {
+		// Every order is generated with each thread count, where 0 generates on the calling thread.
+		std::vector<Run> runs;
+		Order orders[] = {Order::Rows, Order::Spiral, Order::Random};
+		for(auto order: orders) {
+			for(Size threads = 0; threads <= 4; threads++) runs.push_back(Run {threads, order, (U32)threads + 1});
+		}
+
+		auto differences = verify(region, runs.data(), runs.size());
+		for(auto& d: differences) WARN(d);
+		REQUIRE(differences.empty());
+	}
+}
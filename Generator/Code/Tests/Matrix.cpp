@@ -1,7 +1,15 @@
-
 #define CATCH_CONFIG_MAIN
 #include <catch.hpp>
-#include "../Pipeline/Matrix.h"
+#include <stdio.h>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+#include "../Pipeline/ConcurrentMatrix.h"
+#include "../Pipeline/Generator.h"
+#include "../Pipeline/TileMap.h"
+#include "../Pipeline/TileStore.h"
+#include "TempFiles.h"
 
 using namespace generator;
 
@@ -61,6 +69,92 @@ TEST_CASE("IdMatrix") {
 	}
 }
 
+TEST_CASE("IdMatrix compression") {
+	IdMatrix matrix(64, 64, 0, 16);
+	REQUIRE(matrix.storage() == IdMatrix::Format::Uniform);
+	REQUIRE(matrix.memoryUsage() == 0);
+	REQUIRE(matrix.get(10, 10, 0) == 0);
+
+	// Writing the uniform value keeps the matrix uniform.
+	matrix.set(3, 4, 0, 0);
+	matrix.fillItems(0, 5, 64, 0);
+	REQUIRE(matrix.isUniform());
+
+	// Each new value is added to the palette, widening the indices as needed.
+	std::vector<Size> expected(64 * 64, 0);
+	auto check = [&]() {
+		std::vector<U16> row(64);
+		for(Size y = 0; y < 64; y++) {
+			matrix.readItems(0, y, 64, row.data());
+			for(Size x = 0; x < 64; x++) {
+				CAPTURE(x);
+				CAPTURE(y);
+				REQUIRE(matrix.get(x, y, 0) == expected[y * 64 + x]);
+				REQUIRE(row[x] == expected[y * 64 + x]);
+			}
+		}
+	};
+
+	for(Size i = 1; i < 16; i++) {
+		matrix.set(i * 3, i, 0, 1000 + i);
+		expected[i * 64 + i * 3] = 1000 + i;
+		REQUIRE(matrix.storage() == IdMatrix::Format::Palette);
+		check();
+	}
+	REQUIRE(matrix.memoryUsage() < 64 * 64 * 2 / 2);
+
+	// Runs of values that are already in the palette keep it.
+	std::vector<U16> run(40);
+	for(Size i = 0; i < run.size(); i++) run[i] = (U16)(1001 + i % 15);
+	run[0] = 0;
+	matrix.writeItems(13, 20, run.size(), run.data());
+	matrix.fillItems(5, 30, 50, 1003);
+	for(Size i = 0; i < run.size(); i++) expected[20 * 64 + 13 + i] = run[i];
+	for(Size i = 0; i < 50; i++) expected[30 * 64 + 5 + i] = 1003;
+	REQUIRE(matrix.storage() == IdMatrix::Format::Palette);
+	check();
+
+	// The first value that doesn't fit promotes the matrix to full storage.
+	matrix.set(63, 63, 0, 0xffff);
+	expected[63 * 64 + 63] = 0xffff;
+	REQUIRE(matrix.storage() == IdMatrix::Format::Full);
+	REQUIRE(matrix.memoryUsage() == 64 * 64 * 2);
+	check();
+
+	matrix.fill(7);
+	REQUIRE(matrix.isUniform());
+	REQUIRE(matrix.memoryUsage() == 0);
+	REQUIRE(matrix.get(63, 63, 0) == 7);
+
+	// Runs with many values go straight to full storage, as do matrices where a palette wouldn't be smaller.
+	std::vector<U16> values(64);
+	for(Size i = 0; i < 64; i++) values[i] = (U16)i;
+	matrix.writeItems(0, 0, 64, values.data());
+	REQUIRE(matrix.storage() == IdMatrix::Format::Full);
+	REQUIRE(matrix.get(17, 0, 0) == 17);
+	REQUIRE(matrix.get(17, 1, 0) == 7);
+
+	IdMatrix small(64, 64, 0, 1);
+	small.set(1, 1, 0, 1);
+	REQUIRE(small.storage() == IdMatrix::Format::Full);
+	REQUIRE(small.get(1, 1, 0) == 1);
+	REQUIRE(small.get(2, 1, 0) == 0);
+}
+
+TEST_CASE("TiledMatrix uniform tiles") {
+	TiledMatrix matrix(0, 16, 5);
+	matrix.fillRegion(-64, -64, 128, 128, 0, 4000);
+	REQUIRE(matrix.memoryUsage() == 0);
+	REQUIRE(matrix.get(-64, 63, 0) == 4000);
+
+	// Partially covered tiles use a palette.
+	matrix.fillRegion(-10, -10, 20, 20, 0, 12);
+	REQUIRE(matrix.memoryUsage() > 0);
+	REQUIRE(matrix.memoryUsage() < 4 * 32 * 32 * 2 / 4);
+	REQUIRE(matrix.get(0, 0, 0) == 12);
+	REQUIRE(matrix.get(-11, 0, 0) == 4000);
+}
+
 TEST_CASE("TiledMatrix single tile") {
 	TiledMatrix matrix(0, 16, 7);
 	for(Int x = 0; x < 128; x++) {
@@ -104,4 +198,413 @@ TEST_CASE("TiledMatrix OOB") {
 	}
 	
 	REQUIRE(matrix.get(300, 300, 0) == 0);
-}
\ No newline at end of file
+}
+
+TEST_CASE("IdMatrix item runs") {
+	IdMatrix matrix(128, 4, 0, 11);
+	std::vector<U16> values(101);
+	for(Size i = 0; i < values.size(); i++) values[i] = (U16)((i * 37) & 0b11111111111);
+
+	matrix.fillItems(0, 1, 128, 3);
+	matrix.writeItems(13, 1, values.size(), values.data());
+	
+	for(Size x = 0; x < 128; x++) {
+		CAPTURE(x);
+		if(x < 13 || x >= 13 + values.size()) REQUIRE(matrix.get(x, 1, 0) == 3);
+		else REQUIRE(matrix.get(x, 1, 0) == values[x - 13]);
+	}
+
+	std::vector<U32> read(values.size());
+	matrix.readItems(13, 1, read.size(), read.data());
+	for(Size i = 0; i < read.size(); i++) {
+		CAPTURE(i);
+		REQUIRE(read[i] == values[i]);
+	}
+}
+
+TEST_CASE("TiledMatrix regions") {
+	TiledMatrix matrix(0, 16, 4);
+	const Int x = -37, y = -21;
+	const Size width = 75, height = 49;
+	std::vector<U16> values(width * height);
+	for(Size i = 0; i < values.size(); i++) values[i] = (U16)(i * 7919);
+
+	matrix.writeRegion(x, y, width, height, 0, values.data());
+	
+	SECTION("Per-item reads") {
+		for(Size row = 0; row < height; row++) {
+			for(Size column = 0; column < width; column++) {
+				CAPTURE(column);
+				CAPTURE(row);
+				REQUIRE(matrix.get(x + (Int)column, y + (Int)row, 0) == values[row * width + column]);
+			}
+		}
+	}
+
+	SECTION("Region reads") {
+		std::vector<U32> read(values.size());
+		matrix.readRegion(x, y, width, height, 0, read.data());
+		for(Size i = 0; i < values.size(); i++) {
+			CAPTURE(i);
+			REQUIRE(read[i] == values[i]);
+		}
+	}
+
+	SECTION("Unallocated tiles") {
+		std::vector<U32> read(16 * 16, 1);
+		matrix.readRegion(300, 300, 16, 16, 0, read.data());
+		for(auto v: read) REQUIRE(v == 0);
+	}
+
+	SECTION("Fill") {
+		matrix.fillRegion(x + 3, y + 5, 40, 30, 0, 1234);
+		for(Size row = 0; row < height; row++) {
+			for(Size column = 0; column < width; column++) {
+				CAPTURE(column);
+				CAPTURE(row);
+				bool inside = column >= 3 && column < 43 && row >= 5 && row < 35;
+				REQUIRE(matrix.get(x + (Int)column, y + (Int)row, 0) == (inside ? 1234 : values[row * width + column]));
+			}
+		}
+	}
+}
+
+TEST_CASE("TiledMatrix detail regions") {
+	std::vector<U8> values(16 * 16);
+	for(Size i = 0; i < values.size(); i++) values[i] = (U8)(i * 13);
+
+	for(Size baseDetail: {0, 2}) {
+		CAPTURE(baseDetail);
+		TiledMatrix matrix(baseDetail, 8, 5);
+		matrix.writeRegion(-40, 8, 64, 64, 2, values.data());
+
+		Size i = 0;
+		Segment {-40, 8, 64, 64, 1.f, 2}.map([&](Int x, Int y) {
+			CAPTURE(x);
+			CAPTURE(y);
+			REQUIRE(matrix.get(x, y, 2) == values[i++]);
+		});
+
+		std::vector<U8> read(values.size());
+		matrix.readRegion(-40, 8, 64, 64, 2, read.data());
+		REQUIRE(read == values);
+	}
+}
+
+TEST_CASE("ConcurrentTiledMatrix parallel writes") {
+	ConcurrentTiledMatrix matrix(0, 16, 4);
+	const Int threadCount = 8;
+	const Int tilesPerThread = 40;
+
+	// Each thread writes its own column of tiles while the directory grows in every direction.
+	auto value = [](Int x, Int y) {return (Size)((x * 31 + y * 17) & 0xffff);};
+	std::atomic<Size> mismatches {0};
+	std::vector<std::thread> threads;
+	for(Int t = 0; t < threadCount; t++) {
+		threads.emplace_back([&, t]() {
+			auto column = (t - threadCount / 2) * 37;
+			for(Int i = 0; i < tilesPerThread; i++) {
+				auto row = (i & 1 ? -i : i) * 23;
+				for(Int y = 0; y < 16; y++) {
+					for(Int x = 0; x < 16; x++) {
+						auto px = column * 16 + x;
+						auto py = row * 16 + y;
+						matrix.set(px, py, 0, value(px, py));
+					}
+				}
+
+				// Read back something written earlier, while other threads may be growing the matrix.
+				// Catch assertions are not thread-safe, so failures are counted instead.
+				if(matrix.get(column * 16 + 3, row * 16 + 5, 0) != value(column * 16 + 3, row * 16 + 5)) mismatches++;
+			}
+		});
+	}
+	for(auto& thread: threads) thread.join();
+	REQUIRE(mismatches == 0);
+
+	for(Int t = 0; t < threadCount; t++) {
+		auto column = (t - threadCount / 2) * 37;
+		for(Int i = 0; i < tilesPerThread; i++) {
+			auto row = (i & 1 ? -i : i) * 23;
+			for(Int y = 0; y < 16; y++) {
+				for(Int x = 0; x < 16; x++) {
+					auto px = column * 16 + x;
+					auto py = row * 16 + y;
+					CAPTURE(px);
+					CAPTURE(py);
+					REQUIRE(matrix.get(px, py, 0) == value(px, py));
+				}
+			}
+		}
+	}
+
+	REQUIRE(matrix.findTile(100000, 100000) == nullptr);
+	REQUIRE(matrix.get(100000, 100000, 0) == 0);
+
+	// Once the threads are done, the directories replaced while growing can be freed without losing any tiles.
+	REQUIRE(matrix.retiredDirectories() > 0);
+	matrix.trim();
+	REQUIRE(matrix.retiredDirectories() == 0);
+	REQUIRE(matrix.get(-4 * 37 * 16 + 3, 5, 0) == value(-4 * 37 * 16 + 3, 5));
+
+	matrix.set(-100000, 100000, 0, 7);
+	REQUIRE(matrix.retiredDirectories() == 1);
+	REQUIRE(matrix.get(-100000, 100000, 0) == 7);
+	REQUIRE(matrix.get(3 * 37 * 16 + 3, -23 * 16 + 5, 0) == value(3 * 37 * 16 + 3, -23 * 16 + 5));
+}
+
+TEST_CASE("ConcurrentTiledMatrix tile creation") {
+	ConcurrentTiledMatrix matrix(0, 8, 4);
+	std::atomic<const IdMatrix*> seen[8];
+	std::vector<std::thread> threads;
+	for(Size t = 0; t < 8; t++) {
+		threads.emplace_back([&, t]() {
+			seen[t] = &matrix.getTile(-5, 7);
+		});
+	}
+	for(auto& thread: threads) thread.join();
+
+	// Every thread must have received the same tile.
+	for(auto& tile: seen) REQUIRE(tile.load() == matrix.findTile(-5, 7));
+}
+
+TEST_CASE("TileMap") {
+	TileMap<Size> map;
+	REQUIRE(map.find(0, 0) == nullptr);
+
+	// Insert enough tiles to grow the table several times, spread far apart.
+	for(I32 i = 0; i < 1000; i++) {
+		map.at(i * 10007 - 5000000, -i * 7919) = (Size)i;
+	}
+	REQUIRE(map.size() == 1000);
+
+	for(I32 i = 0; i < 1000; i++) {
+		CAPTURE(i);
+		auto value = map.find(i * 10007 - 5000000, -i * 7919);
+		REQUIRE(value != nullptr);
+		REQUIRE(*value == (Size)i);
+	}
+
+	REQUIRE(map.find(1, 1) == nullptr);
+	REQUIRE(map.at(-5000000, 0) == 0);
+	REQUIRE(map.size() == 1000);
+
+	Size sum = 0;
+	map.forEach([&](I32 x, I32 y, Size value) {sum += value;});
+	REQUIRE(sum == 999 * 1000 / 2);
+
+	// Remove every other tile, then check that the remaining ones can still be found.
+	for(I32 i = 0; i < 1000; i += 2) {
+		REQUIRE(map.remove(i * 10007 - 5000000, -i * 7919));
+	}
+	REQUIRE(!map.remove(-5000000, 0));
+	REQUIRE(map.size() == 500);
+
+	for(I32 i = 0; i < 1000; i++) {
+		CAPTURE(i);
+		auto value = map.find(i * 10007 - 5000000, -i * 7919);
+		if(i & 1) {
+			REQUIRE(value != nullptr);
+			REQUIRE(*value == (Size)i);
+		} else {
+			REQUIRE(value == nullptr);
+		}
+	}
+}
+
+TEST_CASE("TiledMatrix distant tiles") {
+	// Tiles this far apart would need a huge dense directory.
+	TiledMatrix matrix(0, 16, 4);
+	matrix.set(-160000, 0, 0, 1);
+	matrix.set(160000, 160000, 0, 2);
+	matrix.set(3, -160000, 0, 3);
+
+	REQUIRE(matrix.get(-160000, 0, 0) == 1);
+	REQUIRE(matrix.get(160000, 160000, 0) == 2);
+	REQUIRE(matrix.get(3, -160000, 0) == 3);
+	REQUIRE(matrix.get(0, 0, 0) == 0);
+}
+
+TEST_CASE("TiledMatrix mips") {
+	const Int x = -70, y = 20;
+	const Size width = 100, height = 60;
+	std::mt19937 random(5);
+	std::vector<U16> values(width * height);
+	for(auto& v: values) v = (U16)random();
+
+	// Reference implementation: combine each block of the base samples directly.
+	auto expected = [&](TiledMatrix& matrix, Int px, Int py, Size level, MipFilter filter) {
+		auto size = Int(1) << level;
+		auto bx = px & ~(size - 1);
+		auto by = py & ~(size - 1);
+		Size result = filter == MipFilter::Min ? 0xffff : 0;
+		for(Int j = by; j < by + size; j++) {
+			for(Int i = bx; i < bx + size; i++) {
+				auto v = matrix.get(i, j, 0);
+				if(filter == MipFilter::Min) result = Tritium::Math::min(result, v);
+				else result = Tritium::Math::max(result, v);
+			}
+		}
+		return result;
+	};
+
+	for(auto filter: {MipFilter::Min, MipFilter::Max}) {
+		TiledMatrix matrix(0, 16, 4);
+		matrix.enableMips(3, filter);
+		matrix.writeRegion(x, y, width, height, 0, values.data());
+		matrix.set(x + 10, y + 10, 0, 0xffff);
+		matrix.set(x + 11, y + 30, 0, 0);
+
+		for(Size level = 1; level <= 3; level++) {
+			for(Int py = y; py < y + (Int)height; py += 3) {
+				for(Int px = x; px < x + (Int)width; px += 3) {
+					// Only test blocks that are fully inside the written area.
+					auto size = Int(1) << level;
+					auto bx = px & ~(size - 1);
+					auto by = py & ~(size - 1);
+					if(bx < x || by < y || bx + size > x + (Int)width || by + size > y + (Int)height) continue;
+
+					CAPTURE(level);
+					CAPTURE(px);
+					CAPTURE(py);
+					REQUIRE(matrix.get(px, py, level) == expected(matrix, px, py, level, filter));
+				}
+			}
+		}
+	}
+
+	SECTION("Average") {
+		TiledMatrix matrix(0, 16, 4);
+		matrix.enableMips(1, MipFilter::Average);
+		matrix.fillRegion(0, 0, 2, 2, 0, 10);
+		matrix.set(1, 1, 0, 14);
+		REQUIRE(matrix.get(0, 0, 1) == 11);
+
+		U16 read[4];
+		matrix.fillRegion(2, 0, 2, 2, 0, 3);
+		matrix.readRegion(0, 0, 4, 2, 1, read);
+		REQUIRE(read[0] == 11);
+		REQUIRE(read[1] == 3);
+	}
+
+	SECTION("coarse writes") {
+		TiledMatrix matrix(0, 16, 4);
+		matrix.enableMips(2, MipFilter::Average);
+
+		// Coarse writes set the whole block at the base detail, so they are read back at any detail.
+		matrix.set(-7, 9, 1, 500);
+		REQUIRE(matrix.get(-7, 9, 1) == 500);
+		REQUIRE(matrix.get(-8, 8, 0) == 500);
+		REQUIRE(matrix.get(-7, 9, 0) == 500);
+
+		// Details past the last level read a smaller block inside the written one.
+		matrix.set(21, -3, 3, 77);
+		REQUIRE(matrix.get(21, -3, 3) == 77);
+		REQUIRE(matrix.get(16, -8, 2) == 77);
+		REQUIRE(matrix.get(23, -1, 0) == 77);
+
+		U16 values[6] = {1, 2, 3, 4, 5, 6};
+		U16 read[6];
+		matrix.writeRegion(33, 40, 6, 4, 1, values);
+		matrix.readRegion(33, 40, 6, 4, 1, read);
+		for(Size i = 0; i < 6; i++) REQUIRE(read[i] == values[i]);
+		REQUIRE(matrix.get(37, 43, 0) == 6);
+
+		matrix.fillRegion(-31, -31, 10, 4, 2, 9);
+		REQUIRE(matrix.get(-31, -31, 2) == 9);
+		REQUIRE(matrix.get(-23, -29, 2) == 9);
+		REQUIRE(matrix.get(-32, -32, 0) == 9);
+		REQUIRE(matrix.get(-21, -29, 0) == 9);
+	}
+}
+
+TEST_CASE("TiledMatrix eviction") {
+	TiledMatrix matrix(0, 8, 4);
+	for(Int y = 0; y < 64; y++) {
+		for(Int x = 0; x < 64; x++) {
+			matrix.set(x, y, 0, (Size)(x * 3 + y) & 0xff);
+		}
+	}
+
+	auto tileBytes = matrix.memoryUsage() / 16;
+	REQUIRE(matrix.memoryUsage() == tileBytes * 16);
+
+	// Without a store the contents of evicted tiles are lost.
+	REQUIRE(matrix.evictTile(0, 0));
+	REQUIRE(!matrix.evictTile(0, 0));
+	REQUIRE(matrix.memoryUsage() == tileBytes * 15);
+	REQUIRE(matrix.get(1, 1, 0) == 0);
+	REQUIRE(matrix.memoryUsage() == tileBytes * 15);
+
+	// With a store they are reloaded when accessed.
+	auto path = tempPath("eviction-test.tiles");
+	SpillFile file(path.c_str());
+	REQUIRE(file.isOpen());
+	matrix.setStore(&file);
+
+	for(I32 y = 0; y < 4; y++) {
+		for(I32 x = 1; x < 4; x++) matrix.evictTile(x, y);
+	}
+	REQUIRE(matrix.memoryUsage() == tileBytes * 3);
+
+	for(Int y = 0; y < 64; y++) {
+		for(Int x = 16; x < 64; x++) {
+			REQUIRE(matrix.get(x, y, 0) == ((Size)(x * 3 + y) & 0xff));
+		}
+	}
+	REQUIRE(matrix.memoryUsage() == tileBytes * 15);
+
+	// Evicting again overwrites the stored tile.
+	matrix.set(20, 20, 0, 1);
+	matrix.evictTile(1, 1);
+	REQUIRE(matrix.get(20, 20, 0) == 1);
+	REQUIRE(matrix.get(21, 20, 0) == ((21 * 3 + 20) & 0xff));
+
+	matrix.setStore(nullptr);
+	remove(path.c_str());
+}
+
+TEST_CASE("TiledMatrix bilinear sampling") {
+	std::mt19937 random(7);
+	for(Size baseDetail: {0, 2}) {
+		CAPTURE(baseDetail);
+		TiledMatrix matrix(baseDetail, 16, 5);
+		auto step = Int(1) << baseDetail;
+		for(Int y = -64; y < 64; y += step) {
+			for(Int x = -64; x < 64; x += step) matrix.set(x, y, baseDetail, random() & 0xffff);
+		}
+
+		// Grids at, below and above the base detail, not aligned to the base samples.
+		for(Size detail: {0, 1, 2, 3}) {
+			CAPTURE(detail);
+			Size width = 37, height = 29;
+			std::vector<F32> values(TiledMatrix::sampleCount(width, detail) * TiledMatrix::sampleCount(height, detail));
+			matrix.sampleBilinear(-21, -13, width, height, detail, values.data());
+
+			Size i = 0;
+			for(Int y = -13; y < -13 + (Int)height; y += Int(1) << detail) {
+				for(Int x = -21; x < -21 + (Int)width; x += Int(1) << detail) {
+					CAPTURE(x);
+					CAPTURE(y);
+					REQUIRE(values[i++] == Approx(matrix.getBilinear(x, y, baseDetail)).epsilon(1e-4));
+				}
+			}
+			REQUIRE(i == values.size());
+		}
+
+		// Both dense and scattered point lists.
+		for(Int spread: {16, 4096}) {
+			std::vector<Int> xs, ys;
+			for(Size i = 0; i < 23; i++) {
+				xs.push_back((Int)(random() % (spread * 2)) - spread);
+				ys.push_back((Int)(random() % (spread * 2)) - spread);
+			}
+
+			std::vector<F32> values(xs.size());
+			matrix.sampleBilinear(xs.data(), ys.data(), xs.size(), values.data());
+			for(Size i = 0; i < xs.size(); i++) {
+				REQUIRE(values[i] == Approx(matrix.getBilinear(xs[i], ys[i], baseDetail)).epsilon(1e-4));
+			}
+		}
+	}
+}
@@ -0,0 +1,74 @@
+#include <catch.hpp>
+#include <random>
+#include <vector>
+#include "../Pipeline/Matrix.h"
+
+using namespace generator;
+
+template<class T> static void testWidth(Size itemBits) {
+	CAPTURE(itemBits);
+	CAPTURE(sizeof(T));
+
+	const Size width = 256;
+	const Size itemsPerWord = Size(1) << Tritium::Math::findLastBit(sizeof(Size) * 8 / itemBits);
+	const Size words = width / itemsPerWord;
+	auto valueBits = itemBits < sizeof(T) * 8 ? itemBits : sizeof(T) * 8;
+	auto mask = (Size(1) << itemBits) - 1;
+
+	std::mt19937_64 random(itemBits * 31 + sizeof(T));
+	std::vector<Size> packed(words);
+	for(auto& w: packed) w = random();
+
+	// Unpacking matches the scalar path.
+	{
+		std::vector<T> fast(width), scalar(width);
+		packing::unpackWords(packed.data(), words, itemBits, itemsPerWord, fast.data());
+		packing::unpackScalar(packed.data(), words, itemBits, itemsPerWord, scalar.data());
+		REQUIRE(fast == scalar);
+	}
+
+	// Packing matches the scalar path.
+	{
+		std::vector<T> values(width);
+		for(auto& v: values) v = (T)random();
+
+		std::vector<Size> fast(words), scalar(words);
+		packing::packWords(values.data(), words, itemBits, itemsPerWord, fast.data());
+		packing::packScalar(values.data(), words, itemBits, itemsPerWord, scalar.data());
+		// Bits above the last item in a word are not used.
+		auto used = Size(-1) >> (sizeof(Size) * 8 - itemsPerWord * itemBits);
+		for(Size w = 0; w < words; w++) {
+			CAPTURE(w);
+			REQUIRE((fast[w] & used) == (scalar[w] & used));
+		}
+	}
+
+	// Matrix rows match per-item access.
+	{
+		IdMatrix matrix(width, 2, 0, itemBits);
+		std::vector<T> values(width);
+		for(auto& v: values) v = (T)(random() & ((Size(1) << valueBits) - 1));
+
+		matrix.writeItems(0, 1, width, values.data());
+		for(Size x = 0; x < width; x++) {
+			CAPTURE(x);
+			REQUIRE(matrix.get(x, 1, 0) == values[x]);
+		}
+
+		// Read an unaligned run, which combines the vector and scalar paths.
+		std::vector<T> read(width - 7);
+		matrix.readItems(3, 1, read.size(), read.data());
+		for(Size i = 0; i < read.size(); i++) {
+			CAPTURE(i);
+			REQUIRE(read[i] == (T)(matrix.get(i + 3, 1, 0) & mask));
+		}
+	}
+}
+
+TEST_CASE("Packing kernels") {
+	for(Size itemBits: {2, 8, 11, 16, 32}) {
+		testWidth<U8>(itemBits);
+		testWidth<U16>(itemBits);
+		testWidth<U32>(itemBits);
+	}
+}
@@ -0,0 +1,934 @@
+#include <catch.hpp>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "../Pipeline/Pipeline.h"
+#include "../Pipeline/ThreadPool.h"
+#include "../Pipeline/Voxel.h"
+#include "../Pipeline/Biome/BiomeStage.h"
+#include "../Pipeline/Height/HeightStage.h"
+#include "../World/World.h"
+#include "../World/WorldManager.h"
+#include "TempFiles.h"
+
+using namespace generator;
+
+TEST_CASE("ThreadPool jobs") {
+	ThreadPool pool(3);
+
+	SECTION("jobs wait for their dependencies") {
+		// Each job in a chain checks that the previous one has finished.
+		std::atomic<Size> finished {0};
+		std::atomic<bool> ordered {true};
+		JobHandle previous;
+		for(Size i = 0; i < 64; i++) {
+			previous = pool.schedule([&, i] {
+				if(finished.load() != i) ordered = false;
+				finished++;
+			}, &previous, previous ? 1 : 0);
+		}
+
+		pool.wait(previous);
+		REQUIRE(previous->isDone());
+		REQUIRE(finished == 64);
+		REQUIRE(ordered);
+	}
+
+	SECTION("jobs can depend on many others") {
+		std::atomic<Size> count {0};
+		std::vector<JobHandle> jobs;
+		for(Size i = 0; i < 256; i++) {
+			jobs.push_back(pool.schedule([&] {count++;}));
+		}
+
+		Size seen = 0;
+		auto join = pool.schedule([&] {seen = count.load();}, jobs);
+		pool.wait(join);
+		REQUIRE(seen == 256);
+
+		// Depending on finished jobs is allowed.
+		auto after = pool.schedule([] {}, jobs);
+		pool.wait(after);
+		REQUIRE(after->isDone());
+	}
+
+	SECTION("jobs can schedule other jobs") {
+		std::atomic<Size> count {0};
+		std::vector<JobHandle> inner(16);
+		auto outer = pool.schedule([&] {
+			for(auto& job: inner) job = pool.schedule([&] {count++;});
+		});
+
+		pool.wait(outer);
+		for(auto& job: inner) pool.wait(job);
+		REQUIRE(count == 16);
+	}
+}
+
+TEST_CASE("ThreadPool without workers") {
+	ThreadPool pool(0);
+	bool ran = false;
+	auto job = pool.schedule([&] {ran = true;});
+	REQUIRE(!job->isDone());
+
+	pool.wait(job);
+	REQUIRE(ran);
+
+	SECTION("low priority jobs run last") {
+		std::vector<Size> order;
+		auto low = pool.schedule([&] {order.push_back(0);}, nullptr, 0, Priority::Low);
+		pool.schedule([&] {order.push_back(1);});
+		pool.schedule([&] {order.push_back(2);});
+		pool.wait(low);
+		REQUIRE(order.size() == 3);
+		REQUIRE(order.back() == 0);
+	}
+
+	SECTION("cancelled jobs finish without running") {
+		bool cancelledRan = false;
+		auto cancelled = pool.schedule([&] {cancelledRan = true;}, nullptr, 0, Priority::Low);
+		auto after = pool.schedule([] {}, &cancelled, 1);
+		REQUIRE(cancelled->cancel());
+		REQUIRE(!cancelled->cancel());
+
+		pool.wait(after);
+		REQUIRE(cancelled->isDone());
+		REQUIRE(!cancelledRan);
+
+		// Jobs that already ran can't be cancelled.
+		auto done = pool.schedule([] {});
+		pool.wait(done);
+		REQUIRE(!done->cancel());
+	}
+}
+
+/// Records whether each landmass stage was generated after the previous stage of all neighbours.
+struct StageOrderGenerator: landmass::Generator {
+	StageOrderGenerator(bool& ordered, Size& count): ordered(ordered), count(count) {}
+
+	void generate(landmass::Chunk& chunk, landmass::ChunkMatrix& matrix, I32 seed) override {
+		chunk.mapNeighbours(matrix, [&](landmass::Chunk& n) {
+			if(n.generatorStage < chunk.generatorStage) ordered = false;
+		});
+		count++;
+	}
+
+	bool& ordered;
+	Size& count;
+};
+
+static Size testHeight(Int x, Int y) {
+	return 4 + ((x * 7 + y * 13) & 15);
+}
+
+static void prepareTerrain(Pipeline& pipeline) {
+	pipeline.data.getOrCreate(Biomes, 0)->fillRegion(-4096, -4096, 8192, 8192, 0, DefaultBiome::id);
+	auto height = pipeline.data.getOrCreate(BaseHeight, 0);
+	for(Int y = -64; y < 64; y++) {
+		for(Int x = -64; x < 64; x++) height->set(x, y, 0, testHeight(x, y));
+	}
+}
+
+/// Generates the test height map, and counts the parts it generates.
+struct CountingHeight: HeightGenerator {
+	CountingHeight(std::atomic<Size>& count): count(count) {}
+
+	void generate(const Segment& segment, TiledMatrix& heightMap, TiledMatrix** auxiliaries, Pipeline& pipeline) override {
+		count++;
+		segment.map([&](Int x, Int y) {heightMap.set(x, y, segment.detail, testHeight(x, y));});
+	}
+
+	std::atomic<Size>& count;
+};
+
+/// Sets the default biome everywhere, and counts the parts it generates.
+struct CountingBiome: BiomeGenerator {
+	CountingBiome(std::atomic<Size>& count): count(count) {}
+
+	void generate(const Segment& segment, TiledMatrix& map, TiledMatrix** auxiliaries, Pipeline& pipeline) override {
+		count++;
+		map.fillRegion(segment.x, segment.y, segment.width, segment.height, segment.detail, DefaultBiome::id);
+	}
+
+	std::atomic<Size>& count;
+};
+
+static bool sameVoxels(Chunk& a, Chunk& b) {
+	for(Size z = 0; z < a.area.depth; z++) {
+		for(Size y = 0; y < a.area.height; y++) {
+			for(Size x = 0; x < a.area.width; x++) {
+				if(a.at(x, y, z).blockType != b.at(x, y, z).blockType) return false;
+			}
+		}
+	}
+	return true;
+}
+
+TEST_CASE("Pipeline chunk jobs") {
+	// A coarse filler keeps the voronoi diagrams small.
+	landmass::RandomHexFiller filler(512, 1);
+	bool ordered = true;
+	Size generated = 0;
+
+	Pipeline pipeline(filler, 1, 32, 4);
+	pipeline.landmass += std::unique_ptr<landmass::Generator>(new StageOrderGenerator(ordered, generated));
+	pipeline.landmass += std::unique_ptr<landmass::Generator>(new StageOrderGenerator(ordered, generated));
+	prepareTerrain(pipeline);
+
+	Pipeline reference(filler, 1, 32, 4);
+	prepareTerrain(reference);
+
+	const Size kCount = 6;
+	std::vector<std::unique_ptr<Chunk>> chunks;
+	std::vector<JobHandle> jobs;
+	for(Size i = 0; i < kCount; i++) {
+		chunks.emplace_back(new Chunk(Area {(I32)(i % 3), (I32)(i / 3), 0, 32, 32, 32, 0}, VoxelStorage::Palette));
+		jobs.push_back(pipeline.submit(*chunks.back()));
+	}
+
+	for(auto& job: jobs) pipeline.workers.wait(job);
+	REQUIRE(ordered);
+
+	// Landmass stages are shared between chunks, so each landmass chunk is only generated once per stage.
+	// The chunks cover 3x2 landmass chunks, and the first stage needs those and their neighbours.
+	REQUIRE(generated == 5 * 4 + 3 * 2);
+
+	// The jobs of finished landmass chunks are dropped, while their neighbours keep the stages they reached.
+	REQUIRE(pipeline.landmassJobCount() == 7 * 6 - 3 * 2);
+
+	// Chunks on finished landmass chunks don't schedule any landmass jobs again.
+	Chunk again(chunks[0]->area, VoxelStorage::Palette);
+	pipeline.workers.wait(pipeline.submit(again));
+	REQUIRE(generated == 5 * 4 + 3 * 2);
+	REQUIRE(pipeline.landmassJobCount() == 7 * 6 - 3 * 2);
+	REQUIRE(sameVoxels(again, *chunks[0]));
+
+	// The reference chunks use flat storage, which should contain the same voxels as the palettes.
+	for(Size i = 0; i < kCount; i++) {
+		Chunk expected(chunks[i]->area);
+		reference.fillChunk(expected);
+		REQUIRE(sameVoxels(*chunks[i], expected));
+	}
+}
+
+/// Blocks each landmass stage until it is released.
+struct BlockingGenerator: landmass::Generator {
+	BlockingGenerator(std::atomic<bool>& entered, std::atomic<bool>& released): entered(entered), released(released) {}
+
+	void generate(landmass::Chunk& chunk, landmass::ChunkMatrix& matrix, I32 seed) override {
+		entered = true;
+		while(!released) std::this_thread::yield();
+	}
+
+	std::atomic<bool>& entered;
+	std::atomic<bool>& released;
+};
+
+TEST_CASE("Pipeline submits beside landmass jobs") {
+	landmass::RandomHexFiller filler(512, 1);
+	std::atomic<bool> entered {false};
+	std::atomic<bool> released {false};
+
+	Pipeline pipeline(filler, 1, 32, 4, 10, 1);
+	pipeline.landmass += std::unique_ptr<landmass::Generator>(new BlockingGenerator(entered, released));
+	prepareTerrain(pipeline);
+
+	Chunk first(Area {0, 0, 0, 32, 32, 32, 0});
+	auto firstJob = pipeline.submit(first);
+	while(!entered) std::this_thread::yield();
+
+	// A landmass stage is running, and submitting a chunk on landmass chunks without jobs doesn't wait for it.
+	Chunk second(Area {4, 0, 0, 32, 32, 32, 0});
+	auto secondJob = pipeline.submit(second);
+	REQUIRE(!released);
+
+	released = true;
+	pipeline.workers.wait(firstJob);
+	pipeline.workers.wait(secondJob);
+	// Each chunk scheduled its landmass chunk and the 8 neighbours, of which only its own was finished.
+	REQUIRE(pipeline.landmassJobCount() == 2 * 9 - 2);
+}
+
+TEST_CASE("Pipeline chunk batches") {
+	// A biome that fills everything with stone, to tell it apart from the default biome.
+	// This is registered here rather than statically, as the biome registry may not be initialized yet.
+	static const BiomeId stoneBiome = registerBiome([](Chunk& chunk, Pipeline& pipeline) {
+		chunk.build([](Voxel& current, Int x, Int y, Int z) {return Voxel {2};});
+	});
+
+	landmass::RandomHexFiller filler(512, 1);
+	Pipeline pipeline(filler, 1, 32, 4);
+	prepareTerrain(pipeline);
+	pipeline.data.get(Biomes)->set(1, 0, 0, stoneBiome);
+
+	Pipeline reference(filler, 1, 32, 4);
+	prepareTerrain(reference);
+	reference.data.get(Biomes)->set(1, 0, 0, stoneBiome);
+
+	// The positions are unordered and contain duplicates, which share their landmass chunk.
+	Area areas[] = {
+		{5, 0, 0, 32, 32, 32, 0},
+		{1, 0, 0, 32, 32, 32, 0},
+		{0, 1, 0, 32, 32, 32, 0},
+		{1, 0, 0, 32, 32, 32, 0},
+		{0, 0, 0, 32, 32, 32, 0}
+	};
+
+	std::vector<std::unique_ptr<Chunk>> chunks;
+	std::vector<Chunk*> batch;
+	for(auto& area: areas) {
+		chunks.emplace_back(new Chunk(area));
+		batch.push_back(chunks.back().get());
+	}
+
+	pipeline.fillChunks(batch.data(), batch.size());
+
+	// The batch keeps the order of the provided chunks.
+	REQUIRE(batch[0]->area.x == 5);
+	REQUIRE(chunks[1]->at(0, 0, 31).blockType == 2);
+
+	for(auto& chunk: chunks) {
+		Chunk expected(chunk->area);
+		reference.fillChunk(expected);
+		REQUIRE(sameVoxels(*chunk, expected));
+	}
+}
+
+DefineStream(LazyDerived, kFirstCustomStream + 8, 16, U16);
+
+TEST_CASE("Pipeline lazy streams") {
+	landmass::RandomHexFiller filler(512, 1);
+	Pipeline pipeline(filler, 1, 32, 4);
+
+	std::atomic<Size> heights {0};
+	std::atomic<Size> biomes {0};
+	Stage heightStage;
+	heightStage += std::unique_ptr<Generator>(new CountingHeight(heights));
+	Stage biomeStage;
+	biomeStage += std::unique_ptr<Generator>(new CountingBiome(biomes));
+
+	pipeline.data.setSource(BaseHeight, heightStage, 0);
+	pipeline.data.setSource(Biomes, biomeStage, 0);
+
+	SECTION("streams are generated when required") {
+		REQUIRE(!pipeline.data.get(BaseHeight));
+		REQUIRE(!pipeline.data.isGenerated(0, 0, 16, 16));
+
+		// The region is extended to a whole coverage cell, which is generated once.
+		auto height = pipeline.data.require(BaseHeight, 8, 8, 16, 16);
+		REQUIRE(height);
+		REQUIRE(heights == 1);
+		REQUIRE(height.get(63, 63, 0) == testHeight(63, 63));
+
+		pipeline.data.require(BaseHeight, 0, 0, 64, 64);
+		REQUIRE(heights == 1);
+
+		pipeline.data.require(BaseHeight, 32, 0, 64, 16);
+		REQUIRE(heights == 2);
+		REQUIRE(pipeline.data.get(BaseHeight).get(100, 10, 0) == testHeight(100, 10));
+	}
+
+	SECTION("stages pull the streams they read") {
+		struct Derived: Generator {
+			Derived(): Generator({BaseHeight}, {LazyDerived}) {}
+			void generate(const Segment& segment, TiledMatrix** auxiliaries, Pipeline& pipeline) override {
+				auto derived = pipeline.data.get(LazyDerived);
+				segment.map([&](Int x, Int y) {derived->set(x, y, segment.detail, auxiliaries[0]->get(x, y, segment.detail) + 1);});
+			}
+		};
+
+		Stage stage;
+		stage += std::unique_ptr<Generator>(new Derived);
+		stage.generate(Segment {0, 0, 64, 64, 1.f, 0}, pipeline);
+		REQUIRE(heights == 1);
+		REQUIRE(pipeline.data.get(LazyDerived).get(5, 7, 0) == testHeight(5, 7) + 1);
+	}
+
+	SECTION("chunks generate the data they read once") {
+		// Both chunks and their biome lookups lie in the same coverage cell.
+		Chunk first(Area {0, 0, 0, 32, 32, 32, 0});
+		Chunk second(Area {1, 0, 0, 32, 32, 32, 0});
+		auto a = pipeline.submit(first);
+		auto b = pipeline.submit(second);
+		pipeline.workers.wait(a);
+		pipeline.workers.wait(b);
+
+		REQUIRE(heights == 1);
+		REQUIRE(biomes == 1);
+
+		bool matches = true;
+		for(Size y = 0; y < 32; y++) {
+			for(Size x = 0; x < 32; x++) {
+				for(Size z = 0; z < 32; z++) {
+					if((first.at(x, y, z).blockType == 1) != (z <= testHeight(x, y))) matches = false;
+					if((second.at(x, y, z).blockType == 1) != (z <= testHeight(x + 32, y))) matches = false;
+				}
+			}
+		}
+		REQUIRE(matches);
+	}
+}
+
+DefineStream(LazyFirst, kFirstCustomStream + 9, 8, U8);
+DefineStream(LazySecond, kFirstCustomStream + 10, 8, U8);
+
+/// Fills its output stream, and counts the parts it generates.
+struct CountingFill: Generator {
+	CountingFill(StreamId stream, std::atomic<Size>& count): Generator({}, {stream}), stream(stream), count(count) {}
+
+	void generate(const Segment& segment, TiledMatrix** auxiliaries, Pipeline& pipeline) override {
+		count++;
+		pipeline.data.get(stream)->fillRegion(segment.x, segment.y, segment.width, segment.height, segment.detail, 1);
+	}
+
+	StreamId stream;
+	std::atomic<Size>& count;
+};
+
+TEST_CASE("Pipeline stages beside chunk jobs") {
+	landmass::RandomHexFiller filler(512, 1);
+	Pipeline pipeline(filler, 1, 32, 4, 10, 1);
+
+	// The biome stage has several independent generators, which are run in parallel when it is generated.
+	std::atomic<Size> heights {0};
+	std::atomic<Size> biomes {0};
+	std::atomic<Size> fills {0};
+	Stage heightStage;
+	heightStage += std::unique_ptr<Generator>(new CountingHeight(heights));
+	Stage biomeStage;
+	biomeStage += std::unique_ptr<Generator>(new CountingBiome(biomes));
+	biomeStage += std::unique_ptr<Generator>(new CountingFill(LazyFirst, fills));
+	biomeStage += std::unique_ptr<Generator>(new CountingFill(LazySecond, fills));
+	pipeline.data.setSource(BaseHeight, heightStage, 0);
+	pipeline.data.setSource(Biomes, biomeStage, 0);
+
+	// Keep the only worker busy, so that the submitted chunks are still queued while another chunk is filled directly.
+	// Filling it generates the biome stage while holding the data lock, which must not run the queued chunk jobs.
+	std::atomic<bool> release {false};
+	pipeline.workers.submit([&] {while(!release) std::this_thread::yield();});
+
+	Chunk first(Area {0, 0, 0, 32, 32, 32, 0});
+	Chunk second(Area {1, 0, 0, 32, 32, 32, 0});
+	auto a = pipeline.submit(first);
+	auto b = pipeline.submit(second);
+
+	Chunk far(Area {4, 0, 0, 32, 32, 32, 0});
+	pipeline.fillChunk(far);
+	REQUIRE(!a->isDone());
+	REQUIRE(!b->isDone());
+
+	release = true;
+	pipeline.workers.wait(a);
+	pipeline.workers.wait(b);
+
+	// The far chunk generates its own cell and the one its biome is looked up in, which the other chunks share.
+	REQUIRE(heights == 2);
+	REQUIRE(biomes == 2);
+	REQUIRE(fills == 4);
+	REQUIRE(pipeline.data.get(LazySecond).get(130, 0, 0) == 1);
+
+	bool matches = true;
+	for(Size y = 0; y < 32; y++) {
+		for(Size x = 0; x < 32; x++) {
+			for(Size z = 0; z < 32; z++) {
+				if((first.at(x, y, z).blockType == 1) != (z <= testHeight(x, y))) matches = false;
+				if((second.at(x, y, z).blockType == 1) != (z <= testHeight(x + 32, y))) matches = false;
+				if((far.at(x, y, z).blockType == 1) != (z <= testHeight(x + 128, y))) matches = false;
+			}
+		}
+	}
+	REQUIRE(matches);
+}
+
+TEST_CASE("Pipeline chunk jobs with evicted mips") {
+	landmass::RandomHexFiller filler(512, 1);
+	std::atomic<Size> heights {0};
+	std::atomic<Size> biomes {0};
+	Stage heightStage;
+	heightStage += std::unique_ptr<Generator>(new CountingHeight(heights));
+	Stage biomeStage;
+	biomeStage += std::unique_ptr<Generator>(new CountingBiome(biomes));
+
+	// Small tiles spread the chunks over many of them, which are all evicted once they are old.
+	Pipeline pipeline(filler, 1, 32, 4, 6, 3);
+	Pipeline reference(filler, 1, 32, 4, 6, 0);
+	for(auto p: {&pipeline, &reference}) {
+		p->data.setSource(BaseHeight, heightStage, 0);
+		p->data.setSource(Biomes, biomeStage, 0);
+		p->data.setMips(BaseHeight, 2, MipFilter::Max);
+	}
+	pipeline.data.setMemoryBudget(1);
+
+	// Each submit trims the streams while the earlier chunks are being filled.
+	// Tiles that are evicted without a store are generated again, while the chunks that read them wait.
+	std::vector<std::unique_ptr<Chunk>> chunks;
+	std::vector<JobHandle> jobs;
+	auto submit = [&](I32 i) {
+		chunks.emplace_back(new Chunk(Area {(i % 4) * 2 - 4, (i / 4 % 4) * 2 - 4, 0, 32, 32, 32, 1}, VoxelStorage::Palette));
+		jobs.push_back(pipeline.submit(*chunks.back()));
+	};
+
+	for(I32 i = 0; i < 64; i++) {
+		submit(i);
+		if(i % 16 == 15) pipeline.workers.wait(jobs[i - 8]);
+	}
+	for(auto& job: jobs) pipeline.workers.wait(job);
+
+	// Chunks at lod 1 read the mip tiles, which are rebuilt from the level below once they are evicted.
+	pipeline.data.trim();
+	pipeline.data.trim();
+	REQUIRE(pipeline.data.readsModify());
+
+	for(I32 i = 0; i < 32; i++) submit(i);
+	for(auto& job: jobs) pipeline.workers.wait(job);
+
+	bool matches = true;
+	for(auto& chunk: chunks) {
+		Chunk expected(chunk->area);
+		reference.fillChunk(expected);
+		matches = matches && sameVoxels(*chunk, expected);
+	}
+	REQUIRE(matches);
+}
+
+TEST_CASE("Pipeline far chunks") {
+	landmass::RandomHexFiller filler(512, 1);
+	Pipeline pipeline(filler, 1, 32, 4);
+	pipeline.data.setMips(BaseHeight, 2, MipFilter::Max);
+	prepareTerrain(pipeline);
+
+	// Each pillar of a chunk at lod 1 covers 2x2 height samples, and is as high as the highest of them.
+	Chunk chunk(Area {0, 0, 0, 32, 32, 32, 1});
+	pipeline.fillChunk(chunk);
+
+	bool matches = true;
+	for(Size y = 0; y < 32; y++) {
+		for(Size x = 0; x < 32; x++) {
+			Size height = 0;
+			for(Int i = 0; i < 4; i++) height = Tritium::Math::max(height, testHeight(x * 2 + (i & 1), y * 2 + (i >> 1)));
+			for(Size z = 0; z < 32; z++) {
+				if((chunk.at(x, y, z).blockType == 1) != (z * 2 <= height)) matches = false;
+			}
+		}
+	}
+	REQUIRE(matches);
+}
+
+DefineStream(TypedHeight, kFirstCustomStream + 4, 12, U16);
+DefineStream(TypedFlag, kMaxStreams - 1, 8, bool);
+
+TEST_CASE("Typed streams") {
+	Pipeline::Data data(4);
+	static_assert(std::is_same<decltype(data.get(TypedHeight).get(0, 0, 0)), U16>::value, "Typed reads return the stream type.");
+	REQUIRE(StreamId(TypedHeight).id == kFirstCustomStream + 4);
+	REQUIRE(StreamId(TypedHeight).itemBits == 12);
+
+	REQUIRE(!data.get(TypedHeight));
+	auto height = data.getOrCreate(TypedHeight, 0);
+	REQUIRE(height);
+	height.set(3, 4, 0, 4000);
+	REQUIRE(data.get(TypedHeight).get(3, 4, 0) == 4000);
+
+	// Typed and runtime ids refer to the same slot.
+	REQUIRE(data.get(StreamId {kFirstCustomStream + 4, 12}) == height);
+
+	// Creating other streams never moves existing ones.
+	data.getOrCreate(TypedFlag, 0).set(0, 0, 0, true);
+	REQUIRE(data.get(TypedHeight) == height);
+	REQUIRE(data.get(TypedFlag).get(0, 0, 0));
+	REQUIRE(!data.get(StreamId {kMaxStreams, 8}));
+}
+
+TEST_CASE("Pipeline data trimming") {
+	Pipeline::Data data(4);
+	auto& matrix = *data.getOrCreate(StreamId {0, 8}, 0);
+	std::vector<U8> values(16 * 16);
+	for(Size i = 0; i < values.size(); i++) values[i] = (U8)(i + 1);
+	auto fill = [&](Int x, Int y) {
+		matrix.writeRegion(x, y, 16, 16, 0, values.data());
+	};
+
+	fill(0, 0);
+	auto tileBytes = data.memoryUsage();
+
+	data.trim();
+	fill(16, 0);
+	data.trim();
+	fill(32, 0);
+	data.trim();
+	fill(48, 0);
+	REQUIRE(data.memoryUsage() == tileBytes * 4);
+
+	// The two oldest tiles are evicted, while the one in use is always kept.
+	data.setMemoryBudget(tileBytes * 2);
+	data.trim();
+	REQUIRE(data.memoryUsage() == tileBytes * 2);
+	REQUIRE(matrix.get(0, 0, 0) == 0);
+	REQUIRE(matrix.get(16, 0, 0) == 0);
+	REQUIRE(matrix.get(32, 0, 0) == 1);
+	REQUIRE(matrix.get(48, 0, 0) == 1);
+
+	data.setMemoryBudget(1);
+	data.trim();
+	data.trim();
+	REQUIRE(data.memoryUsage() == 0);
+}
+
+TEST_CASE("Pipeline data trimming with mips") {
+	Pipeline::Data data(4);
+	data.setMips(StreamId {0, 8}, 2, MipFilter::Max);
+	auto& matrix = *data.getOrCreate(StreamId {0, 8}, 0);
+	auto value = [](Int x, Int y) {return (Size)(x * 3 + y) & 0xff;};
+	for(Int y = 0; y < 64; y++) {
+		for(Int x = 0; x < 64; x++) matrix.set(x, y, 0, value(x, y));
+	}
+
+	// The 16 base tiles have 4 tiles in the first level and 1 in the second, all of which count towards the budget.
+	const Size tileBytes = 16 * 16;
+	REQUIRE(data.memoryUsage() == tileBytes * 21);
+
+	// Only the mip tiles are old enough to be evicted.
+	data.trim();
+	data.trim();
+	for(Int y = 0; y < 64; y += 16) {
+		for(Int x = 0; x < 64; x += 16) matrix.get(x, y, 0);
+	}
+	data.setMemoryBudget(tileBytes * 16);
+	data.trim();
+	REQUIRE(data.memoryUsage() == tileBytes * 16);
+
+	// Evicted mip tiles are rebuilt from the base tiles when they are read.
+	for(Int y = 0; y < 64; y += 5) {
+		for(Int x = 0; x < 64; x += 5) {
+			Size highest = 0;
+			for(Int j = y & ~3; j < (y & ~3) + 4; j++) {
+				for(Int i = x & ~3; i < (x & ~3) + 4; i++) highest = Tritium::Math::max(highest, value(i, j));
+			}
+			REQUIRE(matrix.get(x, y, 2) == highest);
+		}
+	}
+	REQUIRE(data.memoryUsage() == tileBytes * 21);
+	REQUIRE(data.readsModify());
+}
+
+DefineStream(StageInput, kFirstCustomStream, 16, U16);
+DefineStream(StageDerived, kFirstCustomStream + 1, 16, U16);
+DefineStream(StageOther, kFirstCustomStream + 2, 16, U16);
+
+/// Calls a function as a stage generator.
+template<class F> struct TestGenerator: Generator {
+	TestGenerator(std::vector<StreamId>&& inputs, std::vector<StreamId>&& outputs, F f):
+		Generator(::move(inputs), ::move(outputs)), f(f) {}
+
+	void generate(const Segment& segment, TiledMatrix** auxiliaries, Pipeline& pipeline) override {
+		f(segment, auxiliaries, pipeline);
+	}
+
+	F f;
+};
+
+template<class F> std::unique_ptr<Generator> testGenerator(std::vector<StreamId>&& inputs, std::vector<StreamId>&& outputs, F f) {
+	return std::unique_ptr<Generator>(new TestGenerator<F>(::move(inputs), ::move(outputs), f));
+}
+
+TEST_CASE("Stage generator graph") {
+	landmass::GridFiller filler(16);
+	Pipeline pipeline(filler, 1, 32, 4, 5);
+	Segment segment {0, 0, 64, 64, 1.f, 0};
+
+	// Two independent generators wait for each other, which only finishes if they run at the same time.
+	std::atomic<Size> started {0};
+	std::atomic<bool> overlapped {true};
+	auto meet = [&]() {
+		started++;
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+		while(started.load() < 2) {
+			if(std::chrono::steady_clock::now() > deadline) {
+				overlapped = false;
+				return;
+			}
+			std::this_thread::yield();
+		}
+	};
+	bool parallel = pipeline.workers.size() > 0;
+
+	Stage stage;
+	stage += testGenerator({}, {StageInput}, [&](const Segment& s, TiledMatrix** aux, Pipeline& p) {
+		if(parallel) meet();
+		p.data.get(StageInput)->fillRegion(s.x, s.y, s.width, s.height, s.detail, 21);
+	});
+	stage += testGenerator({}, {StageOther}, [&](const Segment& s, TiledMatrix** aux, Pipeline& p) {
+		if(parallel) meet();
+		p.data.get(StageOther)->fillRegion(s.x, s.y, s.width, s.height, s.detail, 5);
+	});
+
+	// This one reads the first output, so it has to run after it.
+	// Catch assertions are not thread-safe, so generators only record their results.
+	bool resolved = false;
+	stage += testGenerator({StageInput}, {StageDerived}, [&](const Segment& s, TiledMatrix** aux, Pipeline& p) {
+		resolved = aux[0] == p.data.get(StageInput);
+		auto derived = p.data.get(StageDerived);
+		s.map([&](Int x, Int y) {derived->set(x, y, s.detail, aux[0]->get(x, y, s.detail) * 2);});
+	});
+
+	stage.generate(segment, pipeline);
+	REQUIRE(overlapped);
+	REQUIRE(resolved);
+	REQUIRE(pipeline.data.get(StageDerived)->get(63, 63, 0) == 42);
+	REQUIRE(pipeline.data.get(StageOther)->get(0, 0, 0) == 5);
+
+	// Generators without declared outputs run one by one, in order.
+	Size order = 0;
+	bool ordered = true;
+	Stage serial;
+	for(Size i = 0; i < 8; i++) {
+		serial += testGenerator({}, {}, [&order, &ordered, i](const Segment& s, TiledMatrix** aux, Pipeline& p) {
+			if(order != i) ordered = false;
+			order++;
+		});
+	}
+	serial.generate(segment, pipeline);
+	REQUIRE(ordered);
+	REQUIRE(order == 8);
+}
+
+DefineStream(StageCovered, kFirstCustomStream + 3, 8, U8);
+
+TEST_CASE("Stage coverage") {
+	landmass::GridFiller filler(16);
+	Pipeline pipeline(filler, 1, 32, 4, 8);
+	pipeline.data.getOrCreate(StageCovered, 0);
+
+	std::vector<Segment> parts;
+	Stage stage;
+	stage += testGenerator({}, {StageCovered}, [&](const Segment& s, TiledMatrix** aux, Pipeline& p) {
+		parts.push_back(s);
+		p.data.get(StageCovered)->fillRegion(s.x, s.y, s.width, s.height, s.detail, 1);
+	});
+
+	SECTION("parts are extended to whole cells") {
+		stage.generate(Segment {8, -8, 16, 16, 1.f, 0}, pipeline);
+		REQUIRE(parts.size() == 2);
+		REQUIRE(parts[0].x == 0);
+		REQUIRE(parts[0].y == -64);
+		REQUIRE(parts[0].width == 64);
+		REQUIRE(parts[0].height == 64);
+		REQUIRE(parts[1].y == 0);
+
+		// Overlapping requests only generate the missing cells.
+		parts.clear();
+		stage.generate(Segment {32, -32, 96, 64, 1.f, 0}, pipeline);
+		REQUIRE(parts.size() == 2);
+		REQUIRE(parts[0].x == 64);
+		REQUIRE(parts[0].width == 64);
+		REQUIRE(parts[1].y == 0);
+
+		parts.clear();
+		stage.generate(Segment {0, -64, 128, 128, 1.f, 0}, pipeline);
+		REQUIRE(parts.empty());
+		REQUIRE(pipeline.data.get(StageCovered)->get(127, 63, 0) == 1);
+	}
+
+	SECTION("each detail is covered separately") {
+		stage.generate(Segment {0, 0, 64, 64, 1.f, 2}, pipeline);
+		REQUIRE(parts.size() == 1);
+		stage.generate(Segment {0, 0, 64, 64, 1.f, 2}, pipeline);
+		REQUIRE(parts.size() == 1);
+
+		// The samples of a coarser detail are not written by a finer one, so they are generated as well.
+		auto& matrix = *pipeline.data.get(StageCovered);
+		REQUIRE(matrix.get(32, 32, 2) == 1);
+		REQUIRE(!pipeline.data.coverage(StageCovered).covers(0, 0, 64, 64, 3));
+		stage.generate(Segment {0, 0, 64, 64, 1.f, 3}, pipeline);
+		REQUIRE(parts.size() == 2);
+		REQUIRE(matrix.get(32, 32, 3) == 1);
+
+		stage.generate(Segment {0, 0, 64, 64, 1.f, 1}, pipeline);
+		REQUIRE(parts.size() == 3);
+		REQUIRE(matrix.get(32, 32, 1) == 1);
+
+		// Details above the cell size generate single samples.
+		stage.generate(Segment {0, 0, 256, 128, 1.f, 7}, pipeline);
+		REQUIRE(parts.size() == 4);
+		REQUIRE(parts[3].width == 256);
+		REQUIRE(parts[3].height == 128);
+	}
+
+	SECTION("evicted tiles are generated again") {
+		Segment segment {0, 0, 64, 64, 1.f, 0};
+		stage.generate(segment, pipeline);
+		REQUIRE(pipeline.data.coverage(StageCovered).covers(0, 0, 64, 64, 0));
+
+		pipeline.data.setMemoryBudget(1);
+		pipeline.data.trim();
+		pipeline.data.trim();
+		pipeline.data.trim();
+		REQUIRE(!pipeline.data.coverage(StageCovered).covers(0, 0, 64, 64, 0));
+
+		stage.generate(segment, pipeline);
+		REQUIRE(parts.size() == 2);
+		REQUIRE(pipeline.data.get(StageCovered)->get(0, 0, 0) == 1);
+	}
+}
+
+TEST_CASE("Stage coverage in tile files") {
+	landmass::GridFiller filler(16);
+	auto directory = tempDirectory();
+	auto path = directory + "/stream" + std::to_string(StageCovered.id) + ".tiles";
+	remove(path.c_str());
+
+	Size runs = 0;
+	Stage stage;
+	stage += testGenerator({}, {StageCovered}, [&](const Segment& s, TiledMatrix** aux, Pipeline& p) {
+		runs++;
+		p.data.get(StageCovered)->fillRegion(s.x, s.y, s.width, s.height, s.detail, 1);
+	});
+
+	auto generate = [&]() {
+		Pipeline pipeline(filler, 1, 32, 4, 8);
+		pipeline.data.setStorageDirectory(directory.c_str());
+		pipeline.data.setSource(StageCovered, stage, 0);
+		auto matrix = pipeline.data.require(StageCovered, 0, -64, 128, 128);
+		REQUIRE(matrix->get(127, 63, 0) == 1);
+		REQUIRE(matrix->get(0, -64, 0) == 1);
+		pipeline.data.flush();
+	};
+
+	generate();
+	REQUIRE(runs == 2);
+
+	// A restarted pipeline uses the coverage saved in the file, so nothing is generated again.
+	generate();
+	REQUIRE(runs == 2);
+
+	// Coverage saved for another cell size is ignored.
+	{
+		Pipeline pipeline(filler, 1, 32, 4, 8);
+		pipeline.data.setStorageDirectory(directory.c_str());
+		pipeline.data.setCoverageCell(5);
+		pipeline.data.setSource(StageCovered, stage, 0);
+		pipeline.data.require(StageCovered, 0, 0, 32, 32);
+		REQUIRE(runs == 3);
+	}
+
+	remove(path.c_str());
+}
+
+TEST_CASE("WorldManager chunk memory") {
+	landmass::RandomHexFiller filler(512, 1);
+	Pipeline pipeline(filler, 1, 32, 4);
+	prepareTerrain(pipeline);
+	WorldManager manager(2, 4, 5);
+
+	auto fetch = [&](Int x, Int y) {
+		Chunk* chunk;
+		while(!(chunk = manager.at(x, y, pipeline))) {
+			if(!pipeline.workers.runPending()) std::this_thread::yield();
+		}
+		return chunk;
+	};
+
+	auto chunk = fetch(0, 0);
+	auto used = manager.pool.usedBytes();
+	auto reserved = manager.pool.reservedBytes();
+	REQUIRE(used > 0);
+
+	REQUIRE(manager.release(0, 0));
+	REQUIRE(!manager.release(0, 0));
+	REQUIRE(manager.pool.usedBytes() < used);
+
+	// The next chunk reuses the memory of the released one.
+	REQUIRE(fetch(1, 0) == chunk);
+	REQUIRE(manager.pool.reservedBytes() == reserved);
+	REQUIRE(chunk->area.x == 1);
+}
+
+TEST_CASE("WorldManager prefetching") {
+	// The manager is declared first, so that the queued chunks are filled before it is destroyed.
+	landmass::RandomHexFiller filler(512, 1);
+	WorldManager manager(2, 4, 5);
+	Pipeline pipeline(filler, 1, 32, 4, 10, 0);
+
+	// Without workers, nothing starts until the queue is run, so prefetched chunks can always be cancelled.
+	manager.prefetch(2, 0, pipeline);
+	REQUIRE(manager.isSpeculative(2, 0));
+	REQUIRE(manager.cancel(2, 0));
+	REQUIRE(!manager.contains(2, 0));
+	REQUIRE(!manager.cancel(2, 0));
+
+	// Chunks that are needed are no longer speculative, and are kept.
+	manager.prefetch(2, 0, pipeline);
+	REQUIRE(!manager.at(2, 0, pipeline));
+	REQUIRE(!manager.isSpeculative(2, 0));
+	REQUIRE(!manager.cancel(2, 0));
+	REQUIRE(manager.contains(2, 0));
+}
+
+/// Counts the chunks that are added to the view.
+struct CountingView: ViewCallback {
+	void addChunk(Chunk& chunk) override {added++;}
+	void removeChunk(Chunk& chunk) override {}
+
+	Size added = 0;
+};
+
+TEST_CASE("World view prefetching") {
+	// Without workers, no chunk is filled during the test, so speculative chunks stay cancellable.
+	// The queued chunks are filled when the world is destroyed, which a coarse landmass keeps quick.
+	World world(1, 1, 3, 5, 4, 0, 512);
+	world.prefetchHorizon = 2;
+	auto& manager = world.getManager();
+	CountingView view;
+
+	auto move = [&](F32 x) {
+		WorldPosition position {x, 0};
+		world.updateView(&position, 1, view);
+	};
+
+	auto speculative = [&](Int x) {
+		bool all = true;
+		for(Int y = -1; y < 1; y++) all = all && manager.isSpeculative(x, y);
+		return all;
+	};
+
+	auto missing = [&](Int x) {
+		bool none = true;
+		for(Int y = -1; y < 1; y++) none = none && !manager.contains(x, y);
+		return none;
+	};
+
+	// A new viewpoint has no motion yet, so only the chunks in view are created.
+	move(0);
+	REQUIRE(manager.contains(-1, -1));
+	REQUIRE(!manager.isSpeculative(0, 0));
+	REQUIRE(missing(1));
+
+	// Moving 2 chunks per update, the chunks that come into view within the next two updates are prefetched.
+	move(2);
+	REQUIRE(manager.contains(2, 0));
+	REQUIRE(!manager.isSpeculative(2, 0));
+	REQUIRE(speculative(3));
+	REQUIRE(speculative(4));
+	REQUIRE(missing(5));
+
+	// Prefetched chunks that come into view are kept, while the path moves on.
+	move(3);
+	REQUIRE(manager.contains(3, 0));
+	REQUIRE(!manager.isSpeculative(3, 0));
+	REQUIRE(speculative(4));
+	REQUIRE(speculative(5));
+
+	// Reversing cancels the queued chunks ahead of the old heading, and prefetches the ones behind.
+	move(-2);
+	REQUIRE(missing(4));
+	REQUIRE(missing(5));
+	REQUIRE(manager.contains(3, 0));
+	REQUIRE(speculative(-5));
+	REQUIRE(speculative(-7));
+	REQUIRE(missing(-8));
+	REQUIRE(view.added == 0);
+}
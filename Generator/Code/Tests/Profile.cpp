@@ -0,0 +1,126 @@
+#include <catch.hpp>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../Pipeline/Profile.h"
+
+using namespace generator;
+
+// The zones are used directly, so that these tests don't depend on GENERATOR_PROFILE.
+static profile::Zone outerZone {"test.outer"};
+static profile::Zone innerZone {"test.inner"};
+static profile::Zone wrapZone {"test.wrap"};
+
+static const profile::ZoneStats* findStats(const std::vector<profile::ZoneStats>& stats, const char* name) {
+	for(auto& s: stats) {
+		if(!strcmp(s.name, name)) return &s;
+	}
+	return nullptr;
+}
+
+static std::string readTrace() {
+	auto file = tmpfile();
+	profile::writeTrace(file);
+
+	std::string text;
+	rewind(file);
+	char buffer[4096];
+	while(auto n = fread(buffer, 1, sizeof(buffer), file)) text.append(buffer, n);
+	fclose(file);
+	return text;
+}
+
+static Size countOf(const std::string& text, const char* pattern) {
+	Size count = 0;
+	for(auto i = text.find(pattern); i != std::string::npos; i = text.find(pattern, i + 1)) count++;
+	return count;
+}
+
+TEST_CASE("Profile zones") {
+	profile::reset();
+
+	SECTION("zones are aggregated over threads") {
+		auto work = [] {
+			for(Size i = 0; i < 100; i++) {
+				profile::Scope outer(outerZone);
+				profile::Scope inner(innerZone);
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for(Size i = 0; i < 4; i++) threads.emplace_back(work);
+		for(auto& thread: threads) thread.join();
+
+		auto stats = profile::summarize();
+		auto outer = findStats(stats, "test.outer");
+		auto inner = findStats(stats, "test.inner");
+		REQUIRE(outer);
+		REQUIRE(inner);
+		REQUIRE(outer->count == 400);
+		REQUIRE(inner->count == 400);
+		REQUIRE(outer->totalTime >= inner->totalTime);
+		REQUIRE(outer->percentile(0.5) <= (F64)outer->maxTime);
+
+		Size histogram = 0;
+		for(auto b: outer->buckets) histogram += b;
+		REQUIRE(histogram == 400);
+
+		auto trace = readTrace();
+		REQUIRE(trace.find("\"traceEvents\"") != std::string::npos);
+		REQUIRE(countOf(trace, "\"name\": \"test.outer\"") == 400);
+		REQUIRE(countOf(trace, "\"name\": \"test.inner\"") == 400);
+	}
+
+	SECTION("buffers keep the most recent events") {
+		for(Size i = 0; i < 20000; i++) {
+			profile::Scope scope(wrapZone);
+		}
+
+		auto stats = profile::summarize();
+		REQUIRE(findStats(stats, "test.wrap")->count == 20000);
+
+		auto traced = countOf(readTrace(), "\"name\": \"test.wrap\"");
+		REQUIRE(traced > 0);
+		REQUIRE(traced < 20000);
+	}
+
+	SECTION("allocations are counted inside zones") {
+		static Size allocations = 0;
+		profile::setAllocationCounter([] {return allocations;});
+		{
+			profile::Scope scope(outerZone);
+			allocations += 3;
+		}
+		profile::setAllocationCounter(nullptr);
+
+		REQUIRE(findStats(profile::summarize(), "test.outer")->allocations == 3);
+	}
+
+	SECTION("allocations are counted per thread") {
+		static thread_local Size allocations = 0;
+		profile::setAllocationCounter([] {return allocations;});
+
+		// Both zones are open while both threads allocate, so a shared count would charge each zone for both.
+		std::atomic<Size> allocated {0};
+		auto work = [&](profile::Zone& zone, Size count) {
+			profile::Scope scope(zone);
+			allocations += count;
+			allocated++;
+			while(allocated.load() < 2) std::this_thread::yield();
+		};
+
+		std::thread first(work, std::ref(outerZone), 3);
+		std::thread second(work, std::ref(innerZone), 5);
+		first.join();
+		second.join();
+		profile::setAllocationCounter(nullptr);
+
+		auto stats = profile::summarize();
+		REQUIRE(findStats(stats, "test.outer")->allocations == 3);
+		REQUIRE(findStats(stats, "test.inner")->allocations == 5);
+	}
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string>
+
+/// Returns the directory to write test files into.
+inline std::string tempDirectory() {
+#ifdef _WIN32
+	auto path = getenv("TEMP");
+#else
+	auto path = getenv("TMPDIR");
+#endif
+	return path && *path ? path : "/tmp";
+}
+
+/// Returns the path of a test file in the temporary directory.
+inline std::string tempPath(const char* name) {
+	return tempDirectory() + "/" + name;
+}
@@ -0,0 +1,62 @@
+#include <catch.hpp>
+#include <stdio.h>
+#include "../Pipeline/Matrix.h"
+#include "../Pipeline/TileFile.h"
+#include "TempFiles.h"
+
+using namespace generator;
+
+TEST_CASE("TileFile") {
+	auto path = tempPath("tilefile-test.tiles");
+	remove(path.c_str());
+	auto value = [](Int x, Int y) {return (Size)(x * 7 + y * 3) & 0xfff;};
+
+	// Enough tiles to need several index pages.
+	{
+		TileFile file(path.c_str(), 3, 12, 4, 0);
+		REQUIRE(file.isOpen());
+		REQUIRE(file.tileCount() == 0);
+
+		TiledMatrix matrix(0, 12, 4);
+		matrix.setStore(&file);
+		for(Int y = -160; y < 160; y++) {
+			for(Int x = -160; x < 160; x++) matrix.set(x, y, 0, value(x, y));
+		}
+
+		// Mapped tiles are written in place and don't use any matrix memory.
+		REQUIRE(file.tileCount() == 400);
+		REQUIRE(matrix.memoryUsage() == 0);
+		matrix.setStore(nullptr);
+	}
+
+	{
+		TileFile file(path.c_str(), 3, 12, 4, 0);
+		REQUIRE(file.tileCount() == 400);
+
+		TiledMatrix matrix(0, 12, 4);
+		matrix.enableMips(2, MipFilter::Max);
+		matrix.setStore(&file);
+		for(Int y = -160; y < 160; y++) {
+			for(Int x = -160; x < 160; x++) REQUIRE(matrix.get(x, y, 0) == value(x, y));
+		}
+		REQUIRE(matrix.get(1000, 1000, 0) == 0);
+		REQUIRE(file.tileCount() == 400);
+
+		// Mip levels are rebuilt for tiles loaded from the file.
+		Size highest = 0;
+		for(Int y = 0; y < 4; y++) {
+			for(Int x = 0; x < 4; x++) highest = Tritium::Math::max(highest, value(x, y));
+		}
+		REQUIRE(matrix.get(0, 0, 2) == highest);
+		matrix.setStore(nullptr);
+	}
+
+	// A file with a different stream format is discarded.
+	{
+		TileFile file(path.c_str(), 3, 8, 4, 0);
+		REQUIRE(file.isOpen());
+		REQUIRE(file.tileCount() == 0);
+	}
+
+	remove(path.c_str());
+}
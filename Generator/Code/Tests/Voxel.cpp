@@ -0,0 +1,293 @@
+#include <catch.hpp>
+#include <random>
+#include <thread>
+#include "../Pipeline/ChunkPool.h"
+#include "../Pipeline/Voxel.h"
+
+using namespace generator;
+
+/// Checks that two chunks contain the same voxels.
+static bool sameVoxels(const Chunk& a, const Chunk& b) {
+	for(Size z = 0; z < a.area.depth; z++) {
+		for(Size y = 0; y < a.area.height; y++) {
+			for(Size x = 0; x < a.area.width; x++) {
+				if(a.at(x, y, z) != b.at(x, y, z)) return false;
+			}
+		}
+	}
+	return true;
+}
+
+TEST_CASE("Palette chunks") {
+	Area area {0, 0, 0, 16, 16, 64, 0};
+	Chunk flat(area);
+	Chunk chunk(area, VoxelStorage::Palette);
+
+	SECTION("new chunks are uniform air") {
+		REQUIRE(chunk.paletteSize() == 1);
+		REQUIRE(chunk.at(3, 4, 5) == Voxel {0});
+		REQUIRE(sameVoxels(chunk, flat));
+		REQUIRE(chunk.memoryUsage() < flat.memoryUsage() / 100);
+	}
+
+	SECTION("indices widen as the palette grows") {
+		std::mt19937 random(1);
+		for(Size i = 0; i < 4000; i++) {
+			auto x = random() % 16, y = random() % 16, z = random() % 64;
+			Voxel voxel {random() % 40, random() % 3};
+			chunk.set(x, y, z, voxel);
+			flat.set(x, y, z, voxel);
+		}
+
+		REQUIRE(chunk.getStorage() == VoxelStorage::Palette);
+		REQUIRE(chunk.paletteSize() > 16);
+		REQUIRE(sameVoxels(chunk, flat));
+		REQUIRE(chunk.memoryUsage() < flat.memoryUsage() / 2);
+	}
+
+	SECTION("overflowing palettes become flat") {
+		for(Size z = 0; z < 64; z++) {
+			for(Size y = 0; y < 16; y++) {
+				for(Size x = 0; x < 16; x++) {
+					Voxel voxel {(x + y * 16 + z * 256) & 0xffff, z};
+					chunk.set(x, y, z, voxel);
+					flat.set(x, y, z, voxel);
+				}
+			}
+		}
+
+		REQUIRE(chunk.getStorage() == VoxelStorage::Flat);
+		REQUIRE(sameVoxels(chunk, flat));
+	}
+
+	SECTION("bulk fills") {
+		chunk.fillColumn(2, 3, 0, 10, Voxel {1});
+		chunk.fillColumn(2, 3, 10, 12, Voxel {2});
+		flat.fillColumn(2, 3, 0, 10, Voxel {1});
+		flat.fillColumn(2, 3, 10, 12, Voxel {2});
+		REQUIRE(chunk.at(2, 3, 9) == Voxel {1});
+		REQUIRE(chunk.at(2, 3, 11) == Voxel {2});
+		REQUIRE(chunk.at(2, 3, 12) == Voxel {0});
+		REQUIRE(chunk.at(3, 3, 0) == Voxel {0});
+		REQUIRE(sameVoxels(chunk, flat));
+
+		chunk.fill(Voxel {5});
+		flat.fill(Voxel {5});
+		REQUIRE(chunk.paletteSize() == 1);
+		REQUIRE(sameVoxels(chunk, flat));
+	}
+
+	SECTION("build") {
+		auto terrain = [](Voxel& current, Int x, Int y, Int z) {
+			return Voxel {z < 8 + (x ^ y) % 4 ? 1u : 0u};
+		};
+		chunk.build(terrain);
+		flat.build(terrain);
+		REQUIRE(chunk.paletteSize() == 2);
+		REQUIRE(sameVoxels(chunk, flat));
+	}
+}
+
+TEST_CASE("Column chunks") {
+	Area area {0, 0, 0, 16, 16, 64, 0};
+	Chunk flat(area);
+	Chunk chunk(area, VoxelStorage::Columns);
+
+	auto terrain = [](Voxel& current, Int x, Int y, Int z) {
+		auto height = 8 + (x ^ y) % 8;
+		return Voxel {z < 2 ? 3u : z < height ? 1u : 0u};
+	};
+
+	SECTION("runs follow writes") {
+		std::mt19937 random(2);
+		for(Size i = 0; i < 20000; i++) {
+			auto x = random() % 16, y = random() % 16, z = random() % 64;
+			Voxel voxel {random() % 3};
+			chunk.set(x, y, z, voxel);
+			flat.set(x, y, z, voxel);
+		}
+		REQUIRE(sameVoxels(chunk, flat));
+
+		for(Size i = 0; i < 2000; i++) {
+			auto x = random() % 16, y = random() % 16;
+			auto begin = random() % 64, end = random() % 65;
+			Voxel voxel {random() % 3};
+			chunk.fillColumn(x, y, begin, end, voxel);
+			flat.fillColumn(x, y, begin, end, voxel);
+		}
+		REQUIRE(sameVoxels(chunk, flat));
+	}
+
+	SECTION("height map terrain") {
+		chunk.build(terrain);
+		flat.build(terrain);
+		REQUIRE(sameVoxels(chunk, flat));
+		REQUIRE(chunk.memoryUsage() < flat.memoryUsage() / 4);
+
+		chunk.updateHeightMap();
+		flat.updateHeightMap();
+		for(Size y = 0; y < 16; y++) {
+			for(Size x = 0; x < 16; x++) {
+				REQUIRE(chunk.heightAt(x, y) == 7 + (x ^ y) % 8);
+				REQUIRE(flat.heightAt(x, y) == chunk.heightAt(x, y));
+			}
+		}
+	}
+
+	SECTION("spans") {
+		chunk.build(terrain);
+		flat.build(terrain);
+
+		// Each storage provides the same spans, with equal runs merged.
+		for(auto c: {&chunk, &flat}) {
+			std::vector<VoxelSpan> spans;
+			c->forEachSpan(5, 3, [&](const VoxelSpan& span) {spans.push_back(span);});
+			REQUIRE(spans.size() == 3);
+			REQUIRE(spans[0].voxel.blockType == 3);
+			REQUIRE(spans[0].end == 2);
+			REQUIRE(spans[1].voxel.blockType == 1);
+			REQUIRE(spans[1].begin == 2);
+			REQUIRE(spans[1].end == 14);
+			REQUIRE(spans[2].voxel.blockType == 0);
+			REQUIRE(spans[2].end == 64);
+		}
+	}
+}
+
+TEST_CASE("Voxel orders") {
+	// Bricks are padded when the chunk size is not a multiple of 4.
+	Area area {0, 0, 0, 10, 6, 13, 0};
+	Chunk reference(area);
+
+	auto terrain = [](Voxel& current, Int x, Int y, Int z) {
+		return Voxel {Size(z < 4 + (x * 3 + y) % 7 ? 1 + (x & 1) : 0)};
+	};
+
+	VoxelOrder orders[] = {VoxelOrder::XFirst, VoxelOrder::ZFirst, VoxelOrder::Bricks};
+	VoxelStorage storages[] = {VoxelStorage::Flat, VoxelStorage::Palette};
+	for(auto order: orders) {
+		for(auto storage: storages) {
+			Chunk chunk(area, storage, order);
+			REQUIRE(chunk.getOrder() == order);
+
+			chunk.build(terrain);
+			reference.build(terrain);
+			REQUIRE(sameVoxels(chunk, reference));
+
+			std::mt19937 random(3);
+			for(Size i = 0; i < 500; i++) {
+				auto x = random() % 10, y = random() % 6, z = random() % 13;
+				Voxel voxel {random() % 4};
+				chunk.set(x, y, z, voxel);
+				reference.set(x, y, z, voxel);
+			}
+			chunk.fillColumn(9, 5, 3, 13, Voxel {7});
+			reference.fillColumn(9, 5, 3, 13, Voxel {7});
+			REQUIRE(sameVoxels(chunk, reference));
+
+			// Spans are read in the native order of each chunk.
+			for(Size y = 0; y < 6; y++) {
+				for(Size x = 0; x < 10; x++) {
+					Size z = 0;
+					chunk.forEachSpan(x, y, [&](const VoxelSpan& span) {
+						REQUIRE(span.begin == z);
+						for(; z < span.end; z++) REQUIRE(reference.at(x, y, z) == span.voxel);
+					});
+					REQUIRE(z == 13);
+				}
+			}
+		}
+	}
+}
+
+TEST_CASE("Column builds") {
+	auto height = [](Int x, Int y) {return (Int)((x * 7 + y * 3) & 31) + 20;};
+
+	// Bedrock, stone and dirt layers, where the stone may be missing in low pillars.
+	auto layered = [=](Int x, Int y, ColumnLayers& layers) {
+		auto h = height(x, y);
+		layers.add(Voxel {3}, 24);
+		layers.add(Voxel {1}, h - 2);
+		layers.add(Voxel {2}, h);
+	};
+	auto voxels = [=](Voxel& current, Int x, Int y, Int z) {
+		auto h = height(x, y);
+		return Voxel {z < 24 ? 3u : z < h - 2 ? 1u : z < h ? 2u : 0u};
+	};
+
+	// Chunks above the bottom of the world, with and without lod.
+	Area areas[] = {{1, 2, 0, 16, 16, 64, 0}, {0, -1, 1, 8, 8, 16, 1}};
+	for(auto& area: areas) {
+		Chunk reference(area);
+		reference.build(voxels);
+
+		VoxelOrder orders[] = {VoxelOrder::XFirst, VoxelOrder::ZFirst, VoxelOrder::Bricks};
+		VoxelStorage storages[] = {VoxelStorage::Flat, VoxelStorage::Palette, VoxelStorage::Columns};
+		for(auto order: orders) {
+			for(auto storage: storages) {
+				Chunk chunk(area, storage, order);
+
+				// Previous contents are replaced completely.
+				chunk.fill(Voxel {9});
+				chunk.buildColumns(layered);
+				REQUIRE(sameVoxels(chunk, reference));
+			}
+		}
+	}
+}
+
+TEST_CASE("Chunk pools") {
+	ChunkPool pool;
+	Area area {0, 0, 0, 16, 16, 64, 0};
+
+	SECTION("released memory is reused") {
+		auto chunk = pool.create(area, VoxelStorage::Palette, VoxelOrder::ZFirst);
+		chunk->fillColumn(3, 4, 0, 10, Voxel {1});
+		chunk->fillColumn(3, 5, 0, 10, Voxel {2});
+		chunk->fillColumn(3, 6, 0, 10, Voxel {3});
+		auto reserved = pool.reservedBytes();
+		pool.release(chunk);
+		REQUIRE(pool.usedBytes() == 0);
+
+		for(Size i = 0; i < 100; i++) {
+			auto next = pool.create(area, VoxelStorage::Palette, VoxelOrder::ZFirst);
+			REQUIRE(next == chunk);
+			REQUIRE(next->at(3, 4, 0) == Voxel {0});
+			next->fillColumn(3, 4, 0, 10, Voxel {1 + i % 5});
+			next->fillColumn(3, 5, 0, 10, Voxel {1});
+			pool.release(next);
+		}
+		REQUIRE(pool.reservedBytes() == reserved);
+	}
+
+	SECTION("pooled chunks contain the same voxels") {
+		// Flat chunks of this size don't fit in a shared slab.
+		Area large {0, 0, 0, 32, 32, 256, 0};
+		Chunk reference(large);
+		auto chunk = pool.create(large);
+		auto terrain = [](Voxel& current, Int x, Int y, Int z) {
+			return Voxel {z < 100 + (x ^ y) ? 1u : 0u};
+		};
+
+		chunk->build(terrain);
+		reference.build(terrain);
+		REQUIRE(sameVoxels(*chunk, reference));
+		REQUIRE(pool.reservedBytes() >= large.width * large.height * large.depth * sizeof(Voxel));
+		pool.release(chunk);
+	}
+
+	SECTION("chunks can be created from several threads") {
+		std::vector<std::thread> threads;
+		for(Size t = 0; t < 4; t++) {
+			threads.emplace_back([&, t] {
+				for(Size i = 0; i < 50; i++) {
+					auto chunk = pool.create(area, VoxelStorage::Palette, VoxelOrder::ZFirst);
+					for(Size z = 0; z < 20; z++) chunk->set(t, i % 16, z, Voxel {z});
+					pool.release(chunk);
+				}
+			});
+		}
+		for(auto& thread: threads) thread.join();
+		REQUIRE(pool.usedBytes() == 0);
+	}
+}
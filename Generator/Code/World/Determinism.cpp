@@ -0,0 +1,180 @@
+#include "Determinism.h"
+#include <algorithm>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+
+namespace generator {
+namespace determinism {
+
+void Hash::add(const void* data, Size bytes) {
+    auto p = (const U8*)data;
+    for(Size i = 0; i < bytes; i++) {
+        value ^= p[i];
+        value *= 1099511628211ull;
+    }
+}
+
+U64 hashVoxels(const Chunk& chunk) {
+    Hash hash;
+    for(Size z = 0; z < chunk.area.depth; z++) {
+        for(Size y = 0; y < chunk.area.height; y++) {
+            for(Size x = 0; x < chunk.area.width; x++) {
+                auto voxel = chunk.at(x, y, z);
+                hash.add(voxel.blockType);
+                hash.add(voxel.metadata);
+                hash.add((U8)(voxel.baseLight | (voxel.skyLight << 4)));
+            }
+        }
+    }
+    return hash.value;
+}
+
+U64 hashLandmass(const landmass::Chunk& chunk, const std::vector<landmass::AttributeId>& attributes) {
+    Hash hash;
+    hash.add((U32)chunk.cellCenters.size());
+    for(auto& p: chunk.cellCenters) {
+        hash.add(p.x());
+        hash.add(p.y());
+    }
+
+    hash.add((U32)chunk.vertices.size());
+    for(auto& v: chunk.vertices) {
+        hash.add(v.x);
+        hash.add(v.y);
+    }
+
+    hash.add((U32)chunk.edges.size());
+    for(auto& e: chunk.edges) {
+        hash.add(e.a.chunkIndex);
+        hash.add(e.a.index);
+        hash.add(e.b.chunkIndex);
+        hash.add(e.b.index);
+    }
+
+    // The attributes are packed into words in the order they were registered.
+    // Only whole words are stored, so items in a partial last word are not included.
+    if(chunk.attributes.offsets) {
+        for(Size i = 0; i < attributes.size(); i++) {
+            auto& attribute = attributes[i];
+            Size count;
+            if(attribute.type == (U8)landmass::AttributeType::Cell) count = chunk.cellEdges.size();
+            else if(attribute.type == (U8)landmass::AttributeType::Edge) count = chunk.edges.size();
+            else count = chunk.vertices.size();
+
+            auto words = count >> attribute.itemShift;
+            hash.add(chunk.attributes.data + chunk.attributes.offsets[i], words * sizeof(U32));
+        }
+    }
+    return hash.value;
+}
+
+U64 hashStream(const TiledMatrix& matrix, I32 x, I32 y, U32 width, U32 height, U32 detail) {
+    Hash hash;
+    Segment {x, y, width, height, 1.f, (U8)detail}.map([&](Int column, Int row) {
+        hash.add((U64)matrix.get(column, row, detail));
+    });
+    return hash.value;
+}
+
+/// Returns the positions of a region in the provided order.
+static std::vector<Int2> orderPositions(const Region& region, const Run& run) {
+    std::vector<Int2> positions;
+    for(U32 y = 0; y < region.height; y++) {
+        for(U32 x = 0; x < region.width; x++) positions.push_back(Int2 {region.x + (I32)x, region.y + (I32)y});
+    }
+
+    if(run.order == Order::Spiral) {
+        // Sorting by the distance to the center and then by angle visits each ring in turn.
+        auto centerX = region.x * 2 + (I32)region.width - 1;
+        auto centerY = region.y * 2 + (I32)region.height - 1;
+        auto ring = [=](Int2 p) {
+            return Tritium::Math::max(Tritium::Math::abs(p.x * 2 - centerX), Tritium::Math::abs(p.y * 2 - centerY));
+        };
+        auto angle = [=](Int2 p) {
+            return atan2((F64)(p.y * 2 - centerY), (F64)(p.x * 2 - centerX));
+        };
+        std::stable_sort(positions.begin(), positions.end(), [&](Int2 a, Int2 b) {
+            auto ra = ring(a), rb = ring(b);
+            return ra < rb || (ra == rb && angle(a) < angle(b));
+        });
+    } else if(run.order == Order::Random) {
+        std::mt19937 random(run.seed);
+        std::shuffle(positions.begin(), positions.end(), random);
+    }
+    return positions;
+}
+
+std::vector<ChunkHash> generate(const Region& region, const Run& run) {
+    auto pipeline = region.createPipeline(run.threadCount);
+
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    std::vector<JobHandle> jobs;
+    for(auto p: orderPositions(region, run)) {
+        chunks.emplace_back(new Chunk(Area {p.x, p.y, 0, region.chunkWidth, region.chunkWidth, region.chunkDepth, 0}));
+        jobs.push_back(pipeline->submit(*chunks.back()));
+    }
+    for(auto& job: jobs) pipeline->workers.wait(job);
+
+    std::vector<ChunkHash> hashes;
+    auto& attributes = pipeline->landmass.usedAttributes();
+    for(auto& chunk: chunks) {
+        auto& area = chunk->area;
+        Hash streams;
+        for(auto stream: region.streams) {
+            auto matrix = pipeline->data.get(stream);
+            streams.add(stream.id);
+            if(!matrix) continue;
+
+            auto x = area.x * (I32)area.width;
+            auto y = area.y * (I32)area.height;
+            streams.add(hashStream(*matrix, x, y, (U32)area.worldWidth(), (U32)area.worldHeight(), (U32)matrix->getDetail()));
+        }
+
+        auto& land = pipeline->landmass.matrix.getChunk(area.x, area.y);
+        hashes.push_back(ChunkHash {area.x, area.y, hashVoxels(*chunk), hashLandmass(land, attributes), streams.value});
+    }
+
+    std::sort(hashes.begin(), hashes.end(), [](const ChunkHash& a, const ChunkHash& b) {
+        return a.y < b.y || (a.y == b.y && a.x < b.x);
+    });
+    return hashes;
+}
+
+static const char* orderName(Order order) {
+    switch(order) {
+        case Order::Rows: return "rows";
+        case Order::Spiral: return "spiral";
+        case Order::Random: return "random";
+    }
+    return "unknown";
+}
+
+std::vector<std::string> verify(const Region& region, const Run* runs, Size runCount) {
+    std::vector<std::string> differences;
+    if(!runCount) return differences;
+
+    auto reference = generate(region, runs[0]);
+    for(Size i = 1; i < runCount; i++) {
+        auto& run = runs[i];
+        auto hashes = generate(region, run);
+
+        for(Size c = 0; c < hashes.size(); c++) {
+            auto& a = reference[c];
+            auto& b = hashes[c];
+            const char* part = nullptr;
+            if(a.voxels != b.voxels) part = "voxels";
+            else if(a.landmass != b.landmass) part = "landmass";
+            else if(a.streams != b.streams) part = "streams";
+            if(!part) continue;
+
+            char text[160];
+            snprintf(text, sizeof(text), "chunk (%d, %d): %s differ with %zu threads in %s order (seed %u)",
+                     b.x, b.y, part, (size_t)run.threadCount, orderName(run.order), run.seed);
+            differences.push_back(text);
+        }
+    }
+    return differences;
+}
+
+}} // namespace generator::determinism
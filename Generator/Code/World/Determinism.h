@@ -0,0 +1,87 @@
+
+#ifndef GENERATOR_DETERMINISM_H
+#define GENERATOR_DETERMINISM_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../Pipeline/Pipeline.h"
+#include "../Pipeline/Voxel.h"
+
+namespace generator {
+namespace determinism {
+
+/// An FNV-1a hash over a sequence of values.
+struct Hash {
+    void add(const void* data, Size bytes);
+
+    /// Adds a scalar value. Structures may contain padding, so their fields should be added one by one.
+    template<class T> void add(T value) {add(&value, sizeof(T));}
+
+    U64 value = 14695981039346656037ull;
+};
+
+/// Returns a hash of the contents of each voxel in a chunk.
+U64 hashVoxels(const Chunk& chunk);
+
+/// Returns a hash of the voronoi diagram of a landmass chunk, and the provided attributes in it.
+U64 hashLandmass(const landmass::Chunk& chunk, const std::vector<landmass::AttributeId>& attributes);
+
+/// Returns a hash of the values in a region of a stream, sampled at the provided detail.
+U64 hashStream(const TiledMatrix& matrix, I32 x, I32 y, U32 width, U32 height, U32 detail);
+
+/// The order in which the chunks of a region are generated.
+enum class Order {
+    Rows, /// Row by row, starting at the lowest position.
+    Spiral, /// Outwards from the center of the region.
+    Random /// Shuffled with the seed of the run.
+};
+
+/// The hashes of everything that was generated for a single chunk.
+struct ChunkHash {
+    I32 x;
+    I32 y;
+    U64 voxels;
+    U64 landmass;
+    U64 streams;
+};
+
+/// Describes a region of chunks, and the pipeline it is generated with.
+struct Region {
+    I32 x;
+    I32 y;
+    U32 width; /// The number of chunks over the x-axis.
+    U32 height; /// The number of chunks over the y-axis.
+    U16 chunkWidth;
+    U16 chunkDepth;
+
+    /// Creates a new pipeline with the provided number of worker threads, set up with the generators to check.
+    /// Each run uses a new pipeline, so that nothing is reused between them.
+    std::function<std::unique_ptr<Pipeline>(Size threadCount)> createPipeline;
+
+    /// The streams that are hashed over the area of each chunk.
+    std::vector<StreamId> streams;
+};
+
+/// A single generation of a region.
+struct Run {
+    Size threadCount;
+    Order order;
+    U32 seed; /// The seed used to shuffle random orders.
+};
+
+/// Generates each chunk of a region through Pipeline::submit(), in the order of the provided run.
+/// Returns the hashes of each chunk, sorted by position.
+std::vector<ChunkHash> generate(const Region& region, const Run& run);
+
+/**
+ * Generates a region once for each run, and compares the hashes of each run with the first one.
+ * Returns a description of each chunk that differs, which is empty if generation is deterministic.
+ * The first run should be the simplest one, such as a single thread in row order.
+ */
+std::vector<std::string> verify(const Region& region, const Run* runs, Size runCount);
+
+}} // namespace generator::determinism
+
+#endif // GENERATOR_DETERMINISM_H
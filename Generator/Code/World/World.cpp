@@ -1,14 +1,19 @@
 
 #include "World.h"
 #include <Math/Math.h>
+#include <algorithm>
 
 namespace generator {
 
-World::World(I32 seed, Size drawDistance, Size regionSize, Size chunkSize, Size chunkHeight):
-    filler(128, seed),
+/// The weight of the latest movement in the velocity of a viewpoint.
+/// Lower weights are less affected by jitter, but take longer to follow a change in heading.
+static const F32 kVelocitySmoothing = 0.5f;
+
+World::World(I32 seed, Size drawDistance, Size regionSize, Size chunkSize, Size chunkHeight, Size threadCount, U32 landmassSpacing):
+    filler(landmassSpacing, seed),
     manager(regionSize, chunkSize, chunkHeight),
     drawDistance((U8)drawDistance),
-    pipeline(filler, seed, 1u << chunkSize, 1u << (7 - chunkSize)) {}
+    pipeline(filler, seed, 1u << chunkSize, 1u << (7 - chunkSize), 10, threadCount) {}
 
 void World::update(WorldPosition* positions, Size count) {
     // TODO: Update blocks and stuff.
@@ -18,18 +23,76 @@ void World::updateView(WorldPosition* positions, Size count, ViewCallback& callb
     for(Size i = 0; i < count; i++) {
         fillArea(Tritium::Math::roundInt(positions[i].x), Tritium::Math::roundInt(positions[i].y), callback);
     }
+
+    prefetch(positions, count);
+}
+
+void World::prefetch(WorldPosition* positions, Size count) {
+    // Viewpoints that are new start without any motion.
+    while(viewers.size() < count) {
+        Viewer viewer;
+        viewer.position = positions[viewers.size()];
+        viewers.push_back(viewer);
+    }
+    viewers.resize(count);
+
+    std::vector<ChunkPosition> wanted;
+    for(Size i = 0; i < count; i++) {
+        auto& viewer = viewers[i];
+        auto position = positions[i];
+        viewer.velocityX += (position.x - viewer.position.x - viewer.velocityX) * kVelocitySmoothing;
+        viewer.velocityY += (position.y - viewer.position.y - viewer.velocityY) * kVelocitySmoothing;
+        viewer.position = position;
+
+        // Viewpoints that won't move a whole chunk within the horizon don't need anything new.
+        auto speed = Tritium::Math::max(Tritium::Math::abs(viewer.velocityX), Tritium::Math::abs(viewer.velocityY));
+        if(speed * prefetchHorizon < 1.f) continue;
+
+        // Follow the predicted path one update at a time, nearest first, so that the closest chunks are generated first.
+        // Each step only adds the chunks that weren't in view at the previous one.
+        auto previousX = Tritium::Math::roundInt(position.x);
+        auto previousY = Tritium::Math::roundInt(position.y);
+        for(Size step = 1; step <= prefetchHorizon; step++) {
+            auto x = Tritium::Math::roundInt(position.x + viewer.velocityX * step);
+            auto y = Tritium::Math::roundInt(position.y + viewer.velocityY * step);
+            if(x == previousX && y == previousY) continue;
+
+            for(Int row = y - drawDistance; row < y + drawDistance; row++) {
+                for(Int column = x - drawDistance; column < x + drawDistance; column++) {
+                    auto seen = column >= previousX - drawDistance && column < previousX + drawDistance
+                             && row >= previousY - drawDistance && row < previousY + drawDistance;
+                    if(!seen) wanted.push_back(ChunkPosition {column, row});
+                }
+            }
+
+            previousX = x;
+            previousY = y;
+        }
+    }
+
+    for(auto& chunk: wanted) manager.prefetch(chunk.x, chunk.y, pipeline);
+
+    // Chunks that are no longer on any path, such as after a change in heading, are dropped if they haven't started.
+    // Chunks that came into view in the meantime are no longer speculative, and are kept.
+    auto order = [](const ChunkPosition& a, const ChunkPosition& b) {
+        return a.y < b.y || (a.y == b.y && a.x < b.x);
+    };
+    std::sort(wanted.begin(), wanted.end(), order);
+    for(auto& chunk: prefetched) {
+        if(!std::binary_search(wanted.begin(), wanted.end(), chunk, order)) manager.cancel(chunk.x, chunk.y);
+    }
+    prefetched.swap(wanted);
 }
 
 void World::fillArea(Int x, Int y, ViewCallback& callback) {
-    // TODO: Do this as a background task.
     for(Int column = x - drawDistance; column < x + drawDistance; column++) {
         for(Int row = y - drawDistance; row < y + drawDistance; row++) {
-            callback.addChunk(fetchChunk(column, row));
+            if(auto chunk = fetchChunk(column, row)) callback.addChunk(*chunk);
         }
     }
 }
 
-Chunk& World::fetchChunk(Int x, Int y) {
+Chunk* World::fetchChunk(Int x, Int y) {
     return manager.at(x, y, pipeline);
 }
 
@@ -12,19 +12,44 @@ struct ViewCallback {
 };
 
 struct World {
-    World(I32 seed, Size drawDistance = 6, Size regionSize = 7, Size chunkSize = 5, Size chunkHeight = 7);
+    /// The landmass spacing is the distance between the cells of the default landmass filler, in world units.
+    World(I32 seed, Size drawDistance = 6, Size regionSize = 7, Size chunkSize = 5, Size chunkHeight = 7,
+          Size threadCount = ThreadPool::defaultThreadCount(), U32 landmassSpacing = 128);
 
     /// Updates the generated world.
     /// @param positions A list of world locations that are currently active.
     void update(WorldPosition* positions, Size count);
 
     /// Updates the rendering of the world for the provided viewpoints.
-    /// Any missing chunks are generated around each position.
+    /// Any missing chunks are generated in the background around each position,
+    /// and added to the view by a later update once they are done.
+    /// Viewpoints are identified by their index, and should be provided in the same order each update.
+    /// Chunks that moving viewpoints are going to reach are generated speculatively, see prefetchHorizon.
     void updateView(WorldPosition* positions, Size count, ViewCallback& callback);
 
+    /// Returns the storage of the chunks in this world.
+    const WorldManager& getManager() const {return manager;}
+
 private:
+    /// The motion of a viewpoint, as tracked between view updates.
+    struct Viewer {
+        WorldPosition position;
+
+        /// The smoothed distance moved per view update, in chunks.
+        F32 velocityX = 0;
+        F32 velocityY = 0;
+    };
+
+    struct ChunkPosition {
+        Int x, y;
+    };
+
     void fillArea(Int x, Int y, ViewCallback& callback);
-    Chunk& fetchChunk(Int x, Int y);
+    Chunk* fetchChunk(Int x, Int y);
+
+    /// Updates the motion of each viewpoint, and prefetches the chunks around their predicted path.
+    /// Chunks prefetched by the previous update that are no longer on any path are cancelled if they haven't started.
+    void prefetch(WorldPosition* positions, Size count);
 
     /// The default landmass filler.
     landmass::RandomHexFiller filler;
@@ -32,12 +57,23 @@ private:
     /// Stores regions and their chunks.
     WorldManager manager;
 
+    /// The motion of each viewpoint, indexed in the order they are provided.
+    std::vector<Viewer> viewers;
+
+    /// The chunks that were prefetched by the previous view update.
+    std::vector<ChunkPosition> prefetched;
+
 public:
     /// The pipeline used to generate this world.
     Pipeline pipeline;
 
     /// The draw distance from each viewport, as a number of chunks.
     const U8 drawDistance;
+
+    /// The number of view updates to look ahead along the motion of each viewpoint.
+    /// The chunks that come into view within this many updates are generated at low priority.
+    /// A horizon of 0 disables prefetching.
+    Size prefetchHorizon = 8;
 };
 
 } // namespace generator
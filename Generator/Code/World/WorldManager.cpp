@@ -6,86 +6,102 @@ namespace generator {
 WorldManager::WorldManager(Size regionSize, Size chunkSize, Size chunkHeight):
         regionSize((U8)regionSize), chunkSize((U8)chunkSize), chunkHeight((U8)chunkHeight) {}
 
-Region& WorldManager::regionAt(Int x, Int y) {
-    auto regionX = regionIndex(x) - this->x;
-    auto regionY = regionIndex(y) - this->y;
-    if(regionX < 0 || regionY < 0 || width <= regionX || height <= regionY) {
-        resize(regionX, regionY);
-        regionX = regionIndex(x) - this->x;
-        regionY = regionIndex(y) - this->y;
-    }
+WorldManager::~WorldManager() {
+    auto chunkCount = Size(1) << (regionSize * 2);
+    regions.forEach([=](I32 x, I32 y, Region& region) {
+        for(Size i = 0; i < chunkCount; i++) {
+            pool.release(region.chunks[i]);
+        }
+        free(region.chunks);
+    });
+}
 
-    auto& region = regions[width * regionY + regionX];
+Region& WorldManager::regionAt(Int x, Int y) {
+    auto& region = regions.at((I32)regionIndex(x), (I32)regionIndex(y));
     if(region.chunks == nullptr) {
         auto size = Size(1) << regionSize;
         region.chunks = (Chunk**)calloc(size * size, sizeof(Chunk*));
+        region.jobs.resize(size * size);
+        region.speculative.resize(size * size);
     }
     return region;
 }
 
-Chunk& WorldManager::at(Int x, Int y, Pipeline& pipeline) {
+void WorldManager::create(Region& region, Size index, Int x, Int y, Pipeline& pipeline, Priority priority) {
+    auto chunkWidth = U16(1) << chunkSize;
+    Area area {(I32)x, (I32)y, 0, (U16)chunkWidth, (U16)chunkWidth, U16(1 << chunkHeight), 0};
+    region.chunks[index] = pool.create(area, voxelStorage, voxelOrder);
+    region.jobs[index] = pipeline.submit(*region.chunks[index], priority);
+    region.speculative[index] = priority == Priority::Low;
+}
+
+Chunk* WorldManager::at(Int x, Int y, Pipeline& pipeline) {
     auto& region = regionAt(x, y);
-    auto index = (Size(1) << regionSize) * indexInRegion(y) + indexInRegion(x);
-    if(region.chunks[index] == nullptr) {
-        auto chunkWidth = U16(1) << chunkSize;
-        Area area {(I32)x, (I32)y, 0, (U16)chunkWidth, (U16)chunkWidth, U16(1 << chunkHeight), 0};
-        region.chunks[index] = new Chunk(area);
-        pipeline.fillChunk(*region.chunks[index]);
+    auto index = chunkIndex(x, y);
+    if(region.chunks[index] == nullptr) create(region, index, x, y, pipeline, Priority::Normal);
+
+    auto& job = region.jobs[index];
+    if(region.speculative[index]) {
+        region.speculative[index] = false;
+
+        // A prefetched chunk that is still queued would wait for all other work, so it is submitted again instead.
+        if(job && job->cancel()) job = pipeline.submit(*region.chunks[index]);
     }
 
-    return *region.chunks[index];
+    if(job) {
+        if(!job->isDone()) return nullptr;
+        job.reset();
+    }
+
+    return region.chunks[index];
+}
+
+void WorldManager::prefetch(Int x, Int y, Pipeline& pipeline) {
+    auto& region = regionAt(x, y);
+    auto index = chunkIndex(x, y);
+    if(region.chunks[index] == nullptr) create(region, index, x, y, pipeline, Priority::Low);
 }
 
-void WorldManager::resize(Int x, Int y) {
-    auto left = Tritium::Math::min((I32)x, this->x);
-    auto right = Tritium::Math::max((I32)x + 1, this->x + width);
-    auto bottom = Tritium::Math::min((I32)y, this->y);
-    auto top = Tritium::Math::max((I32)y + 1, this->y + height);
+bool WorldManager::cancel(Int x, Int y) {
+    auto region = regions.find((I32)regionIndex(x), (I32)regionIndex(y));
+    if(!region || !region->chunks) return false;
 
-    auto w = right - left;
-    auto h = top - bottom;
-    auto dx = (Size)(this->x - left);
-    auto dy = (Size)(this->y - bottom);
+    auto index = chunkIndex(x, y);
+    if(!region->speculative[index] || !region->jobs[index]->cancel()) return false;
 
-    auto newRegions = (Region*)malloc(sizeof(Region) * w * h);
+    pool.release(region->chunks[index]);
+    region->chunks[index] = nullptr;
+    region->jobs[index].reset();
+    region->speculative[index] = false;
+    return true;
+}
 
-    // Initialize new rows below the existing data.
-    for(Size row = 0; row < dy; row++) {
-        for(Size column = 0; column < w; column++) {
-            new (newRegions + row * w + column) Region;
-        }
-    }
+bool WorldManager::contains(Int x, Int y) const {
+    auto region = regions.find((I32)regionIndex(x), (I32)regionIndex(y));
+    return region && region->chunks && region->chunks[chunkIndex(x, y)];
+}
 
-    // Initialize the area with existing rows.
-    for(Size row = 0; row < height; row++) {
-        // Initialize new values before the row.
-        for(Size column = 0; column < dx; column++) {
-            new (newRegions + (dy + row) * w + column) Region;
-        }
+bool WorldManager::isSpeculative(Int x, Int y) const {
+    auto region = regions.find((I32)regionIndex(x), (I32)regionIndex(y));
+    return region && region->chunks && region->speculative[chunkIndex(x, y)];
+}
 
-        // Copy the existing row.
-        memcpy(newRegions + (row + dy) * w + dx, regions + row * width, sizeof(Region) * width);
+bool WorldManager::release(Int x, Int y) {
+    auto region = regions.find((I32)regionIndex(x), (I32)regionIndex(y));
+    if(!region || !region->chunks) return false;
 
-        // Initialize new values at the end of the row.
-        for(Size column = dx + width; column < w; column++) {
-            new (newRegions + row * w + column) Region;
-        }
-    }
+    auto index = chunkIndex(x, y);
+    if(!region->chunks[index]) return false;
 
-    // Initialize new rows above the existing data.
-    for(Size row = height + dy; row < h; row++) {
-        for(Size column = 0; column < w; column++) {
-            new (newRegions + row * w + column) Region;
-        }
-    }
+    // A job that hasn't started yet is cancelled, while a running one has to finish first.
+    auto& job = region->jobs[index];
+    if(job && !job->isDone() && !job->cancel()) return false;
 
-    // Update the matrix state.
-    free(regions);
-    regions = newRegions;
-    this->x = (I32)left;
-    this->y = (I32)bottom;
-    width = (U16)w;
-    height = (U16)h;
+    pool.release(region->chunks[index]);
+    region->chunks[index] = nullptr;
+    job.reset();
+    region->speculative[index] = false;
+    return true;
 }
 
-} // namespace generator
\ No newline at end of file
+} // namespace generator
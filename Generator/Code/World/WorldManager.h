@@ -2,8 +2,10 @@
 #ifndef GENERATOR_WORLDMANAGER_H
 #define GENERATOR_WORLDMANAGER_H
 
+#include "../Pipeline/ChunkPool.h"
 #include "../Pipeline/Pipeline.h"
 #include "../Pipeline/Voxel.h"
+#include "../Pipeline/TileMap.h"
 
 namespace generator {
 
@@ -13,15 +15,60 @@ struct WorldPosition {
 
 struct Region {
     Chunk** chunks = nullptr;
+
+    /// The job filling each chunk, until it is known to be done.
+    std::vector<JobHandle> jobs;
+
+    /// Set for chunks that are filled speculatively, until they are needed.
+    std::vector<bool> speculative;
 };
 
 struct WorldManager {
     WorldManager(Size regionSize, Size chunkSize, Size chunkHeight);
-    Chunk& at(Int x, Int y, Pipeline& pipeline);
+    WorldManager(const WorldManager&) = delete;
+    ~WorldManager();
+
+    /// Returns the chunk at the provided position, or null if it is still being generated.
+    /// Missing chunks are submitted to the pipeline, which must finish its jobs before this is destroyed.
+    Chunk* at(Int x, Int y, Pipeline& pipeline);
+
+    /// Starts filling the chunk at the provided position at low priority, if it doesn't exist yet.
+    /// The chunk is promoted to normal priority once it is needed through at().
+    void prefetch(Int x, Int y, Pipeline& pipeline);
+
+    /// Removes the chunk at the provided position if it was prefetched, and filling it hasn't started yet.
+    /// Returns true if the chunk was removed.
+    bool cancel(Int x, Int y);
+
+    /// Checks if the chunk at the provided position exists, whether or not it is done.
+    bool contains(Int x, Int y) const;
+
+    /// Checks if the chunk at the provided position is being filled speculatively, and hasn't been needed yet.
+    bool isSpeculative(Int x, Int y) const;
+
+    /// Removes the chunk at the provided position and returns its memory to the pool, once it is no longer needed.
+    /// Chunks that are being filled cannot be removed. Returns true if the chunk was removed.
+    bool release(Int x, Int y);
+
+    /// The storage used for new chunks. Most chunks contain few distinct voxels, so palettes keep them small.
+    VoxelStorage voxelStorage = VoxelStorage::Palette;
+
+    /// The voxel order used for new chunks. Biomes mostly generate whole pillars, which are contiguous in this order.
+    VoxelOrder voxelOrder = VoxelOrder::ZFirst;
+
+    /// The memory of each chunk is allocated from this pool, and reused after it is released.
+    ChunkPool pool;
 
 private:
     Region& regionAt(Int x, Int y);
-    void resize(Int x, Int y);
+
+    /// Returns the index of the provided chunk position within its region.
+    Size chunkIndex(Int x, Int y) const {
+        return (Size(1) << regionSize) * indexInRegion(y) + indexInRegion(x);
+    }
+
+    /// Creates the chunk at the provided position and submits it to the pipeline.
+    void create(Region& region, Size index, Int x, Int y, Pipeline& pipeline, Priority priority);
 
     Int regionIndex(Int position) const {
         return position >> regionSize;
@@ -31,14 +78,8 @@ private:
         return position & ((Int(1) << regionSize) - 1);
     }
 
-    /// A rectangle of region pointers.
-    Region* regions = nullptr;
-
-    /// The current region area.
-    I32 x = 0;
-    I32 y = 0;
-    U16 width = 0;
-    U16 height = 0;
+    /// The regions that have been created, indexed by region position.
+    TileMap<Region> regions;
 
     /// The number of chunks in a region, as a power of 2.
     const U8 regionSize;